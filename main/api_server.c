@@ -0,0 +1,975 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include "cJSON.h"
+#include "flash_data.h"
+#include "config.h"
+#include "api_server.h"
+#include "buf_pool.h"
+#include "health_checker.h"
+#include "heartbeat.h"
+#include "check_history.h"
+#include "config_update.h"
+#include "config_store.h"
+#include "log_ring.h"
+#include "slo.h"
+#include "syslog_sink.h"
+#include "time_sync.h"
+#include "wifi_manager.h"
+
+static const char *TAG = "API_SERVER";
+
+// External functions
+extern uint32_t apply_device_config(const device_config_t* config);
+
+// Global variables
+static httpd_handle_t server = NULL;
+
+// Function prototypes
+static esp_err_t status_get_handler(httpd_req_t *req);
+static esp_err_t heartbeat_post_handler(httpd_req_t *req);
+static esp_err_t history_get_handler(httpd_req_t *req);
+static esp_err_t config_post_handler(httpd_req_t *req);
+static esp_err_t logs_get_handler(httpd_req_t *req);
+static esp_err_t log_level_get_handler(httpd_req_t *req);
+static esp_err_t log_level_post_handler(httpd_req_t *req);
+static esp_err_t stats_get_handler(httpd_req_t *req);
+static esp_err_t slo_get_handler(httpd_req_t *req);
+static esp_err_t probe_post_handler(httpd_req_t *req);
+static esp_err_t probe_get_handler(httpd_req_t *req);
+static esp_err_t send_probe_results(httpd_req_t *req, uint32_t id, const probe_now_t* results);
+static bool authorize_request(httpd_req_t *req);
+static bool request_authorized(httpd_req_t *req, const char* expected);
+static esp_err_t stream_history_csv(httpd_req_t *req);
+static esp_err_t stream_history_binary(httpd_req_t *req);
+static cJSON* paths_to_json(const health_target_config_t* target, const probe_result_t* result);
+
+void api_server_start(void)
+{
+    if (server) {
+        return;
+    }
+    
+    ESP_LOGI(TAG, "Starting execution mode API server");
+    
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = HTTP_SERVER_PORT;
+    config.max_open_sockets = API_SERVER_MAX_SOCKETS;  // Part of the socket budget in config.h
+    config.lru_purge_enable = true;
+    config.max_uri_handlers = API_SERVER_MAX_URI_HANDLERS;
+    
+    if (httpd_start(&server, &config) == ESP_OK) {
+        ESP_LOGI(TAG, "HTTP server started on port %d", HTTP_SERVER_PORT);
+        
+        httpd_uri_t status_uri = {
+            .uri = "/status",
+            .method = HTTP_GET,
+            .handler = status_get_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(server, &status_uri);
+        
+        httpd_uri_t config_uri = {
+            .uri = "/config",
+            .method = HTTP_POST,
+            .handler = config_post_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(server, &config_uri);
+        
+        // Everything but /status and /config, which the configuration server has its own of
+        api_server_register_monitoring(server);
+        
+        ESP_LOGI(TAG, "API server started successfully");
+    } else {
+        ESP_LOGE(TAG, "Failed to start HTTP server");
+    }
+}
+
+void api_server_register_monitoring(httpd_handle_t handle)
+{
+    // Also used by the configuration server while monitoring keeps running in AP+STA mode
+    httpd_uri_t heartbeat_uri = {
+        .uri = "/heartbeat",
+        .method = HTTP_POST,
+        .handler = heartbeat_post_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(handle, &heartbeat_uri);
+    
+    httpd_uri_t history_uri = {
+        .uri = "/history",
+        .method = HTTP_GET,
+        .handler = history_get_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(handle, &history_uri);
+    
+    httpd_uri_t logs_uri = {
+        .uri = "/logs",
+        .method = HTTP_GET,
+        .handler = logs_get_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(handle, &logs_uri);
+    
+    httpd_uri_t log_level_get_uri = {
+        .uri = "/logs/level",
+        .method = HTTP_GET,
+        .handler = log_level_get_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(handle, &log_level_get_uri);
+    
+    httpd_uri_t log_level_post_uri = {
+        .uri = "/logs/level",
+        .method = HTTP_POST,
+        .handler = log_level_post_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(handle, &log_level_post_uri);
+    
+    httpd_uri_t stats_uri = {
+        .uri = "/stats",
+        .method = HTTP_GET,
+        .handler = stats_get_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(handle, &stats_uri);
+    
+    httpd_uri_t slo_uri = {
+        .uri = "/slo",
+        .method = HTTP_GET,
+        .handler = slo_get_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(handle, &slo_uri);
+    
+    httpd_uri_t probe_uri = {
+        .uri = "/probe",
+        .method = HTTP_POST,
+        .handler = probe_post_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(handle, &probe_uri);
+    
+    httpd_uri_t probe_get_uri = {
+        .uri = "/probe",
+        .method = HTTP_GET,
+        .handler = probe_get_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(handle, &probe_get_uri);
+}
+
+void api_server_stop(void)
+{
+    if (server) {
+        ESP_LOGI(TAG, "Stopping API server");
+        httpd_stop(server);
+        server = NULL;
+    }
+}
+
+static esp_err_t status_get_handler(httpd_req_t *req)
+{
+    ESP_LOGD(TAG, "GET /status request");
+    
+    const device_config_t* config = config_store_acquire();
+    
+    cJSON *json = cJSON_CreateObject();
+    JSON_ADD_STRING(json, "mode", "execution");
+    JSON_ADD_STRING(json, "monitor_mode",
+                    config->monitor_mode == MONITOR_MODE_HEARTBEAT ? "heartbeat" : "poll");
+    JSON_ADD_BOOL(json, "wifi_connected", wifi_manager_is_connected());
+    wifi_manager_stats_t wifi_stats;
+    wifi_manager_get_stats(&wifi_stats);
+    if (wifi_stats.profile >= 0) {
+        JSON_ADD_STRING(json, "wifi_ssid", wifi_stats.ssid);
+        JSON_ADD_NUMBER(json, "wifi_rssi", wifi_stats.rssi);
+    }
+    JSON_ADD_BOOL(json, "time_synced", time_sync_is_synced());
+    JSON_ADD_BOOL(json, "healthy", health_checker_get_last_status());
+    JSON_ADD_STRING(json, "relay", health_checker_get_last_status() ? "on" : "off");
+    JSON_ADD_STRING(json, "version", "1.0.0");
+    JSON_ADD_STRING(json, "device", "SONOFF MINI");
+    
+    if (config->monitor_mode == MONITOR_MODE_HEARTBEAT) {
+        JSON_ADD_BOOL(json, "heartbeat_listening", heartbeat_is_listening());
+        uint32_t age_ms = heartbeat_get_last_age_ms();
+        if (age_ms == UINT32_MAX) {
+            JSON_ADD_NULL(json, "heartbeat_age_ms");
+        } else {
+            JSON_ADD_NUMBER(json, "heartbeat_age_ms", age_ms);
+        }
+    } else {
+        cJSON *targets = cJSON_CreateArray();
+        for (uint8_t i = 0; i < health_checker_get_target_count(); i++) {
+            cJSON *target = cJSON_CreateObject();
+            probe_result_t result;
+            JSON_ADD_STRING(target, "url", config->targets[i].url);
+            if (health_checker_get_target_result(i, &result)) {
+                JSON_ADD_BOOL(target, "healthy", result.healthy);
+                JSON_ADD_NUMBER(target, "status_code", result.status_code);
+                JSON_ADD_NUMBER(target, "latency_ms", result.latency_ms);
+                if (result.path_count > 0) {
+                    JSON_ADD_BOOL(target, "pipelined", result.pipelined);
+                    JSON_ADD_ITEM(target, "paths", paths_to_json(&config->targets[i], &result));
+                }
+            }
+            uint32_t ewma_ms;
+            uint8_t latency_state;
+            if (health_checker_get_target_latency(i, &ewma_ms, &latency_state)) {
+                JSON_ADD_NUMBER(target, "latency_avg_ms", ewma_ms);
+                JSON_ADD_STRING(target, "latency_state", health_checker_latency_state_name(latency_state));
+            }
+            uint32_t backoff_ms = health_checker_get_target_backoff_ms(i);
+            if (backoff_ms > 0) {
+                JSON_ADD_NUMBER(target, "backoff_ms", backoff_ms);
+            }
+            cJSON_AddItemToArray(targets, target);
+        }
+        JSON_ADD_ITEM(json, "targets", targets);
+    }
+    config_store_release(config);
+    
+    char *json_string = cJSON_Print(json);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+    
+    free(json_string);
+    cJSON_Delete(json);
+    
+    return ESP_OK;
+}
+
+static esp_err_t heartbeat_post_handler(httpd_req_t *req)
+{
+    // Token comes from the X-Heartbeat-Token header, or the raw body if absent
+    char token[MAX_HEARTBEAT_TOKEN_LENGTH + 1];
+    int token_len = 0;
+    
+    if (httpd_req_get_hdr_value_str(req, "X-Heartbeat-Token", token, sizeof(token)) == ESP_OK) {
+        token_len = strlen(token);
+    } else if (req->content_len > 0 && req->content_len < sizeof(token)) {
+        token_len = httpd_req_recv(req, token, req->content_len);
+        if (token_len <= 0) {
+            if (token_len == HTTPD_SOCK_ERR_TIMEOUT) {
+                httpd_resp_send_408(req);
+            }
+            return ESP_FAIL;
+        }
+        while (token_len > 0 && (token[token_len - 1] == '\n' || token[token_len - 1] == '\r')) {
+            token_len--;
+        }
+    }
+    token[token_len] = '\0';
+    
+    esp_err_t err = heartbeat_feed(token, token_len);
+    if (err == ESP_ERR_INVALID_STATE) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Heartbeat mode not active");
+        return ESP_OK;
+    } else if (err != ESP_OK) {
+        httpd_resp_set_status(req, "403 Forbidden");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+    
+    httpd_resp_set_status(req, "204 No Content");
+    httpd_resp_send(req, NULL, 0);
+    
+    return ESP_OK;
+}
+
+static esp_err_t history_get_handler(httpd_req_t *req)
+{
+    ESP_LOGD(TAG, "GET /history request");
+    
+    // ?format=csv (default) or ?format=bin
+    char query[32];
+    char format[8] = "csv";
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        httpd_query_key_value(query, "format", format, sizeof(format));
+    }
+    
+    if (strcmp(format, "bin") == 0) {
+        return stream_history_binary(req);
+    }
+    return stream_history_csv(req);
+}
+
+static esp_err_t config_post_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "POST /config request");
+    
+    if (!authorize_request(req)) {
+        return ESP_OK;
+    }
+    
+    if (req->content_len == 0 || req->content_len > CONFIG_APPLY_MAX_BODY) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid body size");
+        return ESP_OK;
+    }
+    
+    // Both buffers are too large for the httpd task stack
+    char *content = malloc(req->content_len + 1);
+    device_config_t *config = malloc(sizeof(device_config_t));
+    if (content == NULL || config == NULL) {
+        free(content);
+        free(config);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    
+    size_t received = 0;
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, content + received, req->content_len - received);
+        if (ret <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                httpd_resp_send_408(req);
+            }
+            free(content);
+            free(config);
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+    content[received] = '\0';
+    
+    cJSON *json = cJSON_Parse(content);
+    free(content);
+    
+    // Only the fields present in the request change
+    config_store_read(config);
+    if (json == NULL || !config_update_from_json(json, config, false)) {
+        cJSON_Delete(json);
+        free(config);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid configuration parameters");
+        return ESP_OK;
+    }
+    cJSON_Delete(json);
+    
+    uint32_t changes = apply_device_config(config);
+    free(config);
+    
+    cJSON *response = cJSON_CreateObject();
+    JSON_ADD_TRUE(response, "success");
+    cJSON *applied = cJSON_CreateArray();
+    if (changes & CONFIG_CHANGE_CHECKS) {
+        cJSON_AddItemToArray(applied, cJSON_CreateString("checks"));
+    }
+    if (changes & CONFIG_CHANGE_MODE) {
+        cJSON_AddItemToArray(applied, cJSON_CreateString("monitor_mode"));
+    }
+    if (changes & CONFIG_CHANGE_HEARTBEAT) {
+        cJSON_AddItemToArray(applied, cJSON_CreateString("heartbeat"));
+    }
+    if (changes & CONFIG_CHANGE_MQTT) {
+        cJSON_AddItemToArray(applied, cJSON_CreateString("mqtt"));
+    }
+    if (changes & CONFIG_CHANGE_SYSLOG) {
+        cJSON_AddItemToArray(applied, cJSON_CreateString("syslog"));
+    }
+    if (changes & CONFIG_CHANGE_API) {
+        cJSON_AddItemToArray(applied, cJSON_CreateString("api_token"));
+    }
+    if (changes & CONFIG_CHANGE_WIFI) {
+        cJSON_AddItemToArray(applied, cJSON_CreateString("wifi"));
+    }
+    JSON_ADD_ITEM(response, "applied", applied);
+    JSON_ADD_BOOL(response, "wifi_reconnect", (changes & CONFIG_CHANGE_WIFI) != 0);
+    
+    char *response_string = cJSON_Print(response);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response_string, strlen(response_string));
+    
+    free(response_string);
+    cJSON_Delete(response);
+    
+    return ESP_OK;
+}
+
+static esp_err_t logs_get_handler(httpd_req_t *req)
+{
+    ESP_LOGD(TAG, "GET /logs request");
+    
+    // Formatted here, on the httpd task, from records the hot path stored in binary
+    log_record_t records[4];
+    char chunk[512];
+    size_t chunk_len = 0;
+    uint32_t seq = log_ring_oldest_seq();
+    size_t count;
+    
+    httpd_resp_set_type(req, "text/plain");
+    
+    while ((count = log_ring_read(&seq, records, sizeof(records) / sizeof(records[0]))) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            char line[160];
+            int len = log_ring_format(&records[i], line, sizeof(line) - 1);
+            if (len < 0) {
+                continue;
+            }
+            line[len++] = '\n';
+            if (chunk_len + len > sizeof(chunk)) {
+                if (httpd_resp_send_chunk(req, chunk, chunk_len) != ESP_OK) {
+                    return ESP_FAIL;
+                }
+                chunk_len = 0;
+            }
+            memcpy(chunk + chunk_len, line, len);
+            chunk_len += len;
+        }
+    }
+    
+    if (chunk_len > 0 && httpd_resp_send_chunk(req, chunk, chunk_len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t log_level_get_handler(httpd_req_t *req)
+{
+    ESP_LOGD(TAG, "GET /logs/level request");
+    
+    cJSON *json = cJSON_CreateObject();
+    cJSON *levels = cJSON_CreateObject();
+    for (uint8_t i = 0; i < LOG_MOD_COUNT; i++) {
+        cJSON_AddStringToObject(levels, log_ring_module_name(i), log_ring_level_name(g_log_levels[i]));
+    }
+    JSON_ADD_ITEM(json, "levels", levels);
+    JSON_ADD_STRING(json, "compile_level", log_ring_level_name(LOG_RING_COMPILE_LEVEL));
+    
+    // Average cost per record of storing it vs formatting it, the formatting used to be paid inline
+    log_ring_stats_t stats;
+    log_ring_get_stats(&stats);
+    cJSON *ring = cJSON_CreateObject();
+    JSON_ADD_NUMBER(ring, "written", stats.written);
+    JSON_ADD_NUMBER(ring, "dropped", stats.dropped);
+    JSON_ADD_NUMBER(ring, "avg_write_us", stats.written ? stats.write_us_total / stats.written : 0);
+    JSON_ADD_NUMBER(ring, "avg_format_us", stats.formatted ? stats.format_us_total / stats.formatted : 0);
+    JSON_ADD_ITEM(json, "stats", ring);
+    
+    char *json_string = cJSON_Print(json);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+    
+    free(json_string);
+    cJSON_Delete(json);
+    
+    return ESP_OK;
+}
+
+static esp_err_t stats_get_handler(httpd_req_t *req)
+{
+    ESP_LOGD(TAG, "GET /stats request");
+    
+    const device_config_t* config = config_store_acquire();
+    
+    cJSON *json = cJSON_CreateObject();
+    cJSON *targets = cJSON_CreateArray();
+    for (uint8_t i = 0; i < health_checker_get_target_count(); i++) {
+        uint32_t counts[PROBE_REASON_COUNT];
+        probe_budget_t budget;
+        if (!health_checker_get_target_stats(i, counts, &budget)) {
+            continue;
+        }
+        
+        cJSON *target = cJSON_CreateObject();
+        JSON_ADD_STRING(target, "url", config->targets[i].url);
+        
+        cJSON *budget_json = cJSON_CreateObject();
+        JSON_ADD_NUMBER(budget_json, "connect_ms", budget.connect_ms);
+        JSON_ADD_NUMBER(budget_json, "tls_ms", budget.tls_ms);
+        JSON_ADD_NUMBER(budget_json, "first_byte_ms", budget.first_byte_ms);
+        JSON_ADD_NUMBER(budget_json, "total_ms", budget.total_ms);
+        JSON_ADD_ITEM(target, "budget", budget_json);
+        
+        cJSON *reasons = cJSON_CreateObject();
+        for (uint8_t r = 0; r < PROBE_REASON_COUNT; r++) {
+            cJSON_AddNumberToObject(reasons, probe_reason_name(r), counts[r]);
+        }
+        JSON_ADD_ITEM(target, "reasons", reasons);
+        cJSON_AddItemToArray(targets, target);
+    }
+    JSON_ADD_ITEM(json, "targets", targets);
+    config_store_release(config);
+    
+    probe_pool_stats_t stats;
+    probe_pool_get_stats(&stats);
+    cJSON *pool = cJSON_CreateObject();
+    JSON_ADD_NUMBER(pool, "submitted", stats.submitted);
+    JSON_ADD_NUMBER(pool, "dropped", stats.dropped);
+    JSON_ADD_NUMBER(pool, "expired", stats.expired);
+    JSON_ADD_NUMBER(pool, "watchdog", stats.watchdog);
+    JSON_ADD_ITEM(json, "pool", pool);
+    
+    buf_pool_stats_t buf_stats;
+    buf_pool_get_stats(&buf_stats);
+    cJSON *buffers = cJSON_CreateObject();
+    JSON_ADD_NUMBER(buffers, "size", buf_stats.size);
+    JSON_ADD_NUMBER(buffers, "count", buf_stats.count);
+    JSON_ADD_NUMBER(buffers, "in_use", buf_stats.in_use);
+    JSON_ADD_NUMBER(buffers, "peak", buf_stats.peak);
+    JSON_ADD_NUMBER(buffers, "taken", buf_stats.taken);
+    JSON_ADD_NUMBER(buffers, "waits", buf_stats.waits);
+    JSON_ADD_NUMBER(buffers, "exhausted", buf_stats.exhausted);
+    JSON_ADD_ITEM(json, "buffers", buffers);
+    
+    probe_now_stats_t probe_now_stats;
+    health_checker_get_probe_now_stats(&probe_now_stats);
+    cJSON *on_demand = cJSON_CreateObject();
+    JSON_ADD_NUMBER(on_demand, "fresh", probe_now_stats.fresh);
+    JSON_ADD_NUMBER(on_demand, "joined", probe_now_stats.joined);
+    JSON_ADD_NUMBER(on_demand, "recent", probe_now_stats.recent);
+    JSON_ADD_NUMBER(on_demand, "backoff", probe_now_stats.backoff);
+    JSON_ADD_NUMBER(on_demand, "timeouts", probe_now_stats.timeouts);
+    JSON_ADD_ITEM(json, "on_demand", on_demand);
+    
+    wifi_manager_stats_t wifi_stats;
+    wifi_manager_get_stats(&wifi_stats);
+    cJSON *wifi = cJSON_CreateObject();
+    JSON_ADD_NUMBER(wifi, "profile", wifi_stats.profile);
+    JSON_ADD_NUMBER(wifi, "link_losses", wifi_stats.link_losses);
+    JSON_ADD_NUMBER(wifi, "roams", wifi_stats.roams);
+    JSON_ADD_NUMBER(wifi, "failovers", wifi_stats.failovers);
+    JSON_ADD_NUMBER(wifi, "scans", wifi_stats.scans);
+    JSON_ADD_NUMBER(wifi, "last_recovery_ms", wifi_stats.last_recovery_ms);
+    JSON_ADD_NUMBER(wifi, "max_recovery_ms", wifi_stats.max_recovery_ms);
+    JSON_ADD_ITEM(json, "wifi", wifi);
+    
+    if (syslog_sink_is_running()) {
+        syslog_sink_stats_t syslog_stats;
+        syslog_sink_get_stats(&syslog_stats);
+        cJSON *syslog = cJSON_CreateObject();
+        JSON_ADD_NUMBER(syslog, "sent", syslog_stats.sent);
+        JSON_ADD_NUMBER(syslog, "dropped", syslog_stats.dropped);
+        JSON_ADD_NUMBER(syslog, "datagrams", syslog_stats.datagrams);
+        JSON_ADD_NUMBER(syslog, "send_errors", syslog_stats.send_errors);
+        JSON_ADD_NUMBER(syslog, "throttled", syslog_stats.throttled);
+        JSON_ADD_ITEM(json, "syslog", syslog);
+    }
+    
+    char *json_string = cJSON_Print(json);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+    
+    free(json_string);
+    cJSON_Delete(json);
+    
+    return ESP_OK;
+}
+
+static esp_err_t slo_get_handler(httpd_req_t *req)
+{
+    ESP_LOGD(TAG, "GET /slo request");
+    
+    cJSON *json = cJSON_CreateObject();
+    JSON_ADD_BOOL(json, "time_synced", time_sync_is_synced());
+    JSON_ADD_BOOL(json, "down", slo_is_down());
+    uint32_t incident_ms = slo_incident_age_ms();
+    if (incident_ms > 0) {
+        JSON_ADD_NUMBER(json, "incident_ms", incident_ms);
+    }
+    
+    cJSON *windows = cJSON_CreateObject();
+    for (uint8_t w = 0; w < SLO_WINDOW_COUNT; w++) {
+        slo_totals_t totals;
+        if (!slo_get_totals(w, &totals)) {
+            continue;
+        }
+        
+        // Only monitored time counts, time spent stopped or offline is neither up nor down
+        cJSON *window = cJSON_CreateObject();
+        uint64_t observed_ms = (uint64_t)totals.up_ms + totals.down_ms;
+        if (observed_ms > 0) {
+            JSON_ADD_NUMBER(window, "availability_pct", (double)totals.up_ms * 100.0 / observed_ms);
+        } else {
+            JSON_ADD_NULL(window, "availability_pct");
+        }
+        JSON_ADD_NUMBER(window, "up_s", totals.up_ms / 1000);
+        JSON_ADD_NUMBER(window, "down_s", totals.down_ms / 1000);
+        JSON_ADD_NUMBER(window, "detections", totals.detections);
+        JSON_ADD_NUMBER(window, "mttd_ms", totals.detections ? totals.detect_ms / totals.detections : 0);
+        JSON_ADD_NUMBER(window, "recoveries", totals.recoveries);
+        JSON_ADD_NUMBER(window, "mttr_ms", totals.recoveries ? totals.recover_ms / totals.recoveries : 0);
+        cJSON_AddItemToObject(windows, slo_window_name(w), window);
+    }
+    JSON_ADD_ITEM(json, "windows", windows);
+    
+    char *json_string = cJSON_Print(json);
+    
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+    
+    free(json_string);
+    cJSON_Delete(json);
+    
+    return ESP_OK;
+}
+
+static esp_err_t log_level_post_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "POST /logs/level request");
+    
+    if (!authorize_request(req)) {
+        return ESP_OK;
+    }
+    
+    // {"module": "PROBE", "level": "debug"}, module "*" sets all of them
+    char content[128];
+    int ret = httpd_req_recv(req, content, sizeof(content) - 1);
+    if (ret <= 0) {
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            httpd_resp_send_408(req);
+        }
+        return ESP_FAIL;
+    }
+    content[ret] = '\0';
+    
+    cJSON *json = cJSON_Parse(content);
+    cJSON *module = JSON_GET_ITEM(json, "module");
+    cJSON *level = JSON_GET_ITEM(json, "level");
+    esp_log_level_t parsed_level;
+    if (!cJSON_IsString(module) || module->valuestring == NULL ||
+        !cJSON_IsString(level) || level->valuestring == NULL ||
+        !log_ring_parse_level(level->valuestring, &parsed_level)) {
+        cJSON_Delete(json);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected module and level");
+        return ESP_OK;
+    }
+    
+    log_ring_set_level(module->valuestring, parsed_level);
+    cJSON_Delete(json);
+    
+    return log_level_get_handler(req);
+}
+
+static esp_err_t probe_post_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "POST /probe request");
+    
+    if (!authorize_request(req)) {
+        return ESP_OK;
+    }
+    
+    // ?target=N checks one target, all of them otherwise
+    uint8_t target_count = health_checker_get_target_count();
+    uint8_t mask = (1 << target_count) - 1;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "target", value, sizeof(value)) == ESP_OK) {
+        char *end;
+        long target = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || target < 0 || target >= target_count) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown target");
+            return ESP_OK;
+        }
+        mask = 1 << target;
+    }
+    
+    uint32_t id;
+    esp_err_t err = health_checker_probe_start(mask, &id);
+    if (err == ESP_ERR_NOT_FOUND) {
+        const char *message = "No targets configured";
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_send(req, message, strlen(message));
+        return ESP_OK;
+    } else if (err != ESP_OK) {
+        const char *message = "Polling not active or WiFi not connected";
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, message, strlen(message));
+        return ESP_OK;
+    }
+    
+    // Recent results and back-offs answer right away, probes are fetched with GET /probe?id=N
+    // so this task never waits on them
+    probe_now_t results[MAX_HEALTH_TARGETS];
+    bool done;
+    if (health_checker_probe_result(id, results, &done) == ESP_OK && done) {
+        return send_probe_results(req, id, results);
+    }
+    
+    char location[24];
+    snprintf(location, sizeof(location), "/probe?id=%u", id);
+    cJSON *json = cJSON_CreateObject();
+    JSON_ADD_NUMBER(json, "id", id);
+    JSON_ADD_STRING(json, "result", location);
+    char *json_string = cJSON_Print(json);
+    
+    httpd_resp_set_status(req, "202 Accepted");
+    httpd_resp_set_hdr(req, "Location", location);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+    
+    free(json_string);
+    cJSON_Delete(json);
+    
+    return ESP_OK;
+}
+
+static esp_err_t probe_get_handler(httpd_req_t *req)
+{
+    ESP_LOGD(TAG, "GET /probe request");
+    
+    char query[32];
+    char value[12];
+    char *end = value;
+    unsigned long id = 0;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "id", value, sizeof(value)) == ESP_OK) {
+        id = strtoul(value, &end, 10);
+    }
+    if (end == value || *end != '\0' || id == 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected id");
+        return ESP_OK;
+    }
+    
+    probe_now_t results[MAX_HEALTH_TARGETS];
+    bool done;
+    esp_err_t err = health_checker_probe_result(id, results, &done);
+    if (err == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown or expired id");
+        return ESP_OK;
+    } else if (err == ESP_ERR_TIMEOUT) {
+        httpd_resp_set_status(req, "504 Gateway Timeout");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    } else if (err != ESP_OK) {
+        const char *message = "Targets changed or polling stopped";
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, message, strlen(message));
+        return ESP_OK;
+    }
+    
+    if (!done) {
+        const char *message = "{\"pending\": true}";
+        httpd_resp_set_status(req, "202 Accepted");
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, message, strlen(message));
+        return ESP_OK;
+    }
+    return send_probe_results(req, id, results);
+}
+
+static esp_err_t send_probe_results(httpd_req_t *req, uint32_t id, const probe_now_t* results)
+{
+    // Every requested target backing off means nothing could be checked, tell the caller when to retry
+    bool all_backoff = true;
+    bool healthy = true;
+    uint32_t retry_after_ms = UINT32_MAX;
+    const device_config_t* config = config_store_acquire();
+    cJSON *json = cJSON_CreateObject();
+    JSON_ADD_NUMBER(json, "id", id);
+    cJSON *targets = cJSON_CreateArray();
+    for (uint8_t i = 0; i < MAX_HEALTH_TARGETS; i++) {
+        const probe_now_t* entry = &results[i];
+        if (!entry->requested) {
+            continue;
+        }
+        cJSON *target = cJSON_CreateObject();
+        JSON_ADD_NUMBER(target, "target", i);
+        JSON_ADD_STRING(target, "url", config->targets[i].url);
+        JSON_ADD_STRING(target, "source", health_checker_probe_now_source_name(entry->source));
+        if (entry->source == PROBE_NOW_BACKOFF) {
+            JSON_ADD_NUMBER(target, "retry_after_ms", entry->retry_after_ms);
+            if (entry->retry_after_ms < retry_after_ms) {
+                retry_after_ms = entry->retry_after_ms;
+            }
+        } else {
+            all_backoff = false;
+        }
+        if (entry->has_result) {
+            if (entry->source != PROBE_NOW_BACKOFF) {
+                JSON_ADD_NUMBER(target, "age_ms", entry->age_ms);
+            }
+            JSON_ADD_BOOL(target, "healthy", entry->result.healthy);
+            JSON_ADD_NUMBER(target, "status_code", entry->result.status_code);
+            JSON_ADD_NUMBER(target, "latency_ms", entry->result.latency_ms);
+            if (!entry->result.healthy) {
+                JSON_ADD_STRING(target, "reason", probe_reason_name(entry->result.reason));
+            }
+            if (entry->result.path_count > 0) {
+                JSON_ADD_BOOL(target, "pipelined", entry->result.pipelined);
+                JSON_ADD_ITEM(target, "paths", paths_to_json(&config->targets[i], &entry->result));
+            }
+            healthy = healthy && entry->result.healthy;
+        } else {
+            healthy = false;
+        }
+        cJSON_AddItemToArray(targets, target);
+    }
+    config_store_release(config);
+    JSON_ADD_BOOL(json, "healthy", healthy);
+    JSON_ADD_ITEM(json, "targets", targets);
+    
+    char *json_string = cJSON_Print(json);
+    
+    if (all_backoff && retry_after_ms != UINT32_MAX) {
+        char retry_after[12];
+        snprintf(retry_after, sizeof(retry_after), "%u", (retry_after_ms + 999) / 1000);
+        httpd_resp_set_status(req, "429 Too Many Requests");
+        httpd_resp_set_hdr(req, "Retry-After", retry_after);
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_string, strlen(json_string));
+    
+    free(json_string);
+    cJSON_Delete(json);
+    
+    return ESP_OK;
+}
+
+static bool authorize_request(httpd_req_t *req)
+{
+    // Sends the error response itself when the request is not allowed
+    const device_config_t* config = config_store_acquire();
+    bool token_set = strlen(config->api_token) > 0;
+    bool authorized = token_set && request_authorized(req, config->api_token);
+    config_store_release(config);
+    
+    if (!token_set) {
+        const char *message = "Remote configuration disabled, set api_token in configuration mode";
+        httpd_resp_set_status(req, "403 Forbidden");
+        httpd_resp_send(req, message, strlen(message));
+        return false;
+    }
+    if (!authorized) {
+        ESP_LOGW(TAG, "Rejected %s with invalid token", req->uri);
+        httpd_resp_set_status(req, "401 Unauthorized");
+        httpd_resp_set_hdr(req, "WWW-Authenticate", "Bearer");
+        httpd_resp_send(req, NULL, 0);
+        return false;
+    }
+    return true;
+}
+
+static bool request_authorized(httpd_req_t *req, const char* expected)
+{
+    // "Authorization: Bearer <token>" or "X-Api-Token: <token>"
+    char header[MAX_API_TOKEN_LENGTH + 8];
+    const char *token = NULL;
+    
+    if (httpd_req_get_hdr_value_str(req, "Authorization", header, sizeof(header)) == ESP_OK &&
+        strncmp(header, "Bearer ", 7) == 0) {
+        token = header + 7;
+    } else if (httpd_req_get_hdr_value_str(req, "X-Api-Token", header, sizeof(header)) == ESP_OK) {
+        token = header;
+    }
+    if (token == NULL || strlen(token) != strlen(expected)) {
+        return false;
+    }
+    
+    // Constant time compare, the token is a shared secret
+    uint8_t diff = 0;
+    for (size_t i = 0; token[i] != '\0'; i++) {
+        diff |= (uint8_t)(token[i] ^ expected[i]);
+    }
+    return diff == 0;
+}
+
+static esp_err_t stream_history_csv(httpd_req_t *req)
+{
+    history_record_t records[HISTORY_CHUNK_RECORDS];
+    history_cursor_t cursor;
+    char line[64];
+    char chunk[768];
+    size_t chunk_len = 0;
+    
+    httpd_resp_set_type(req, "text/csv");
+    chunk_len = snprintf(chunk, sizeof(chunk), "uptime_ms,target,healthy,status,latency_ms,reason\n");
+    
+    // Copy a few records at a time so the ring is never locked while sending
+    check_history_begin(&cursor);
+    while (1) {
+        uint32_t time_ms;
+        bool gap;
+        size_t count = check_history_read(&cursor, records, HISTORY_CHUNK_RECORDS, &time_ms, &gap);
+        if (count == 0) {
+            break;
+        }
+        
+        for (size_t i = 0; i < count; i++) {
+            const history_record_t *record = &records[i];
+            time_ms += record->dt_ds * HISTORY_TICK_MS;
+            int len = snprintf(line, sizeof(line), "%u,%d,%d,%d,%u,%s\n", time_ms,
+                               HISTORY_TARGET(record), HISTORY_HEALTHY(record) ? 1 : 0,
+                               HISTORY_STATUS(record), record->latency_ms,
+                               probe_reason_name(HISTORY_REASON(record)));
+            if (chunk_len + len > sizeof(chunk)) {
+                if (httpd_resp_send_chunk(req, chunk, chunk_len) != ESP_OK) {
+                    return ESP_FAIL;
+                }
+                chunk_len = 0;
+            }
+            memcpy(chunk + chunk_len, line, len);
+            chunk_len += len;
+        }
+    }
+    
+    if (chunk_len > 0 && httpd_resp_send_chunk(req, chunk, chunk_len) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t stream_history_binary(httpd_req_t *req)
+{
+    history_record_t records[HISTORY_CHUNK_RECORDS];
+    history_cursor_t cursor;
+    uint32_t time_ms;
+    bool gap;
+    
+    httpd_resp_set_type(req, "application/octet-stream");
+    
+    check_history_begin(&cursor);
+    size_t count = check_history_read(&cursor, records, HISTORY_CHUNK_RECORDS, &time_ms, &gap);
+    
+    // Header: "CHK1", base uptime (ms, LE), record size, reserved; then raw delta-encoded records
+    uint8_t header[12] = { 'C', 'H', 'K', '1' };
+    memcpy(&header[4], &time_ms, sizeof(time_ms));
+    header[8] = sizeof(history_record_t);
+    if (httpd_resp_send_chunk(req, (const char *)header, sizeof(header)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    
+    while (count > 0) {
+        if (httpd_resp_send_chunk(req, (const char *)records, count * sizeof(history_record_t)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        count = check_history_read(&cursor, records, HISTORY_CHUNK_RECORDS, &time_ms, &gap);
+        if (gap) {
+            // Deltas no longer chain, end the stream rather than send wrong timestamps
+            ESP_LOGW(TAG, "History overwritten while streaming, truncating");
+            break;
+        }
+    }
+    
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static cJSON* paths_to_json(const health_target_config_t* target, const probe_result_t* result)
+{
+    cJSON *paths = cJSON_CreateArray();
+    for (uint8_t k = 0; k < result->path_count; k++) {
+        const probe_path_result_t *path_result = &result->paths[k];
+        cJSON *path = cJSON_CreateObject();
+        JSON_ADD_STRING(path, "path", probe_path(target, k));
+        JSON_ADD_BOOL(path, "healthy", path_result->healthy);
+        JSON_ADD_NUMBER(path, "status_code", path_result->status_code);
+        JSON_ADD_NUMBER(path, "latency_ms", path_result->latency_ms);
+        if (!path_result->healthy) {
+            JSON_ADD_STRING(path, "reason", probe_reason_name(path_result->reason));
+        }
+        cJSON_AddItemToArray(paths, path);
+    }
+    return paths;
+}
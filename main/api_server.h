@@ -0,0 +1,11 @@
+#ifndef API_SERVER_H
+#define API_SERVER_H
+
+#include <esp_http_server.h>
+
+// Function prototypes
+void api_server_start(void);
+void api_server_stop(void);
+void api_server_register_monitoring(httpd_handle_t handle);  // Execution mode endpoints on another server
+
+#endif // API_SERVER_H
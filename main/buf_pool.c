@@ -0,0 +1,98 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "config.h"
+#include "buf_pool.h"
+
+static const char *TAG = "BUF_POOL";
+
+// Global variables
+static char s_blocks[PROBE_BUF_COUNT][PROBE_BUF_SIZE] __attribute__((aligned(4)));
+static bool s_in_use[PROBE_BUF_COUNT];
+static SemaphoreHandle_t s_free_blocks = NULL;  // Counts the blocks not in use
+static buf_pool_stats_t s_stats;
+
+void buf_pool_init(void)
+{
+    if (s_free_blocks != NULL) {
+        return;
+    }
+    
+    s_free_blocks = xSemaphoreCreateCounting(PROBE_BUF_COUNT, PROBE_BUF_COUNT);
+    if (s_free_blocks == NULL) {
+        ESP_LOGE(TAG, "Failed to create buffer pool");
+        return;
+    }
+    
+    s_stats.size = PROBE_BUF_SIZE;
+    s_stats.count = PROBE_BUF_COUNT;
+    ESP_LOGI(TAG, "Probe buffers: %d of %d bytes", PROBE_BUF_COUNT, PROBE_BUF_SIZE);
+}
+
+char* buf_pool_take(TickType_t wait)
+{
+    if (s_free_blocks == NULL) {
+        return NULL;
+    }
+    
+    // Never falls back to malloc, a caller that cannot wait fails instead
+    if (xSemaphoreTake(s_free_blocks, 0) != pdTRUE) {
+        taskENTER_CRITICAL();
+        s_stats.waits++;
+        taskEXIT_CRITICAL();
+        if (wait == 0 || xSemaphoreTake(s_free_blocks, wait) != pdTRUE) {
+            taskENTER_CRITICAL();
+            s_stats.exhausted++;
+            taskEXIT_CRITICAL();
+            return NULL;
+        }
+    }
+    
+    // The semaphore guarantees a free slot
+    char* buf = NULL;
+    taskENTER_CRITICAL();
+    for (uint8_t i = 0; i < PROBE_BUF_COUNT; i++) {
+        if (!s_in_use[i]) {
+            s_in_use[i] = true;
+            buf = s_blocks[i];
+            break;
+        }
+    }
+    s_stats.taken++;
+    s_stats.in_use++;
+    if (s_stats.in_use > s_stats.peak) {
+        s_stats.peak = s_stats.in_use;
+    }
+    taskEXIT_CRITICAL();
+    
+    return buf;
+}
+
+void buf_pool_give(char* buf)
+{
+    if (buf == NULL) {
+        return;
+    }
+    
+    if (buf < s_blocks[0] || buf >= s_blocks[0] + sizeof(s_blocks) || (buf - s_blocks[0]) % PROBE_BUF_SIZE != 0) {
+        ESP_LOGE(TAG, "Block %p is not from the pool", buf);
+        return;
+    }
+    uint8_t index = (buf - s_blocks[0]) / PROBE_BUF_SIZE;
+    
+    taskENTER_CRITICAL();
+    s_in_use[index] = false;
+    s_stats.in_use--;
+    taskEXIT_CRITICAL();
+    
+    xSemaphoreGive(s_free_blocks);
+}
+
+void buf_pool_get_stats(buf_pool_stats_t* stats)
+{
+    taskENTER_CRITICAL();
+    *stats = s_stats;
+    taskEXIT_CRITICAL();
+}
@@ -0,0 +1,25 @@
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+// Counters since boot
+typedef struct {
+    uint16_t size;       // Bytes per block
+    uint8_t count;
+    uint8_t in_use;
+    uint8_t peak;
+    uint32_t taken;
+    uint32_t waits;      // Takes that found no free block at first
+    uint32_t exhausted;  // Takes that gave up, the probe failed with no_resources
+} buf_pool_stats_t;
+
+// Function prototypes
+void buf_pool_init(void);
+char* buf_pool_take(TickType_t wait);  // A PROBE_BUF_SIZE block, NULL if none frees up within wait
+void buf_pool_give(char* buf);
+void buf_pool_get_stats(buf_pool_stats_t* stats);
+
+#endif // BUF_POOL_H
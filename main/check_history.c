@@ -0,0 +1,128 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "config.h"
+#include "check_history.h"
+
+static const char *TAG = "CHECK_HISTORY";
+
+// Packing relies on these limits
+_Static_assert(sizeof(history_record_t) == 6, "history_record_t must stay 6 bytes");
+_Static_assert(MAX_HEALTH_TARGETS <= 4, "target index is stored in 2 bits");
+_Static_assert(PROBE_REASON_COUNT <= 16, "probe reason is stored in 4 bits");
+
+// Global variables
+static history_record_t s_records[HISTORY_CAPACITY];
+static uint32_t s_total = 0;             // Records ever written, also the next sequence number
+static uint32_t s_last_time_ms = 0;      // Uptime of the newest record, quantised to HISTORY_TICK_MS
+static uint32_t s_oldest_base_ms = 0;    // Uptime the oldest record's dt_ds is relative to
+static SemaphoreHandle_t s_mutex = NULL;
+
+// Function prototypes
+static uint32_t oldest_seq(void);
+static uint32_t uptime_ms(void);
+
+void check_history_init(void)
+{
+    s_mutex = xSemaphoreCreateMutex();
+    ESP_LOGI(TAG, "History ring: %d records, %d bytes", HISTORY_CAPACITY, (int)sizeof(s_records));
+}
+
+void check_history_record(uint8_t target, const probe_result_t* result)
+{
+    uint32_t now_ms = uptime_ms();
+    
+    uint8_t reason = result->healthy ? PROBE_REASON_OK : result->reason;
+    if (!result->healthy && reason == PROBE_REASON_OK) {
+        reason = PROBE_REASON_BAD_RESPONSE;
+    }
+    int status = result->status_code;
+    if (status < 0 || status > 0x3FF) {
+        status = 0;
+    }
+    
+    history_record_t record = {
+        .latency_ms = result->latency_ms > 0xFFFF ? 0xFFFF : (uint16_t)result->latency_ms,
+        .packed = (uint16_t)(status | ((target & 0x3) << 10) | ((reason & 0xF) << 12)),
+    };
+    
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    
+    if (s_total == 0) {
+        record.dt_ds = 0;
+        s_last_time_ms = now_ms;
+        s_oldest_base_ms = now_ms;
+    } else {
+        // Advance by the quantised delta so rounding never accumulates
+        uint32_t dt_ds = (now_ms - s_last_time_ms) / HISTORY_TICK_MS;
+        if (dt_ds > 0xFFFF) {
+            dt_ds = 0xFFFF;
+        }
+        record.dt_ds = (uint16_t)dt_ds;
+        s_last_time_ms += dt_ds * HISTORY_TICK_MS;
+    }
+    
+    history_record_t* slot = &s_records[s_total % HISTORY_CAPACITY];
+    if (s_total >= HISTORY_CAPACITY) {
+        // The evicted record becomes the base of the new oldest one
+        s_oldest_base_ms += slot->dt_ds * HISTORY_TICK_MS;
+    }
+    *slot = record;
+    s_total++;
+    
+    xSemaphoreGive(s_mutex);
+}
+
+void check_history_begin(history_cursor_t* cursor)
+{
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    cursor->seq = oldest_seq();
+    cursor->time_ms = s_oldest_base_ms;
+    xSemaphoreGive(s_mutex);
+}
+
+size_t check_history_read(history_cursor_t* cursor, history_record_t* records, size_t max,
+                          uint32_t* base_time_ms, bool* gap)
+{
+    size_t count = 0;
+    
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    
+    *gap = false;
+    if ((int32_t)(cursor->seq - oldest_seq()) < 0) {
+        // Reader fell behind the writer, skip to what is still in the ring
+        cursor->seq = oldest_seq();
+        cursor->time_ms = s_oldest_base_ms;
+        *gap = true;
+    }
+    
+    *base_time_ms = cursor->time_ms;
+    while (count < max && cursor->seq != s_total) {
+        const history_record_t* record = &s_records[cursor->seq % HISTORY_CAPACITY];
+        records[count++] = *record;
+        cursor->time_ms += record->dt_ds * HISTORY_TICK_MS;
+        cursor->seq++;
+    }
+    
+    xSemaphoreGive(s_mutex);
+    
+    return count;
+}
+
+size_t check_history_count(void)
+{
+    return s_total < HISTORY_CAPACITY ? s_total : HISTORY_CAPACITY;
+}
+
+static uint32_t oldest_seq(void)
+{
+    return s_total > HISTORY_CAPACITY ? s_total - HISTORY_CAPACITY : 0;
+}
+
+static uint32_t uptime_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
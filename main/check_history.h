@@ -0,0 +1,39 @@
+#ifndef CHECK_HISTORY_H
+#define CHECK_HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "probe.h"
+
+#define HISTORY_TICK_MS 100  // Resolution of dt_ds
+
+// Compact check record, 6 bytes
+typedef struct __attribute__((packed)) {
+    uint16_t dt_ds;       // Deciseconds since the previous record, saturates at 0xFFFF
+    uint16_t latency_ms;  // Saturates at 0xFFFF
+    uint16_t packed;      // Bits 0-9 status code, 10-11 target, 12-15 probe_reason_t
+} history_record_t;
+
+#define HISTORY_STATUS(rec) ((rec)->packed & 0x3FF)
+#define HISTORY_TARGET(rec) (((rec)->packed >> 10) & 0x3)
+#define HISTORY_REASON(rec) (((rec)->packed >> 12) & 0xF)
+#define HISTORY_HEALTHY(rec) (HISTORY_REASON(rec) == PROBE_REASON_OK)
+
+// Read position, survives the ring wrapping underneath a slow reader
+typedef struct {
+    uint32_t seq;      // Sequence number of the next record to read
+    uint32_t time_ms;  // Uptime of the record before seq
+} history_cursor_t;
+
+// Function prototypes
+void check_history_init(void);
+void check_history_record(uint8_t target, const probe_result_t* result);
+void check_history_begin(history_cursor_t* cursor);
+// Copies up to max records; *base_time_ms is the uptime the first record's dt_ds is relative to.
+// Returns the number copied, *gap is set when records were overwritten before they could be read.
+size_t check_history_read(history_cursor_t* cursor, history_record_t* records, size_t max,
+                          uint32_t* base_time_ms, bool* gap);
+size_t check_history_count(void);
+
+#endif // CHECK_HISTORY_H
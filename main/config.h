@@ -20,29 +20,217 @@
 // Configuration
 #define BUTTON_PRESS_TIME_MS 5000  // 5 seconds to enter config mode
 #define DEFAULT_HEALTH_CHECK_INTERVAL_MS 30000  // 30 seconds
-#define MAX_RETRY_COUNT 3
 
 // HTTP Configuration
 #define HTTP_SERVER_PORT 80
 #define MAX_URL_LENGTH 256
 #define MAX_WIFI_SSID_LENGTH 32
 #define MAX_WIFI_PASSWORD_LENGTH 64
+#define MAX_WIFI_BACKUPS 2         // Profiles tried after wifi_ssid, in priority order
+#define MAX_WIFI_PROFILES (1 + MAX_WIFI_BACKUPS)
+#define MAX_HOST_LENGTH 64
+#define MAX_PROBE_PAYLOAD_LENGTH 32
+#define MAX_TARGET_PATHS 3         // Extra paths checked on the connection of an HTTP target
+#define MAX_TARGET_PATH_LENGTH 32
+
+// Health Check Targets
+#define MAX_HEALTH_TARGETS 4
+#define HEALTH_CHECK_TIMEOUT_MS 10000  // Default total budget per probe
+
+// Probe Phase Budgets, per-target overrides take precedence
+#define PROBE_CONNECT_TIMEOUT_MS 3000     // DNS and TCP handshake
+#define PROBE_TLS_TIMEOUT_MS 5000         // TLS handshake, https only
+#define PROBE_FIRST_BYTE_TIMEOUT_MS 5000  // From request sent to the first response byte
+#define PROBE_BUDGET_PERCENT 80           // Total budget is capped at this share of the check interval
+#define PROBE_MAX_RESPONSE 4096           // Bytes of one response (headers and skipped body), per-target override
+#define PROBE_MIN_RESPONSE 256            // Smallest max_response accepted
+
+// Latency Policy, applied to an EWMA of the latencies of healthy probes
+#define LATENCY_EWMA_SHIFT 2         // A new sample weighs 1 / (1 << shift)
+#define LATENCY_RECOVER_PERCENT 80   // A tripped state clears once the EWMA is below this share of its threshold
+
+// Wi-Fi Failover
+#define WIFI_MIN_RSSI -80                // dBm, weaker APs are only joined when nothing usable is in range
+#define WIFI_ROAM_HYSTERESIS_DB 8        // A working link only moves to an AP of the same or lower priority this much stronger
+#define WIFI_WEAK_CHECKS 3               // Consecutive readings below WIFI_MIN_RSSI before looking for another AP
+#define WIFI_LINK_CHECK_INTERVAL_MS 5000 // RSSI reading while connected, scan retry while no profile is reachable
+#define WIFI_PREFERRED_RESCAN_MS 300000  // How often a link on a backup profile looks for a better one
+#define WIFI_DIRECT_RETRIES 1            // Reconnects to the same AP before scanning, none after a beacon timeout
+#define WIFI_SCAN_DWELL_MS 80            // Active scan time per channel
+#define WIFI_SCAN_MAX_RECORDS 16
+
+// Check Scheduling
+#define SNTP_SERVER "pool.ntp.org"
+#define SCHEDULE_MAX_JITTER_MS 5000   // Random delay added to each slot, at most interval / 10
+#define SCHEDULE_RECONNECT_WINDOW_MS 30000  // Reconnect checks spread over this, at most one interval
+#define BACKOFF_MAX_MS 600000         // Cap for Retry-After and 429/503 back-off
+
+// On-demand Checks (POST /probe)
+#define PROBE_NOW_MIN_INTERVAL_MS 5000  // Per target, a younger result is returned instead of probing again
+#define PROBE_NOW_MAX_REQUESTS 4        // Requests whose results can be fetched, the oldest is dropped first
+
+// Probe Pool Configuration
+#define PROBE_POOL_WORKERS 2        // Concurrent probe tasks, also the probes' socket limit
+#define PROBE_POOL_QUEUE_LENGTH 8   // Pending probe jobs
+#define PROBE_POOL_MAX_PER_HOST 1   // Concurrent probes against the same host
+#define PROBE_POOL_TASK_STACK 4096
+#define PROBE_WATCHDOG_PERIOD_MS 500
+#define PROBE_WATCHDOG_GRACE_MS 1000  // Overrun tolerated past the deadline before a probe is abandoned
+
+// Socket Budget, checked against CONFIG_LWIP_MAX_SOCKETS at build time (DNS and SNTP use raw pcbs, no socket)
+#define SOCKETS_PROBES PROBE_POOL_WORKERS        // A probe holds one socket at a time, https included
+#define SOCKETS_HTTPD (API_SERVER_MAX_SOCKETS + 2)  // Clients plus the listen and control sockets
+#define SOCKETS_MQTT 1
+#define SOCKETS_HEARTBEAT 1
+#define SOCKETS_SYSLOG 1
+#define SOCKETS_TOTAL (SOCKETS_PROBES + SOCKETS_HTTPD + SOCKETS_MQTT + SOCKETS_HEARTBEAT + SOCKETS_SYSLOG)
+
+// Probe Buffers, fixed blocks shared by the workers instead of per-probe stack or heap buffers
+#define PROBE_BUF_SIZE 512                  // Requests, status line and headers of one HTTP probe
+#define PROBE_BUF_COUNT PROBE_POOL_WORKERS  // Fewer blocks than workers makes HTTP probes wait for one
+#define PROBE_BUF_WAIT_MS 1000              // Longest wait for a block, the connect budget also bounds it
+#define PROBE_CLIENT_BUFFER_SIZE 512        // RX and TX buffers of the SDK client used for https, each
+
+// Heartbeat (passive monitoring) Configuration
+#define HEARTBEAT_DEFAULT_PORT 5005
+#define HEARTBEAT_DEFAULT_TIMEOUT_MS 60000  // Trip relay after 60 s without a heartbeat
+#define HEARTBEAT_MIN_TIMEOUT_MS 1000
+#define MAX_HEARTBEAT_TOKEN_LENGTH 33
+#define HEARTBEAT_TASK_STACK 2048
+
+// MQTT Publishing Configuration
+#define MAX_MQTT_URI_LENGTH 128
+#define MAX_MQTT_TOPIC_LENGTH 64
+#define MQTT_TOPIC_PREFIX "sonoff-monitor"     // Default prefix, device MAC is appended
+#define MQTT_QUEUE_LENGTH 16
+#define MQTT_BATCH_MAX_RESULTS 16              // Results per batched message
+#define MQTT_BATCH_INTERVAL_MS 30000           // Flush batched results at least this often
+#define MQTT_MIN_PUBLISH_INTERVAL_MS 5000      // Rate limit for batched messages
+#define MQTT_TASK_STACK 3072
+
+// Remote Syslog Configuration
+#define MAX_SYSLOG_SERVER_LENGTH 64
+#define SYSLOG_DEFAULT_PORT 514
+#define SYSLOG_LINE_SLOTS 16              // ESP_LOG lines waiting for the sender, the oldest is overwritten
+#define SYSLOG_LINE_LENGTH 128            // Longer lines are truncated
+#define SYSLOG_DATAGRAM_SIZE 1024         // Lines batched per datagram, well below the Wi-Fi MTU
+#define SYSLOG_BATCH_INTERVAL_MS 1000     // A batch waits at most this long for more lines
+#define SYSLOG_MAX_DATAGRAMS_PER_S 4      // Rate limit, lines held back meanwhile may be overwritten
+#define SYSLOG_POLL_INTERVAL_MS 250
+#define SYSLOG_RESOLVE_RETRY_MS 30000
+#define SYSLOG_TASK_STACK 3072
+
+// Check History Configuration
+#define HISTORY_CAPACITY 1024  // Records in the RAM ring, 6 bytes each
+#define HISTORY_CHUNK_RECORDS 32  // Records copied per chunk when streaming /history
+
+// Deferred Logging Configuration
+#define LOG_RING_CAPACITY 64                  // Binary records kept for the UART and /logs
+#define LOG_RING_COMPILE_LEVEL ESP_LOG_INFO   // Ring log calls above this level are compiled out
+#define LOG_RING_DRAIN_INTERVAL_MS 200        // UART drain period
+#define LOG_RING_TASK_STACK 2048
+
+// Availability Accounting
+#define SLO_SAVE_INTERVAL_MS 600000  // Rolling windows are written to NVS at most this often
+
+// Execution mode API server
+#define API_SERVER_MAX_URI_HANDLERS 12
+#define API_SERVER_MAX_SOCKETS 3
+#define CONFIG_SERVER_MAX_URI_HANDLERS 14  // Its own four plus the monitoring endpoints
+#define MAX_API_TOKEN_LENGTH 33  // Bearer token for remote reconfiguration, empty disables it
+#define CONFIG_APPLY_MAX_BODY 2048
+
+// Flash-resident data
+#define CONFIG_HTML_CHUNK_SIZE 256  // RAM bounce buffer for serving the configuration page from flash
+
+// Configuration snapshots
+#define CONFIG_STORE_MAX_LISTENERS 4  // Components notified when a new version is published
+#define CONFIG_STORE_DRAIN_POLL_MS 10 // Writer polls this often until readers leave the spare copy
 
 // NVS Keys
 #define NVS_NAMESPACE "config"
 #define NVS_KEY_WIFI_SSID "wifi_ssid"
 #define NVS_KEY_WIFI_PASSWORD "wifi_pass"
+#define NVS_KEY_WIFI_BACKUPS "wifi_backups"
+#define NVS_KEY_WIFI_BACKUP_COUNT "wifi_bk_count"
 #define NVS_KEY_HEALTH_URL "health_url"
+#define NVS_KEY_TARGETS "targets"
+#define NVS_KEY_TARGET_COUNT "target_count"
+#define NVS_KEY_TARGETS_VERSION "targets_ver"
+#define TARGETS_BLOB_VERSION 1  // Bump whenever health_target_config_t changes, older blobs are discarded
 #define NVS_KEY_CHECK_INTERVAL "check_interval"
+#define NVS_KEY_SCHEDULE_MODE "schedule"
 #define NVS_KEY_CONFIGURED "configured"
 #define NVS_KEY_LAST_HEALTH_STATUS "last_health"  // Persist last health status
+#define NVS_KEY_MONITOR_MODE "monitor_mode"
+#define NVS_KEY_HEARTBEAT_PORT "hb_port"
+#define NVS_KEY_HEARTBEAT_TIMEOUT "hb_timeout"
+#define NVS_KEY_HEARTBEAT_TOKEN "hb_token"
+#define NVS_KEY_MQTT_URI "mqtt_uri"
+#define NVS_KEY_MQTT_TOPIC "mqtt_topic"
+#define NVS_KEY_API_TOKEN "api_token"
+#define NVS_KEY_SYSLOG_SERVER "syslog"
+#define NVS_KEY_SLO "slo"
+
+// How the relay decides whether the monitored service is alive
+typedef enum {
+    MONITOR_MODE_POLL = 0,       // Device polls the health check targets
+    MONITOR_MODE_HEARTBEAT = 1,  // Service pushes heartbeats to the device
+} monitor_mode_t;
+
+// When checks run within the interval
+typedef enum {
+    SCHEDULE_MODE_SPREAD = 0,  // Per-device offset plus jitter, aligned to SNTP time
+    SCHEDULE_MODE_FIXED = 1,   // Every interval counted from start
+} schedule_mode_t;
+
+// How a target is probed
+typedef enum {
+    PROBE_TYPE_HTTP = 0,  // GET, healthy on 200
+    PROBE_TYPE_TCP = 1,   // Healthy when the TCP handshake completes
+    PROBE_TYPE_UDP = 2,   // Healthy when the request datagram gets a reply
+} probe_type_t;
+
+// Wi-Fi network the station may join
+typedef struct {
+    char ssid[MAX_WIFI_SSID_LENGTH];
+    char password[MAX_WIFI_PASSWORD_LENGTH];  // Empty for an open network
+} wifi_profile_t;
+
+// Health check target
+typedef struct {
+    char url[MAX_URL_LENGTH];  // http(s)://..., tcp://host:port or udp://host:port
+    uint8_t type;              // probe_type_t
+    char payload[MAX_PROBE_PAYLOAD_LENGTH];  // UDP request datagram
+    char expect[MAX_PROBE_PAYLOAD_LENGTH];   // UDP reply prefix, empty accepts any reply
+    uint16_t connect_timeout_ms;     // Phase budgets in ms, 0 uses the PROBE_* defaults
+    uint16_t tls_timeout_ms;
+    uint16_t first_byte_timeout_ms;
+    uint16_t timeout_ms;             // Total, 0 uses HEALTH_CHECK_TIMEOUT_MS
+    uint16_t latency_degraded_ms;    // Latency EWMA thresholds, 0 disables the state
+    uint16_t latency_failed_ms;
+    uint16_t max_response;           // Bytes, 0 uses PROBE_MAX_RESPONSE
+    char paths[MAX_TARGET_PATHS][MAX_TARGET_PATH_LENGTH];  // More paths on the URL's origin, HTTP only
+} health_target_config_t;
 
 // Configuration structure
 typedef struct {
     char wifi_ssid[MAX_WIFI_SSID_LENGTH];
     char wifi_password[MAX_WIFI_PASSWORD_LENGTH];
-    char health_check_url[MAX_URL_LENGTH];
+    wifi_profile_t wifi_backups[MAX_WIFI_BACKUPS];  // Used when wifi_ssid is out of range or weak
+    uint8_t wifi_backup_count;
+    health_target_config_t targets[MAX_HEALTH_TARGETS];  // targets[0] is the primary health_check_url
+    uint8_t target_count;
     uint32_t check_interval_ms;
+    uint8_t schedule_mode;  // schedule_mode_t
+    uint8_t monitor_mode;  // monitor_mode_t
+    uint16_t heartbeat_port;
+    uint32_t heartbeat_timeout_ms;
+    char heartbeat_token[MAX_HEARTBEAT_TOKEN_LENGTH];
+    char mqtt_uri[MAX_MQTT_URI_LENGTH];      // Empty disables MQTT publishing
+    char mqtt_topic[MAX_MQTT_TOPIC_LENGTH];  // Topic prefix, empty uses MQTT_TOPIC_PREFIX/<mac>
+    char api_token[MAX_API_TOKEN_LENGTH];    // Required by POST /config in execution mode
+    char syslog_server[MAX_SYSLOG_SERVER_LENGTH];  // host[:port] for remote syslog, empty disables it
     bool configured;
     bool last_health_status;  // Last known health status
 } device_config_t;
@@ -5,15 +5,22 @@
 #include "esp_log.h"
 #include "esp_http_server.h"
 #include "cJSON.h"
+#include "flash_data.h"
 #include "config.h"
 #include "config_server.h"
+#include "probe.h"
+#include "config_update.h"
+#include "config_store.h"
+#include "health_checker.h"
+#include "heartbeat.h"
+#include "api_server.h"
+#include "wifi_manager.h"
 
 static const char *TAG = "CONFIG_SERVER";
 
 // External functions
-extern void save_device_config(void);
+extern uint32_t apply_device_config(const device_config_t* config);
 extern void switch_to_execution_mode(void);
-extern device_config_t* get_device_config(void);
 
 // Global variables
 static httpd_handle_t server = NULL;
@@ -32,8 +39,8 @@ static void switch_mode_task(void* pvParameters)
     vTaskDelete(NULL);
 }
 
-// HTML page for configuration
-static const char* config_html = 
+// HTML page for configuration, in flash: only flash_read may touch it
+static const char config_html[] FLASH_ATTR =
 "<!DOCTYPE html>"
 "<html>"
 "<head>"
@@ -121,7 +128,10 @@ void config_server_start(void)
     
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = HTTP_SERVER_PORT;
+    config.max_open_sockets = API_SERVER_MAX_SOCKETS;  // Monitoring may keep running in AP+STA mode
     config.lru_purge_enable = true;
+    config.task_priority = tskIDLE_PRIORITY + 4;       // Below the probe workers
+    config.max_uri_handlers = CONFIG_SERVER_MAX_URI_HANDLERS;
     
     // Start the httpd server
     if (httpd_start(&server, &config) == ESP_OK) {
@@ -160,6 +170,11 @@ void config_server_start(void)
         };
         httpd_register_uri_handler(server, &status_uri);
         
+        // Heartbeats, probes and stats must keep working while the page is open
+        if (health_checker_is_running() || heartbeat_is_running()) {
+            api_server_register_monitoring(server);
+        }
+        
         ESP_LOGI(TAG, "Configuration server started successfully");
     } else {
         ESP_LOGE(TAG, "Failed to start HTTP server");
@@ -180,27 +195,94 @@ static esp_err_t root_get_handler(httpd_req_t *req)
     ESP_LOGI(TAG, "Serving root page");
     
     httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, config_html, strlen(config_html));
     
-    return ESP_OK;
+    // lwIP copies the payload byte by byte, so the page goes out through a RAM buffer
+    char chunk[CONFIG_HTML_CHUNK_SIZE];
+    size_t total = sizeof(config_html) - 1;
+    size_t sent = 0;
+    while (sent < total) {
+        size_t len = total - sent < sizeof(chunk) ? total - sent : sizeof(chunk);
+        flash_read(chunk, config_html + sent, len);
+        if (httpd_resp_send_chunk(req, chunk, len) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        sent += len;
+    }
+    
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 static esp_err_t config_get_handler(httpd_req_t *req)
 {
     ESP_LOGI(TAG, "GET /config request");
     
-    device_config_t* config = get_device_config();
+    const device_config_t* config = config_store_acquire();
     
     cJSON *json = cJSON_CreateObject();
     cJSON *wifi_ssid = cJSON_CreateString(config->wifi_ssid);
-    cJSON *health_check_url = cJSON_CreateString(config->health_check_url);
+    cJSON *health_check_url = cJSON_CreateString(config->targets[0].url);
+    cJSON *targets = cJSON_CreateArray();
+    for (uint8_t i = 0; i < config->target_count; i++) {
+        cJSON *target = cJSON_CreateObject();
+        JSON_ADD_STRING(target, "url", config->targets[i].url);
+        JSON_ADD_STRING(target, "type", probe_type_name(config->targets[i].type));
+        if (config->targets[i].type == PROBE_TYPE_UDP) {
+            JSON_ADD_STRING(target, "payload", config->targets[i].payload);
+            JSON_ADD_STRING(target, "expect", config->targets[i].expect);
+        }
+        if (config->targets[i].connect_timeout_ms > 0) {
+            JSON_ADD_NUMBER(target, "connect_timeout", config->targets[i].connect_timeout_ms);
+        }
+        if (config->targets[i].tls_timeout_ms > 0) {
+            JSON_ADD_NUMBER(target, "tls_timeout", config->targets[i].tls_timeout_ms);
+        }
+        if (config->targets[i].first_byte_timeout_ms > 0) {
+            JSON_ADD_NUMBER(target, "first_byte_timeout", config->targets[i].first_byte_timeout_ms);
+        }
+        if (config->targets[i].timeout_ms > 0) {
+            JSON_ADD_NUMBER(target, "timeout", config->targets[i].timeout_ms);
+        }
+        if (config->targets[i].latency_degraded_ms > 0) {
+            JSON_ADD_NUMBER(target, "latency_degraded", config->targets[i].latency_degraded_ms);
+        }
+        if (config->targets[i].latency_failed_ms > 0) {
+            JSON_ADD_NUMBER(target, "latency_failed", config->targets[i].latency_failed_ms);
+        }
+        if (config->targets[i].max_response > 0) {
+            JSON_ADD_NUMBER(target, "max_response", config->targets[i].max_response);
+        }
+        if (config->targets[i].paths[0][0] != '\0') {
+            cJSON *paths = cJSON_CreateArray();
+            for (uint8_t k = 0; k < MAX_TARGET_PATHS && config->targets[i].paths[k][0] != '\0'; k++) {
+                cJSON_AddItemToArray(paths, cJSON_CreateString(config->targets[i].paths[k]));
+            }
+            JSON_ADD_ITEM(target, "paths", paths);
+        }
+        cJSON_AddItemToArray(targets, target);
+    }
     cJSON *check_interval = cJSON_CreateNumber(config->check_interval_ms / 1000);
     cJSON *configured = cJSON_CreateBool(config->configured);
     
-    cJSON_AddItemToObject(json, "wifi_ssid", wifi_ssid);
-    cJSON_AddItemToObject(json, "health_check_url", health_check_url);
-    cJSON_AddItemToObject(json, "check_interval", check_interval);
-    cJSON_AddItemToObject(json, "configured", configured);
+    JSON_ADD_ITEM(json, "wifi_ssid", wifi_ssid);
+    cJSON *wifi_backups = cJSON_CreateArray();
+    for (uint8_t i = 0; i < config->wifi_backup_count; i++) {
+        cJSON_AddItemToArray(wifi_backups, cJSON_CreateString(config->wifi_backups[i].ssid));
+    }
+    JSON_ADD_ITEM(json, "wifi_backups", wifi_backups);
+    JSON_ADD_ITEM(json, "health_check_url", health_check_url);
+    JSON_ADD_ITEM(json, "targets", targets);
+    JSON_ADD_STRING(json, "monitor_mode", config->monitor_mode == MONITOR_MODE_HEARTBEAT ? "heartbeat" : "poll");
+    JSON_ADD_STRING(json, "schedule", config->schedule_mode == SCHEDULE_MODE_FIXED ? "fixed" : "spread");
+    JSON_ADD_NUMBER(json, "heartbeat_port", config->heartbeat_port);
+    JSON_ADD_NUMBER(json, "heartbeat_timeout", config->heartbeat_timeout_ms);
+    JSON_ADD_BOOL(json, "heartbeat_token_set", strlen(config->heartbeat_token) > 0);
+    JSON_ADD_BOOL(json, "mqtt_enabled", strlen(config->mqtt_uri) > 0);
+    JSON_ADD_STRING(json, "mqtt_topic", config->mqtt_topic);
+    JSON_ADD_BOOL(json, "api_token_set", strlen(config->api_token) > 0);
+    JSON_ADD_STRING(json, "syslog_server", config->syslog_server);
+    JSON_ADD_ITEM(json, "check_interval", check_interval);
+    JSON_ADD_ITEM(json, "configured", configured);
+    config_store_release(config);
     
     char *json_string = cJSON_Print(json);
     
@@ -227,7 +309,8 @@ static esp_err_t config_post_handler(httpd_req_t *req)
     }
     
     content[ret] = '\0';
-    ESP_LOGI(TAG, "Received configuration: %s", content);
+    // The body carries Wi-Fi passwords and API tokens, only its size goes to the log
+    ESP_LOGI(TAG, "Received configuration (%d bytes)", ret);
     
     cJSON *json = cJSON_Parse(content);
     if (json == NULL) {
@@ -236,72 +319,38 @@ static esp_err_t config_post_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
     
-    device_config_t* config = get_device_config();
-    cJSON *response = cJSON_CreateObject();
-    bool success = true;
-    
-    // Parse WiFi SSID
-    cJSON *wifi_ssid = cJSON_GetObjectItem(json, "wifi_ssid");
-    if (cJSON_IsString(wifi_ssid) && (wifi_ssid->valuestring != NULL)) {
-        strncpy(config->wifi_ssid, wifi_ssid->valuestring, sizeof(config->wifi_ssid) - 1);
-        config->wifi_ssid[sizeof(config->wifi_ssid) - 1] = '\0';
-    } else {
-        success = false;
-        ESP_LOGE(TAG, "Invalid or missing wifi_ssid");
-    }
-    
-    // Parse WiFi Password
-    cJSON *wifi_password = cJSON_GetObjectItem(json, "wifi_password");
-    if (cJSON_IsString(wifi_password) && (wifi_password->valuestring != NULL)) {
-        strncpy(config->wifi_password, wifi_password->valuestring, sizeof(config->wifi_password) - 1);
-        config->wifi_password[sizeof(config->wifi_password) - 1] = '\0';
-    } else {
-        success = false;
-        ESP_LOGE(TAG, "Invalid or missing wifi_password");
-    }
-    
-    // Parse Health Check URL
-    cJSON *health_check_url = cJSON_GetObjectItem(json, "health_check_url");
-    if (cJSON_IsString(health_check_url) && (health_check_url->valuestring != NULL)) {
-        strncpy(config->health_check_url, health_check_url->valuestring, sizeof(config->health_check_url) - 1);
-        config->health_check_url[sizeof(config->health_check_url) - 1] = '\0';
-    } else {
-        success = false;
-        ESP_LOGE(TAG, "Invalid or missing health_check_url");
+    // Parse into a copy, monitoring may still be running on the live configuration
+    device_config_t* config = malloc(sizeof(device_config_t));
+    if (config == NULL) {
+        cJSON_Delete(json);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
     }
+    config_store_read(config);
+    cJSON *response = cJSON_CreateObject();
     
-    // Parse Check Interval
-    cJSON *check_interval = cJSON_GetObjectItem(json, "check_interval");
-    if (cJSON_IsNumber(check_interval)) {
-        config->check_interval_ms = (uint32_t)check_interval->valueint;
-        if (config->check_interval_ms < 10000) {
-            config->check_interval_ms = 10000; // Minimum 10 seconds
-        }
-    } else {
-        success = false;
-        ESP_LOGE(TAG, "Invalid or missing check_interval");
-    }
+    bool success = config_update_from_json(json, config, true);
     
     if (success) {
         config->configured = true;
         
-        // Save configuration
-        save_device_config();
+        // Save configuration, and apply it in place if monitoring kept running
+        apply_device_config(config);
         
-        cJSON_AddTrueToObject(response, "success");
-        cJSON_AddStringToObject(response, "message", "Configuration saved successfully");
+        JSON_ADD_TRUE(response, "success");
+        JSON_ADD_STRING(response, "message", "Configuration saved successfully");
         
         ESP_LOGI(TAG, "Configuration saved successfully");
         ESP_LOGI(TAG, "WiFi SSID: %s", config->wifi_ssid);
-        ESP_LOGI(TAG, "Health URL: %s", config->health_check_url);
+        ESP_LOGI(TAG, "Health URL: %s (%d targets)", config->targets[0].url, config->target_count);
         ESP_LOGI(TAG, "Check interval: %d ms", config->check_interval_ms);
         
         // Schedule mode switch after response
         xTaskCreate(switch_mode_task, "switch_mode", 2048, NULL, 5, NULL);
-        
+    
     } else {
-        cJSON_AddFalseToObject(response, "success");
-        cJSON_AddStringToObject(response, "message", "Invalid configuration parameters");
+        JSON_ADD_FALSE(response, "success");
+        JSON_ADD_STRING(response, "message", "Invalid configuration parameters");
     }
     
     char *response_string = cJSON_Print(response);
@@ -312,6 +361,7 @@ static esp_err_t config_post_handler(httpd_req_t *req)
     free(response_string);
     cJSON_Delete(response);
     cJSON_Delete(json);
+    free(config);
     
     return ESP_OK;
 }
@@ -320,13 +370,22 @@ static esp_err_t status_get_handler(httpd_req_t *req)
 {
     ESP_LOGI(TAG, "GET /status request");
     
-    device_config_t* config = get_device_config();
+    const device_config_t* config = config_store_acquire();
+    bool configured = config->configured;
+    config_store_release(config);
     
     cJSON *json = cJSON_CreateObject();
-    cJSON_AddStringToObject(json, "mode", "configuration");
-    cJSON_AddBoolToObject(json, "configured", config->configured);
-    cJSON_AddStringToObject(json, "version", "1.0.0");
-    cJSON_AddStringToObject(json, "device", "SONOFF MINI");
+    JSON_ADD_STRING(json, "mode", "configuration");
+    JSON_ADD_BOOL(json, "configured", configured);
+    // Monitoring keeps running in AP+STA mode once the device is configured
+    bool monitoring = health_checker_is_running() || heartbeat_is_running();
+    JSON_ADD_BOOL(json, "monitoring", monitoring);
+    if (monitoring) {
+        JSON_ADD_BOOL(json, "wifi_connected", wifi_manager_is_connected());
+        JSON_ADD_BOOL(json, "healthy", health_checker_get_last_status());
+    }
+    JSON_ADD_STRING(json, "version", "1.0.0");
+    JSON_ADD_STRING(json, "device", "SONOFF MINI");
     
     char *json_string = cJSON_Print(json);
     
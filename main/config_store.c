@@ -0,0 +1,121 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "config.h"
+#include "config_store.h"
+
+static const char *TAG = "CONFIG_STORE";
+
+typedef struct {
+    config_store_listener_t listener;
+    void *ctx;
+} listener_entry_t;
+
+// Global variables
+// Two copies, readers use the current one while a writer fills the spare one
+static device_config_t s_copies[2];
+static volatile uint8_t s_readers[2];  // Snapshots handed out per copy
+static volatile uint8_t s_current = 0;
+static volatile uint32_t s_version = 0;
+static SemaphoreHandle_t s_write_mutex = NULL;  // Serializes writers and the listener table, readers never take it
+static listener_entry_t s_listeners[CONFIG_STORE_MAX_LISTENERS];
+static uint8_t s_listener_count = 0;
+
+// Function prototypes
+static const device_config_t* acquire(uint32_t* version);
+
+void config_store_init(const device_config_t* initial)
+{
+    s_write_mutex = xSemaphoreCreateMutex();
+    s_copies[0] = *initial;
+    s_current = 0;
+    s_version = 1;
+}
+
+const device_config_t* config_store_acquire(void)
+{
+    return acquire(NULL);
+}
+
+void config_store_release(const device_config_t* config)
+{
+    if (config == NULL) {
+        return;
+    }
+    
+    uint8_t index = (config == &s_copies[0]) ? 0 : 1;
+    taskENTER_CRITICAL();
+    s_readers[index]--;
+    taskEXIT_CRITICAL();
+}
+
+uint32_t config_store_read(device_config_t* out)
+{
+    uint32_t version;
+    const device_config_t* config = acquire(&version);
+    *out = *config;
+    config_store_release(config);
+    return version;
+}
+
+uint32_t config_store_publish(const device_config_t* config)
+{
+    xSemaphoreTake(s_write_mutex, portMAX_DELAY);
+    
+    // Readers of the version before the current one may still hold the spare copy
+    uint8_t spare = s_current ^ 1;
+    while (s_readers[spare] > 0) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_STORE_DRAIN_POLL_MS));
+    }
+    s_copies[spare] = *config;
+    
+    taskENTER_CRITICAL();
+    s_current = spare;
+    uint32_t version = ++s_version;
+    taskEXIT_CRITICAL();
+    
+    ESP_LOGD(TAG, "Published configuration version %u", version);
+    
+    // The old copy is only reused by the next writer, which waits for this mutex
+    for (uint8_t i = 0; i < s_listener_count; i++) {
+        s_listeners[i].listener(&s_copies[spare ^ 1], &s_copies[spare], version, s_listeners[i].ctx);
+    }
+    
+    xSemaphoreGive(s_write_mutex);
+    return version;
+}
+
+uint32_t config_store_version(void)
+{
+    return s_version;
+}
+
+bool config_store_subscribe(config_store_listener_t listener, void* ctx)
+{
+    xSemaphoreTake(s_write_mutex, portMAX_DELAY);
+    bool added = s_listener_count < CONFIG_STORE_MAX_LISTENERS;
+    if (added) {
+        s_listeners[s_listener_count].listener = listener;
+        s_listeners[s_listener_count].ctx = ctx;
+        s_listener_count++;
+    } else {
+        ESP_LOGE(TAG, "No room for another configuration listener");
+    }
+    xSemaphoreGive(s_write_mutex);
+    return added;
+}
+
+static const device_config_t* acquire(uint32_t* version)
+{
+    // Picking the copy and counting the reader must not be split by a publish
+    taskENTER_CRITICAL();
+    uint8_t index = s_current;
+    s_readers[index]++;
+    if (version != NULL) {
+        *version = s_version;
+    }
+    taskEXIT_CRITICAL();
+    return &s_copies[index];
+}
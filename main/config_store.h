@@ -0,0 +1,24 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+
+// Called on the publishing task after the new version is visible; old_config stays valid until it returns
+typedef void (*config_store_listener_t)(const device_config_t* old_config, const device_config_t* new_config,
+                                        uint32_t version, void* ctx);
+
+// Function prototypes
+void config_store_init(const device_config_t* initial);  // Version 1, before any other task reads it
+// Readers never block, the snapshot does not change until it is released
+const device_config_t* config_store_acquire(void);
+void config_store_release(const device_config_t* config);
+uint32_t config_store_read(device_config_t* out);  // Copy of the current version, returns its number
+// Writers replace the whole configuration, returns the new version. Not from a listener, and not while
+// holding a snapshot: the spare copy is only reused once its readers are gone
+uint32_t config_store_publish(const device_config_t* config);
+uint32_t config_store_version(void);
+bool config_store_subscribe(config_store_listener_t listener, void* ctx);  // False when the table is full
+
+#endif // CONFIG_STORE_H
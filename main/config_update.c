@@ -0,0 +1,366 @@
+#include <string.h>
+#include "esp_log.h"
+#include "config.h"
+#include "config_update.h"
+#include "probe.h"
+#include "flash_data.h"
+
+static const char *TAG = "CONFIG_UPDATE";
+
+// Function prototypes
+static bool parse_target(const cJSON *item, health_target_config_t *target);
+static bool parse_wifi_profile(const cJSON *item, wifi_profile_t *profile);
+// name is a FLASH_KEY
+static bool parse_string(const cJSON *json, const char *name, char *dest, size_t size);
+static bool parse_u16(const cJSON *json, const char *name, uint16_t *dest);
+static bool parse_paths(const cJSON *item, health_target_config_t *target);
+
+bool config_update_from_json(const cJSON *json, device_config_t *config, bool require_all)
+{
+    bool success = true;
+    
+    // Parse WiFi SSID
+    cJSON *wifi_ssid = JSON_GET_ITEM(json, "wifi_ssid");
+    if (cJSON_IsString(wifi_ssid) && (wifi_ssid->valuestring != NULL)) {
+        strncpy(config->wifi_ssid, wifi_ssid->valuestring, sizeof(config->wifi_ssid) - 1);
+        config->wifi_ssid[sizeof(config->wifi_ssid) - 1] = '\0';
+    } else if (require_all) {
+        success = false;
+        ESP_LOGE(TAG, "Invalid or missing wifi_ssid");
+    }
+    
+    // Parse WiFi Password
+    cJSON *wifi_password = JSON_GET_ITEM(json, "wifi_password");
+    if (cJSON_IsString(wifi_password) && (wifi_password->valuestring != NULL)) {
+        strncpy(config->wifi_password, wifi_password->valuestring, sizeof(config->wifi_password) - 1);
+        config->wifi_password[sizeof(config->wifi_password) - 1] = '\0';
+    } else if (require_all) {
+        success = false;
+        ESP_LOGE(TAG, "Invalid or missing wifi_password");
+    }
+    
+    // Parse optional backup networks in priority order, these replace any previous backups
+    cJSON *wifi_backups = JSON_GET_ITEM(json, "wifi_backups");
+    if (cJSON_IsArray(wifi_backups)) {
+        config->wifi_backup_count = 0;
+        memset(config->wifi_backups, 0, sizeof(config->wifi_backups));
+        cJSON *backup;
+        cJSON_ArrayForEach(backup, wifi_backups) {
+            if (config->wifi_backup_count >= MAX_WIFI_BACKUPS) {
+                ESP_LOGW(TAG, "Ignoring WiFi backups beyond %d", MAX_WIFI_BACKUPS);
+                break;
+            }
+            if (!parse_wifi_profile(backup, &config->wifi_backups[config->wifi_backup_count])) {
+                success = false;
+                ESP_LOGE(TAG, "Invalid wifi_backups entry");
+                break;
+            }
+            config->wifi_backup_count++;
+        }
+    }
+    
+    // Parse optional monitor mode
+    cJSON *monitor_mode = JSON_GET_ITEM(json, "monitor_mode");
+    if (cJSON_IsString(monitor_mode) && (monitor_mode->valuestring != NULL)) {
+        if (strcmp(monitor_mode->valuestring, "heartbeat") == 0) {
+            config->monitor_mode = MONITOR_MODE_HEARTBEAT;
+        } else if (strcmp(monitor_mode->valuestring, "poll") == 0) {
+            config->monitor_mode = MONITOR_MODE_POLL;
+        } else {
+            success = false;
+            ESP_LOGE(TAG, "Invalid monitor_mode");
+        }
+    }
+    
+    // Parse Health Check URL, only required when polling. Repeating the current URL (the config page
+    // always sends it) keeps the primary's options and the additional targets, a new URL replaces them
+    cJSON *health_check_url = JSON_GET_ITEM(json, "health_check_url");
+    if (cJSON_IsString(health_check_url) && (health_check_url->valuestring != NULL) &&
+        config->target_count > 0 && strcmp(health_check_url->valuestring, config->targets[0].url) == 0) {
+        ESP_LOGD(TAG, "health_check_url unchanged, keeping targets");
+    } else if (cJSON_IsString(health_check_url) && (health_check_url->valuestring != NULL)) {
+        memset(&config->targets[0], 0, sizeof(config->targets[0]));
+        strncpy(config->targets[0].url, health_check_url->valuestring, sizeof(config->targets[0].url) - 1);
+        config->targets[0].type = probe_type_from_url(config->targets[0].url);
+        config->target_count = 1;
+    } else if (require_all && config->monitor_mode != MONITOR_MODE_HEARTBEAT) {
+        success = false;
+        ESP_LOGE(TAG, "Invalid or missing health_check_url");
+    }
+    
+    // Parse optional additional targets, these replace any previous additional targets
+    cJSON *targets = JSON_GET_ITEM(json, "targets");
+    if (success && cJSON_IsArray(targets)) {
+        config->target_count = strlen(config->targets[0].url) > 0 ? 1 : 0;
+        cJSON *target;
+        cJSON_ArrayForEach(target, targets) {
+            health_target_config_t parsed;
+            if (!parse_target(target, &parsed)) {
+                success = false;
+                ESP_LOGE(TAG, "Invalid target entry");
+                break;
+            }
+            // The primary URL may be repeated to set its probe options
+            if (config->target_count > 0 && strcmp(parsed.url, config->targets[0].url) == 0) {
+                config->targets[0] = parsed;
+                continue;
+            }
+            if (config->target_count >= MAX_HEALTH_TARGETS) {
+                ESP_LOGW(TAG, "Ignoring targets beyond %d", MAX_HEALTH_TARGETS);
+                break;
+            }
+            config->targets[config->target_count++] = parsed;
+        }
+    }
+    
+    // Parse Check Interval
+    cJSON *check_interval = JSON_GET_ITEM(json, "check_interval");
+    if (cJSON_IsNumber(check_interval)) {
+        config->check_interval_ms = (uint32_t)check_interval->valueint;
+        if (config->check_interval_ms < 10000) {
+            config->check_interval_ms = 10000; // Minimum 10 seconds
+        }
+    } else if (require_all) {
+        success = false;
+        ESP_LOGE(TAG, "Invalid or missing check_interval");
+    }
+    
+    // Parse optional schedule mode
+    cJSON *schedule = JSON_GET_ITEM(json, "schedule");
+    if (cJSON_IsString(schedule) && (schedule->valuestring != NULL)) {
+        if (strcmp(schedule->valuestring, "spread") == 0) {
+            config->schedule_mode = SCHEDULE_MODE_SPREAD;
+        } else if (strcmp(schedule->valuestring, "fixed") == 0) {
+            config->schedule_mode = SCHEDULE_MODE_FIXED;
+        } else {
+            success = false;
+            ESP_LOGE(TAG, "Invalid schedule");
+        }
+    }
+    
+    // Parse optional heartbeat settings
+    cJSON *heartbeat_port = JSON_GET_ITEM(json, "heartbeat_port");
+    if (cJSON_IsNumber(heartbeat_port)) {
+        if (heartbeat_port->valueint > 0 && heartbeat_port->valueint <= 65535) {
+            config->heartbeat_port = (uint16_t)heartbeat_port->valueint;
+        } else {
+            success = false;
+            ESP_LOGE(TAG, "Invalid heartbeat_port");
+        }
+    }
+    
+    cJSON *heartbeat_timeout = JSON_GET_ITEM(json, "heartbeat_timeout");
+    if (cJSON_IsNumber(heartbeat_timeout)) {
+        config->heartbeat_timeout_ms = (uint32_t)heartbeat_timeout->valueint;
+        if (config->heartbeat_timeout_ms < HEARTBEAT_MIN_TIMEOUT_MS) {
+            config->heartbeat_timeout_ms = HEARTBEAT_MIN_TIMEOUT_MS;
+        }
+    }
+    
+    success = parse_string(json, FLASH_KEY("heartbeat_token"), config->heartbeat_token,
+                           sizeof(config->heartbeat_token)) && success;
+    
+    // Parse optional MQTT settings, an empty URI disables publishing
+    success = parse_string(json, FLASH_KEY("mqtt_uri"), config->mqtt_uri, sizeof(config->mqtt_uri)) && success;
+    success = parse_string(json, FLASH_KEY("mqtt_topic"), config->mqtt_topic, sizeof(config->mqtt_topic)) && success;
+    
+    // Parse optional API token, an empty token disables remote reconfiguration
+    success = parse_string(json, FLASH_KEY("api_token"), config->api_token, sizeof(config->api_token)) && success;
+    
+    // Parse optional syslog server, an empty one disables remote logging
+    char syslog_server[MAX_SYSLOG_SERVER_LENGTH];
+    strcpy(syslog_server, config->syslog_server);
+    if (parse_string(json, FLASH_KEY("syslog_server"), syslog_server, sizeof(syslog_server))) {
+        char host[MAX_HOST_LENGTH];
+        uint16_t port;
+        if (syslog_server[0] == '\0' || probe_parse_address(syslog_server, host, sizeof(host), &port)) {
+            strcpy(config->syslog_server, syslog_server);
+        } else {
+            success = false;
+            ESP_LOGE(TAG, "Invalid syslog_server");
+        }
+    } else {
+        success = false;
+    }
+    
+    return success;
+}
+
+uint32_t config_update_diff(const device_config_t *old_config, const device_config_t *new_config)
+{
+    uint32_t changes = 0;
+    
+    if (strcmp(old_config->wifi_ssid, new_config->wifi_ssid) != 0 ||
+        strcmp(old_config->wifi_password, new_config->wifi_password) != 0 ||
+        old_config->wifi_backup_count != new_config->wifi_backup_count ||
+        memcmp(old_config->wifi_backups, new_config->wifi_backups, sizeof(old_config->wifi_backups)) != 0) {
+        changes |= CONFIG_CHANGE_WIFI;
+    }
+    
+    // Targets are zero-filled before parsing, so a byte compare is exact
+    if (old_config->target_count != new_config->target_count ||
+        memcmp(old_config->targets, new_config->targets, sizeof(old_config->targets[0]) * new_config->target_count) != 0 ||
+        old_config->check_interval_ms != new_config->check_interval_ms ||
+        old_config->schedule_mode != new_config->schedule_mode) {
+        changes |= CONFIG_CHANGE_CHECKS;
+    }
+    
+    if (old_config->monitor_mode != new_config->monitor_mode) {
+        changes |= CONFIG_CHANGE_MODE;
+    }
+    
+    if (old_config->heartbeat_port != new_config->heartbeat_port ||
+        old_config->heartbeat_timeout_ms != new_config->heartbeat_timeout_ms ||
+        strcmp(old_config->heartbeat_token, new_config->heartbeat_token) != 0) {
+        changes |= CONFIG_CHANGE_HEARTBEAT;
+    }
+    
+    if (strcmp(old_config->mqtt_uri, new_config->mqtt_uri) != 0 ||
+        strcmp(old_config->mqtt_topic, new_config->mqtt_topic) != 0) {
+        changes |= CONFIG_CHANGE_MQTT;
+    }
+    
+    if (strcmp(old_config->api_token, new_config->api_token) != 0) {
+        changes |= CONFIG_CHANGE_API;
+    }
+    
+    if (strcmp(old_config->syslog_server, new_config->syslog_server) != 0) {
+        changes |= CONFIG_CHANGE_SYSLOG;
+    }
+    
+    return changes;
+}
+
+static bool parse_wifi_profile(const cJSON *item, wifi_profile_t *profile)
+{
+    memset(profile, 0, sizeof(*profile));
+    
+    cJSON *ssid = JSON_GET_ITEM(item, "ssid");
+    if (!cJSON_IsString(ssid) || ssid->valuestring == NULL || strlen(ssid->valuestring) == 0 ||
+        strlen(ssid->valuestring) >= sizeof(profile->ssid)) {
+        return false;
+    }
+    strcpy(profile->ssid, ssid->valuestring);
+    
+    // The password may be omitted for an open network
+    return parse_string(item, FLASH_KEY("password"), profile->password, sizeof(profile->password));
+}
+
+static bool parse_target(const cJSON *item, health_target_config_t *target)
+{
+    memset(target, 0, sizeof(*target));
+    
+    // Either a plain URL string or an object with probe options
+    const cJSON *url = cJSON_IsObject(item) ? JSON_GET_ITEM(item, "url") : item;
+    if (!cJSON_IsString(url) || url->valuestring == NULL ||
+        strlen(url->valuestring) >= sizeof(target->url)) {
+        return false;
+    }
+    strcpy(target->url, url->valuestring);
+    target->type = probe_type_from_url(target->url);
+    
+    if (!cJSON_IsObject(item)) {
+        return true;
+    }
+    
+    cJSON *type = JSON_GET_ITEM(item, "type");
+    if (cJSON_IsString(type) && type->valuestring != NULL) {
+        if (strcmp(type->valuestring, "http") == 0) {
+            target->type = PROBE_TYPE_HTTP;
+        } else if (strcmp(type->valuestring, "tcp") == 0) {
+            target->type = PROBE_TYPE_TCP;
+        } else if (strcmp(type->valuestring, "udp") == 0) {
+            target->type = PROBE_TYPE_UDP;
+        } else {
+            return false;
+        }
+    }
+    
+    cJSON *payload = JSON_GET_ITEM(item, "payload");
+    if (cJSON_IsString(payload) && payload->valuestring != NULL) {
+        strncpy(target->payload, payload->valuestring, sizeof(target->payload) - 1);
+    }
+    
+    cJSON *expect = JSON_GET_ITEM(item, "expect");
+    if (cJSON_IsString(expect) && expect->valuestring != NULL) {
+        strncpy(target->expect, expect->valuestring, sizeof(target->expect) - 1);
+    }
+    
+    // Phase budgets and latency thresholds in ms, budgets are capped below the check interval when applied
+    if (!parse_paths(item, target) ||
+        !parse_u16(item, FLASH_KEY("connect_timeout"), &target->connect_timeout_ms) ||
+        !parse_u16(item, FLASH_KEY("tls_timeout"), &target->tls_timeout_ms) ||
+        !parse_u16(item, FLASH_KEY("first_byte_timeout"), &target->first_byte_timeout_ms) ||
+        !parse_u16(item, FLASH_KEY("timeout"), &target->timeout_ms) ||
+        !parse_u16(item, FLASH_KEY("latency_degraded"), &target->latency_degraded_ms) ||
+        !parse_u16(item, FLASH_KEY("latency_failed"), &target->latency_failed_ms) ||
+        !parse_u16(item, FLASH_KEY("max_response"), &target->max_response)) {
+        return false;
+    }
+    
+    // Below this not even a status line and the usual headers fit, 0 keeps the default
+    if (target->max_response > 0 && target->max_response < PROBE_MIN_RESPONSE) {
+        ESP_LOGE(TAG, "max_response below %d", PROBE_MIN_RESPONSE);
+        return false;
+    }
+    return true;
+}
+
+static bool parse_string(const cJSON *json, const char *name, char *dest, size_t size)
+{
+    // Absent is fine, too long is an error rather than a silent truncation
+    char key[FLASH_KEY_MAX];
+    flash_strlcpy(key, name, sizeof(key));
+    cJSON *item = cJSON_GetObjectItem(json, key);
+    if (!cJSON_IsString(item) || item->valuestring == NULL) {
+        return true;
+    }
+    if (strlen(item->valuestring) >= size) {
+        ESP_LOGE(TAG, "%s too long", key);
+        return false;
+    }
+    strcpy(dest, item->valuestring);
+    return true;
+}
+
+static bool parse_u16(const cJSON *json, const char *name, uint16_t *dest)
+{
+    char key[FLASH_KEY_MAX];
+    flash_strlcpy(key, name, sizeof(key));
+    cJSON *item = cJSON_GetObjectItem(json, key);
+    if (!cJSON_IsNumber(item)) {
+        return true;
+    }
+    if (item->valueint < 0 || item->valueint > UINT16_MAX) {
+        ESP_LOGE(TAG, "Invalid %s", key);
+        return false;
+    }
+    *dest = (uint16_t)item->valueint;
+    return true;
+}
+
+static bool parse_paths(const cJSON *item, health_target_config_t *target)
+{
+    // Extra paths checked on the URL's own connection, so only HTTP targets have them
+    cJSON *paths = JSON_GET_ITEM(item, "paths");
+    if (paths == NULL) {
+        return true;
+    }
+    if (!cJSON_IsArray(paths) || target->type != PROBE_TYPE_HTTP ||
+        cJSON_GetArraySize(paths) > MAX_TARGET_PATHS) {
+        ESP_LOGE(TAG, "Invalid paths");
+        return false;
+    }
+    
+    int index = 0;
+    cJSON *path;
+    cJSON_ArrayForEach(path, paths) {
+        if (!cJSON_IsString(path) || path->valuestring == NULL || path->valuestring[0] != '/' ||
+            strlen(path->valuestring) >= MAX_TARGET_PATH_LENGTH || strpbrk(path->valuestring, " \r\n") != NULL) {
+            ESP_LOGE(TAG, "Invalid path");
+            return false;
+        }
+        strcpy(target->paths[index++], path->valuestring);
+    }
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef CONFIG_UPDATE_H
+#define CONFIG_UPDATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cJSON.h"
+#include "config.h"
+
+// Groups of settings that changed between two configurations
+#define CONFIG_CHANGE_WIFI       (1 << 0)  // SSID, password or backup networks, needs a reconnect
+#define CONFIG_CHANGE_CHECKS     (1 << 1)  // Targets or check interval
+#define CONFIG_CHANGE_MODE       (1 << 2)  // Poll vs heartbeat
+#define CONFIG_CHANGE_HEARTBEAT  (1 << 3)
+#define CONFIG_CHANGE_MQTT       (1 << 4)
+#define CONFIG_CHANGE_API        (1 << 5)  // API token
+#define CONFIG_CHANGE_SYSLOG     (1 << 6)
+
+// Function prototypes
+// Fields missing from json are left untouched unless require_all is set, in which case
+// the settings needed to leave configuration mode must be present.
+bool config_update_from_json(const cJSON *json, device_config_t *config, bool require_all);
+uint32_t config_update_diff(const device_config_t *old_config, const device_config_t *new_config);
+
+#endif // CONFIG_UPDATE_H
@@ -0,0 +1,117 @@
+#include <string.h>
+#include "flash_data.h"
+
+// Function prototypes
+static inline uint32_t load_word(const void* address);
+
+void flash_read(void* dst, const void* src, size_t len)
+{
+    uint8_t *out = dst;
+    uintptr_t address = (uintptr_t)src;
+    size_t offset = address & 3;
+    address -= offset;
+    
+    // Little endian, byte 0 of a word is its lowest 8 bits
+    while (len > 0) {
+        uint32_t word = load_word((const void *)address);
+        for (; offset < 4 && len > 0; offset++, len--) {
+            *out++ = (uint8_t)(word >> (8 * offset));
+        }
+        offset = 0;
+        address += 4;
+    }
+}
+
+size_t flash_strlcpy(char* dst, const char* src, size_t size)
+{
+    if (size == 0) {
+        return 0;
+    }
+    
+    uintptr_t address = (uintptr_t)src;
+    size_t offset = address & 3;
+    address -= offset;
+    size_t len = 0;
+    
+    while (1) {
+        uint32_t word = load_word((const void *)address);
+        for (; offset < 4; offset++) {
+            char c = (char)(word >> (8 * offset));
+            if (c == '\0' || len + 1 >= size) {
+                dst[len] = '\0';
+                return len;
+            }
+            dst[len++] = c;
+        }
+        offset = 0;
+        address += 4;
+    }
+}
+
+size_t flash_strlen(const char* src)
+{
+    uintptr_t address = (uintptr_t)src;
+    size_t offset = address & 3;
+    address -= offset;
+    size_t len = 0;
+    
+    while (1) {
+        uint32_t word = load_word((const void *)address);
+        for (; offset < 4; offset++) {
+            if ((char)(word >> (8 * offset)) == '\0') {
+                return len;
+            }
+            len++;
+        }
+        offset = 0;
+        address += 4;
+    }
+}
+
+void json_add_number(cJSON* object, const char* flash_key, double number)
+{
+    char key[FLASH_KEY_MAX];
+    flash_strlcpy(key, flash_key, sizeof(key));
+    cJSON_AddNumberToObject(object, key, number);
+}
+
+void json_add_string(cJSON* object, const char* flash_key, const char* string)
+{
+    char key[FLASH_KEY_MAX];
+    flash_strlcpy(key, flash_key, sizeof(key));
+    cJSON_AddStringToObject(object, key, string);
+}
+
+void json_add_bool(cJSON* object, const char* flash_key, bool boolean)
+{
+    char key[FLASH_KEY_MAX];
+    flash_strlcpy(key, flash_key, sizeof(key));
+    cJSON_AddBoolToObject(object, key, boolean);
+}
+
+void json_add_null(cJSON* object, const char* flash_key)
+{
+    char key[FLASH_KEY_MAX];
+    flash_strlcpy(key, flash_key, sizeof(key));
+    cJSON_AddNullToObject(object, key);
+}
+
+void json_add_item(cJSON* object, const char* flash_key, cJSON* item)
+{
+    char key[FLASH_KEY_MAX];
+    flash_strlcpy(key, flash_key, sizeof(key));
+    cJSON_AddItemToObject(object, key, item);
+}
+
+cJSON* json_get_item(const cJSON* object, const char* flash_key)
+{
+    char key[FLASH_KEY_MAX];
+    flash_strlcpy(key, flash_key, sizeof(key));
+    return cJSON_GetObjectItem(object, key);
+}
+
+static inline uint32_t load_word(const void* address)
+{
+    // volatile keeps the compiler from narrowing this to a byte load
+    return *(const volatile uint32_t *)address;
+}
@@ -0,0 +1,45 @@
+#ifndef FLASH_DATA_H
+#define FLASH_DATA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cJSON.h"
+
+// Constant data kept in the memory-mapped SPI flash instead of DRAM. The flash cache only serves
+// aligned 32-bit loads, so this data must never reach strlen, strcpy, printf and friends directly:
+// copy it out with flash_read or flash_strlcpy first
+#define FLASH_ATTR __attribute__((section(".irom0.text"), aligned(4)))
+
+// String literal in flash, usable as an expression
+#define FLASH_STR(s) (__extension__({ static const char flash_str_[] FLASH_ATTR = (s); &flash_str_[0]; }))
+
+// Object keys are bounced through the stack, this is the longest one allowed
+#define FLASH_KEY_MAX 32
+#define FLASH_KEY(s) (__extension__({ \
+        _Static_assert(sizeof(s) <= FLASH_KEY_MAX, "JSON key longer than FLASH_KEY_MAX"); \
+        FLASH_STR(s); }))
+
+// cJSON with the key literal in flash, same arguments as the cJSON_Add*ToObject calls
+#define JSON_ADD_NUMBER(object, key, number) json_add_number((object), FLASH_KEY(key), (number))
+#define JSON_ADD_STRING(object, key, string) json_add_string((object), FLASH_KEY(key), (string))
+#define JSON_ADD_BOOL(object, key, boolean) json_add_bool((object), FLASH_KEY(key), (boolean))
+#define JSON_ADD_TRUE(object, key) json_add_bool((object), FLASH_KEY(key), true)
+#define JSON_ADD_FALSE(object, key) json_add_bool((object), FLASH_KEY(key), false)
+#define JSON_ADD_NULL(object, key) json_add_null((object), FLASH_KEY(key))
+#define JSON_ADD_ITEM(object, key, item) json_add_item((object), FLASH_KEY(key), (item))
+#define JSON_GET_ITEM(object, key) json_get_item((object), FLASH_KEY(key))
+
+// Function prototypes
+void flash_read(void* dst, const void* src, size_t len);
+size_t flash_strlcpy(char* dst, const char* src, size_t size);  // Returns the length copied, always terminates
+size_t flash_strlen(const char* src);
+
+void json_add_number(cJSON* object, const char* flash_key, double number);
+void json_add_string(cJSON* object, const char* flash_key, const char* string);  // string is in RAM
+void json_add_bool(cJSON* object, const char* flash_key, bool boolean);
+void json_add_null(cJSON* object, const char* flash_key);
+void json_add_item(cJSON* object, const char* flash_key, cJSON* item);
+cJSON* json_get_item(const cJSON* object, const char* flash_key);
+
+#endif // FLASH_DATA_H
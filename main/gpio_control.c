@@ -4,6 +4,7 @@
 #include "esp_log.h"
 #include "config.h"
 #include "gpio_control.h"
+#include "log_ring.h"
 
 static const char *TAG = "GPIO_CONTROL";
 
@@ -54,7 +55,7 @@ void gpio_control_init(void)
 void gpio_control_set_relay(bool state)
 {
     gpio_set_level(GPIO_RELAY, state ? 1 : 0);
-    ESP_LOGI(TAG, "Relay %s", state ? "ON" : "OFF");
+    LOGR_I(LOG_MOD_GPIO, "Relay %s", state ? "ON" : "OFF");
 }
 
 void gpio_control_set_blue_led(bool state)
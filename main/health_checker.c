@@ -2,41 +2,116 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/timers.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_log.h"
-#include "esp_http_client.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "config.h"
 #include "health_checker.h"
+#include "probe.h"
+#include "probe_pool.h"
+#include "mqtt_publisher.h"
+#include "check_history.h"
+#include "slo.h"
+#include "log_ring.h"
+#include "time_sync.h"
 #include "wifi_manager.h"
 #include "gpio_control.h"
 
 static const char *TAG = "HEALTH_CHECKER";
 
+// Runtime state of a single target
+typedef struct {
+    health_target_config_t config;
+    char host[MAX_HOST_LENGTH];
+    bool in_flight;
+    bool has_result;
+    probe_result_t last_result;
+    uint32_t backoff_ms;     // Current 429/503 back-off, 0 when not backing off
+    TickType_t not_before;   // No probes before this tick while backing off
+    uint32_t reason_counts[PROBE_REASON_COUNT];  // Outcomes since the target was set
+    uint32_t latency_ewma;   // Scaled by 1 << LATENCY_EWMA_SHIFT, 0 before the first sample
+    uint8_t latency_state;   // latency_state_t
+    uint32_t completions;    // Probes finished since the target was set
+    TickType_t completed_at;
+    probe_result_t last_probe;  // Verdict of the latest probe, 429s included
+} target_state_t;
+
+// On-demand request, results are read from the targets when fetched
+typedef struct {
+    uint32_t id;              // 0 for a free slot
+    uint32_t generation;      // s_generation when started
+    TickType_t wait_until;
+    uint8_t mask;
+    uint8_t waiting;          // Targets whose probe has not reported yet
+    bool timed_out;
+    uint8_t source[MAX_HEALTH_TARGETS];     // probe_now_source_t
+    uint32_t started[MAX_HEALTH_TARGETS];   // Completion count of each target when started
+} probe_request_t;
+
 // Global variables
 static TimerHandle_t health_check_timer = NULL;
-static char health_check_url[MAX_URL_LENGTH];
+static target_state_t s_targets[MAX_HEALTH_TARGETS];
+static uint8_t s_target_count = 0;
+static SemaphoreHandle_t s_state_mutex = NULL;
+static SemaphoreHandle_t s_status_mutex = NULL;
 static uint32_t check_interval_ms;
+static uint8_t s_schedule_mode = SCHEDULE_MODE_SPREAD;
+static uint32_t s_device_hash = 0;  // Per-device slot offset, derived from the MAC
 static bool is_running = false;
 static bool last_health_status = false;
+static uint32_t s_generation = 0;  // Bumped whenever the target list is replaced
+static bool s_dispatched = false;  // A scheduled check ran since start
+static TickType_t s_last_dispatch;
+static probe_now_stats_t s_probe_now_stats;
+static probe_request_t s_requests[PROBE_NOW_MAX_REQUESTS];
+static uint32_t s_next_request_id = 1;
 
 // Function prototypes
 static void health_check_timer_callback(TimerHandle_t xTimer);
-static void health_check_task(void *pvParameters);
-static esp_err_t http_event_handler(esp_http_client_event_t *evt);
+static void dispatch_health_checks(void);
+static void prepare_job(uint8_t index, TickType_t now, probe_job_t* job);
+static void submit_jobs(probe_job_t* jobs, int job_count);
+static void run_probe(const probe_job_t* job, probe_result_t* result);
+static void on_probe_done(const probe_job_t* job, const probe_result_t* result);
 static void update_health_status(bool status);
+static void set_target(uint8_t index, const health_target_config_t* config);
+static TickType_t next_check_delay(void);
+static void apply_backoff(target_state_t* target, const probe_result_t* result);
+static void apply_latency(target_state_t* target, const probe_result_t* result);
+static uint8_t next_latency_state(uint8_t state, uint32_t ewma_ms, const health_target_config_t* config);
+
+void health_checker_init(void)
+{
+    s_state_mutex = xSemaphoreCreateMutex();
+    s_status_mutex = xSemaphoreCreateMutex();
+    
+    // FNV-1a of the MAC, spreads devices that share an interval across it
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    s_device_hash = 2166136261u;
+    for (int i = 0; i < 6; i++) {
+        s_device_hash = (s_device_hash ^ mac[i]) * 16777619u;
+    }
+}
 
-void health_checker_start(const char* url, uint32_t interval_ms)
+void health_checker_start(const health_target_config_t* targets, uint8_t target_count, uint32_t interval_ms,
+                          uint8_t schedule_mode)
 {
     ESP_LOGI(TAG, "Starting health checker");
-    ESP_LOGI(TAG, "URL: %s", url);
-    ESP_LOGI(TAG, "Interval: %d ms", interval_ms);
+    ESP_LOGI(TAG, "Targets: %d", target_count);
+    ESP_LOGI(TAG, "Interval: %d ms (%s)", interval_ms, schedule_mode == SCHEDULE_MODE_FIXED ? "fixed" : "spread");
     
     if (is_running) {
         health_checker_stop();
     }
     
+    if (probe_pool_init(run_probe, on_probe_done) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start probe pool");
+        return;
+    }
+    
     // Load last known health status and apply to relay
     last_health_status = health_checker_load_last_status();
     gpio_control_set_relay(last_health_status);
@@ -45,15 +120,26 @@ void health_checker_start(const char* url, uint32_t interval_ms)
              last_health_status ? "ON" : "OFF");
     
     // Save parameters
-    strncpy(health_check_url, url, sizeof(health_check_url) - 1);
-    health_check_url[sizeof(health_check_url) - 1] = '\0';
+    if (target_count > MAX_HEALTH_TARGETS) {
+        target_count = MAX_HEALTH_TARGETS;
+    }
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    memset(s_targets, 0, sizeof(s_targets));
+    for (uint8_t i = 0; i < target_count; i++) {
+        set_target(i, &targets[i]);
+    }
+    s_target_count = target_count;
+    s_generation++;
+    xSemaphoreGive(s_state_mutex);
     check_interval_ms = interval_ms;
+    s_schedule_mode = schedule_mode;
+    s_dispatched = false;
     
-    // Create timer for periodic health checks
+    // Create timer for periodic health checks, re-armed for the next slot after every check
     health_check_timer = xTimerCreate(
         "health_check_timer",
-        pdMS_TO_TICKS(check_interval_ms),
-        pdTRUE,  // Auto-reload
+        next_check_delay(),
+        pdFALSE,
         NULL,
         health_check_timer_callback
     );
@@ -83,12 +169,57 @@ void health_checker_stop(void)
         }
         
         is_running = false;
+        probe_pool_flush();
+        slo_pause();
         update_health_status(false);  // Turn off relay and save status
         
         ESP_LOGI(TAG, "Health checker stopped");
     }
 }
 
+void health_checker_reconfigure(const health_target_config_t* targets, uint8_t target_count, uint32_t interval_ms,
+                                uint8_t schedule_mode)
+{
+    if (!is_running) {
+        return;
+    }
+    
+    ESP_LOGI(TAG, "Reconfiguring health checker: %d targets, %d ms", target_count, interval_ms);
+    
+    if (target_count > MAX_HEALTH_TARGETS) {
+        target_count = MAX_HEALTH_TARGETS;
+    }
+    
+    // Results still in flight were produced for the old target list
+    probe_pool_flush();
+    
+    // Relay and status are left alone, unchanged targets keep their last result
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < MAX_HEALTH_TARGETS; i++) {
+        s_targets[i].in_flight = false;
+        if (i >= target_count) {
+            memset(&s_targets[i], 0, sizeof(s_targets[i]));
+        } else if (i >= s_target_count ||
+                   memcmp(&s_targets[i].config, &targets[i], sizeof(targets[i])) != 0) {
+            set_target(i, &targets[i]);
+        }
+    }
+    s_target_count = target_count;
+    s_generation++;
+    xSemaphoreGive(s_state_mutex);
+    
+    if (interval_ms != check_interval_ms || schedule_mode != s_schedule_mode) {
+        check_interval_ms = interval_ms;
+        s_schedule_mode = schedule_mode;
+        xTimerChangePeriod(health_check_timer, next_check_delay(), pdMS_TO_TICKS(100));
+    }
+    
+    // Check the new target set right away rather than after a full interval
+    if (wifi_manager_is_connected()) {
+        dispatch_health_checks();
+    }
+}
+
 bool health_checker_is_running(void)
 {
     return is_running;
@@ -99,121 +230,568 @@ bool health_checker_get_last_status(void)
     return last_health_status;
 }
 
+void health_checker_report_status(bool status)
+{
+    update_health_status(status);
+}
+
+uint32_t health_checker_get_target_backoff_ms(uint8_t target)
+{
+    uint32_t remaining_ms = 0;
+    
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    if (target < s_target_count && s_targets[target].backoff_ms > 0) {
+        int32_t ticks = (int32_t)(s_targets[target].not_before - xTaskGetTickCount());
+        remaining_ms = ticks > 0 ? ticks * portTICK_PERIOD_MS : 0;
+    }
+    xSemaphoreGive(s_state_mutex);
+    
+    return remaining_ms;
+}
+
+bool health_checker_get_target_latency(uint8_t target, uint32_t* ewma_ms, uint8_t* state)
+{
+    bool found = false;
+    
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    if (target < s_target_count && s_targets[target].latency_ewma > 0) {
+        *ewma_ms = s_targets[target].latency_ewma >> LATENCY_EWMA_SHIFT;
+        *state = s_targets[target].latency_state;
+        found = true;
+    }
+    xSemaphoreGive(s_state_mutex);
+    
+    return found;
+}
+
+const char* health_checker_latency_state_name(uint8_t state)
+{
+    switch (state) {
+        case LATENCY_STATE_OK:
+            return "ok";
+        case LATENCY_STATE_DEGRADED:
+            return "degraded";
+        case LATENCY_STATE_FAILED:
+            return "failed";
+        default:
+            return "unknown";
+    }
+}
+
+bool health_checker_get_target_stats(uint8_t target, uint32_t counts[PROBE_REASON_COUNT], probe_budget_t* budget)
+{
+    bool found = false;
+    
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    if (target < s_target_count) {
+        memcpy(counts, s_targets[target].reason_counts, sizeof(s_targets[target].reason_counts));
+        probe_budget_resolve(&s_targets[target].config, check_interval_ms, budget);
+        found = true;
+    }
+    xSemaphoreGive(s_state_mutex);
+    
+    return found;
+}
+
+uint8_t health_checker_get_target_count(void)
+{
+    return s_target_count;
+}
+
+bool health_checker_get_target_result(uint8_t target, probe_result_t* result)
+{
+    bool has_result = false;
+    
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    if (target < s_target_count && s_targets[target].has_result) {
+        *result = s_targets[target].last_result;
+        has_result = true;
+    }
+    xSemaphoreGive(s_state_mutex);
+    
+    return has_result;
+}
+
+esp_err_t health_checker_probe_start(uint8_t mask, uint32_t* id)
+{
+    probe_job_t jobs[MAX_HEALTH_TARGETS];
+    int job_count = 0;
+    TickType_t now = xTaskGetTickCount();
+    
+    if (!is_running || !wifi_manager_is_connected()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    mask &= (1 << s_target_count) - 1;
+    if (mask == 0) {
+        xSemaphoreGive(s_state_mutex);
+        return ESP_ERR_NOT_FOUND;
+    }
+    
+    // A free slot, or the oldest request gives its slot up
+    probe_request_t* request = &s_requests[0];
+    for (int i = 0; i < PROBE_NOW_MAX_REQUESTS && request->id != 0; i++) {
+        if (s_requests[i].id == 0 || (int32_t)(s_requests[i].id - request->id) < 0) {
+            request = &s_requests[i];
+        }
+    }
+    memset(request, 0, sizeof(*request));
+    request->id = s_next_request_id++;
+    if (s_next_request_id == 0) {
+        s_next_request_id = 1;
+    }
+    request->generation = s_generation;
+    request->mask = mask;
+    request->wait_until = now;
+    
+    // Requests share the probe in flight or a recent result, so however many arrive
+    // a target is probed on demand at most once per PROBE_NOW_MIN_INTERVAL_MS
+    for (uint8_t i = 0; i < s_target_count; i++) {
+        target_state_t* target = &s_targets[i];
+        if ((mask & (1 << i)) == 0) {
+            continue;
+        }
+        request->started[i] = target->completions;
+        
+        if (target->in_flight) {
+            request->source[i] = PROBE_NOW_JOINED;
+            s_probe_now_stats.joined++;
+        } else if (target->backoff_ms > 0 && (int32_t)(now - target->not_before) < 0) {
+            request->source[i] = PROBE_NOW_BACKOFF;
+            s_probe_now_stats.backoff++;
+            continue;
+        } else if (target->completions > 0 &&
+                   now - target->completed_at < pdMS_TO_TICKS(PROBE_NOW_MIN_INTERVAL_MS)) {
+            request->source[i] = PROBE_NOW_RECENT;
+            s_probe_now_stats.recent++;
+            continue;
+        } else {
+            request->source[i] = PROBE_NOW_FRESH;
+            prepare_job(i, now, &jobs[job_count++]);
+            s_probe_now_stats.fresh++;
+        }
+        
+        // A probe already in flight started earlier, its budget bounds the wait as well
+        probe_budget_t budget;
+        probe_budget_resolve(&target->config, check_interval_ms, &budget);
+        TickType_t until = now + pdMS_TO_TICKS(budget.total_ms + PROBE_WATCHDOG_GRACE_MS + PROBE_WATCHDOG_PERIOD_MS);
+        if ((int32_t)(until - request->wait_until) > 0) {
+            request->wait_until = until;
+        }
+        request->waiting |= 1 << i;
+    }
+    *id = request->id;
+    xSemaphoreGive(s_state_mutex);
+    
+    if (job_count > 0) {
+        LOGR_I(LOG_MOD_CHECKER, "On-demand check %u, probing %d targets", *id, job_count);
+        submit_jobs(jobs, job_count);
+    }
+    return ESP_OK;
+}
+
+esp_err_t health_checker_probe_result(uint32_t id, probe_now_t results[MAX_HEALTH_TARGETS], bool* done)
+{
+    esp_err_t err = ESP_OK;
+    bool lost = false;
+    TickType_t now = xTaskGetTickCount();
+    
+    memset(results, 0, sizeof(probe_now_t) * MAX_HEALTH_TARGETS);
+    *done = false;
+    
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    probe_request_t* request = NULL;
+    for (int i = 0; i < PROBE_NOW_MAX_REQUESTS; i++) {
+        if (id != 0 && s_requests[i].id == id) {
+            request = &s_requests[i];
+        }
+    }
+    if (request == NULL) {
+        xSemaphoreGive(s_state_mutex);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (!is_running || request->generation != s_generation) {
+        xSemaphoreGive(s_state_mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    // on_probe_done bumps the completion count of each target, once past started[] the probe has reported.
+    // A later probe may have replaced its verdict by now, which is only fresher
+    for (uint8_t i = 0; i < s_target_count; i++) {
+        target_state_t* target = &s_targets[i];
+        probe_now_t* out = &results[i];
+        if ((request->mask & (1 << i)) == 0) {
+            continue;
+        }
+        out->requested = true;
+        out->source = request->source[i];
+        if (request->waiting & (1 << i)) {
+            if (target->completions == request->started[i]) {
+                lost = lost || !target->in_flight;  // Dropped by a full queue, nothing will report
+                continue;
+            }
+            request->waiting &= ~(1 << i);
+        }
+        if (out->source == PROBE_NOW_BACKOFF) {
+            int32_t ticks = (int32_t)(target->not_before - now);
+            out->retry_after_ms = ticks > 0 ? ticks * portTICK_PERIOD_MS : 0;
+            out->has_result = target->has_result;
+            out->result = target->last_result;
+        } else {
+            out->has_result = true;
+            out->result = target->last_probe;
+            out->age_ms = (now - target->completed_at) * portTICK_PERIOD_MS;
+        }
+    }
+    
+    if (request->waiting == 0) {
+        *done = true;
+    } else if (lost || (int32_t)(now - request->wait_until) >= 0) {
+        if (!request->timed_out) {
+            request->timed_out = true;
+            s_probe_now_stats.timeouts++;
+        }
+        err = ESP_ERR_TIMEOUT;
+    }
+    xSemaphoreGive(s_state_mutex);
+    
+    return err;
+}
+
+const char* health_checker_probe_now_source_name(uint8_t source)
+{
+    switch (source) {
+        case PROBE_NOW_FRESH:
+            return "fresh";
+        case PROBE_NOW_JOINED:
+            return "joined";
+        case PROBE_NOW_RECENT:
+            return "recent";
+        case PROBE_NOW_BACKOFF:
+            return "backoff";
+        default:
+            return "unknown";
+    }
+}
+
+void health_checker_get_probe_now_stats(probe_now_stats_t* stats)
+{
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    *stats = s_probe_now_stats;
+    xSemaphoreGive(s_state_mutex);
+}
+
 void health_checker_on_wifi_connected(void)
 {
-    // Perform immediate health check when WiFi connection is established
-    if (is_running && wifi_manager_is_connected()) {
-        ESP_LOGI(TAG, "WiFi connected, performing immediate health check");
-        xTaskCreate(health_check_task, "health_check_task", 4096, NULL, 5, NULL);
+    if (!is_running || !wifi_manager_is_connected()) {
+        return;
+    }
+    
+    // A fleet reconnecting after a power cut must not check in lockstep. Spread mode checks at this
+    // device's offset within the interval, compressed into the reconnect window, unless its slot comes first
+    if (s_schedule_mode == SCHEDULE_MODE_SPREAD) {
+        uint32_t window_ms = check_interval_ms < SCHEDULE_RECONNECT_WINDOW_MS ?
+                             check_interval_ms : SCHEDULE_RECONNECT_WINDOW_MS;
+        uint32_t delay_ms = 0;
+        if (check_interval_ms > 0) {
+            delay_ms = (uint32_t)((uint64_t)(s_device_hash % check_interval_ms) * window_ms / check_interval_ms);
+        }
+        TickType_t delay = pdMS_TO_TICKS(delay_ms) > 0 ? pdMS_TO_TICKS(delay_ms) : 1;
+        TickType_t remaining = xTimerGetExpiryTime(health_check_timer) - xTaskGetTickCount();
+        if (xTimerIsTimerActive(health_check_timer) && remaining <= delay) {
+            return;
+        }
+        ESP_LOGI(TAG, "WiFi connected, health check in %u ms", delay_ms);
+        xTimerChangePeriod(health_check_timer, delay, pdMS_TO_TICKS(100));
+        return;
     }
+    
+    // Perform immediate health check when WiFi connection is established
+    ESP_LOGI(TAG, "WiFi connected, performing immediate health check");
+    dispatch_health_checks();
 }
 
 static void health_check_timer_callback(TimerHandle_t xTimer)
 {
     // Only perform health check if WiFi is connected
     if (wifi_manager_is_connected()) {
-        ESP_LOGD(TAG, "WiFi connected, performing health check");
-        xTaskCreate(health_check_task, "health_check_task", 4096, NULL, 5, NULL);
+        LOGR_D(LOG_MOD_CHECKER, "WiFi connected, performing health check");
+        dispatch_health_checks();
     } else {
-        ESP_LOGD(TAG, "WiFi not connected, skipping health check");
+        LOGR_D(LOG_MOD_CHECKER, "WiFi not connected, skipping health check");
         
-        // Set relay to OFF when WiFi is not connected
+        // Set relay to OFF when WiFi is not connected, this is not an outage of the targets
+        slo_pause();
         update_health_status(false);
     }
+    
+    xTimerChangePeriod(xTimer, next_check_delay(), 0);
 }
 
-static void health_check_task(void *pvParameters)
+static void dispatch_health_checks(void)
 {
-    // Double check WiFi connection before proceeding
-    if (!wifi_manager_is_connected()) {
-        ESP_LOGW(TAG, "WiFi disconnected during health check task creation, aborting");
-        update_health_status(false);
-        vTaskDelete(NULL);
-        return;
+    probe_job_t jobs[MAX_HEALTH_TARGETS];
+    int job_count = 0;
+    TickType_t now = xTaskGetTickCount();
+    
+    // Targets still waiting on the previous cycle are skipped rather than queued twice
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    s_dispatched = true;
+    s_last_dispatch = now;
+    for (uint8_t i = 0; i < s_target_count; i++) {
+        if (s_targets[i].in_flight) {
+            LOGR_W(LOG_MOD_CHECKER, "Target %d still in flight, skipping this cycle", i);
+            continue;
+        }
+        if (s_targets[i].backoff_ms > 0 && (int32_t)(now - s_targets[i].not_before) < 0) {
+            LOGR_D(LOG_MOD_CHECKER, "Target %d backing off, skipping this cycle", i);
+            continue;
+        }
+        prepare_job(i, now, &jobs[job_count++]);
     }
+    xSemaphoreGive(s_state_mutex);
     
-    ESP_LOGI(TAG, "Performing health check: %s", health_check_url);
+    submit_jobs(jobs, job_count);
+}
+
+static void prepare_job(uint8_t index, TickType_t now, probe_job_t* job)
+{
+    // Caller holds s_state_mutex
+    probe_budget_t budget;
+    probe_budget_resolve(&s_targets[index].config, check_interval_ms, &budget);
+    memset(job, 0, sizeof(*job));
+    job->target = index;
+    strncpy(job->host, s_targets[index].host, sizeof(job->host) - 1);
+    job->deadline = now + pdMS_TO_TICKS(budget.total_ms);
+    s_targets[index].in_flight = true;
+}
+
+static void submit_jobs(probe_job_t* jobs, int job_count)
+{
+    // Submit earliest deadline first so results are delivered in deadline order
+    for (int i = 1; i < job_count; i++) {
+        probe_job_t key = jobs[i];
+        int j = i - 1;
+        while (j >= 0 && (int32_t)(jobs[j].deadline - key.deadline) > 0) {
+            jobs[j + 1] = jobs[j];
+            j--;
+        }
+        jobs[j + 1] = key;
+    }
     
-    esp_http_client_config_t config = {
-        .url = health_check_url,
-        .event_handler = http_event_handler,
-        .timeout_ms = 10000,  // 10 seconds timeout
-        .method = HTTP_METHOD_GET,
-        .skip_cert_common_name_check = true,  // Skip certificate verification for HTTPS
-        .cert_pem = NULL,
-        .client_cert_pem = NULL,
-        .client_key_pem = NULL,
-    };
+    for (int i = 0; i < job_count; i++) {
+        if (probe_pool_submit(&jobs[i]) != ESP_OK) {
+            xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+            s_targets[jobs[i].target].in_flight = false;
+            xSemaphoreGive(s_state_mutex);
+        }
+    }
+}
+
+static void run_probe(const probe_job_t* job, probe_result_t* result)
+{
+    health_target_config_t target;
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    target = s_targets[job->target].config;
+    xSemaphoreGive(s_state_mutex);
     
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(TAG, "Failed to initialize HTTP client");
-        update_health_status(false);
-        vTaskDelete(NULL);
+    probe_budget_t budget;
+    probe_budget_resolve(&target, check_interval_ms, &budget);
+    probe_run(&target, &budget, job->deadline, result);
+}
+
+static void on_probe_done(const probe_job_t* job, const probe_result_t* probe_result)
+{
+    if (!is_running) {
         return;
     }
     
-    esp_err_t err = esp_http_client_perform(client);
-    if (err == ESP_OK) {
-        int status_code = esp_http_client_get_status_code(client);
-        ESP_LOGI(TAG, "HTTP Status: %d", status_code);
+    // Relay is ON only while every target that has reported is healthy
+    bool aggregate = true;
+    bool any_result = false;
+    probe_result_t verdict = *probe_result;
+    const probe_result_t* result = &verdict;
+    
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    if (job->target < s_target_count) {
+        target_state_t* target = &s_targets[job->target];
+        target->in_flight = false;
+        // A slow answer is a failure only once the latency average says so
+        apply_latency(target, probe_result);
+        if (verdict.healthy && target->latency_state == LATENCY_STATE_FAILED) {
+            verdict.healthy = false;
+            verdict.reason = PROBE_REASON_SLOW;
+        }
+        target->reason_counts[result->healthy ? PROBE_REASON_OK : result->reason % PROBE_REASON_COUNT]++;
+        apply_backoff(target, result);
+        target->completions++;
+        target->completed_at = xTaskGetTickCount();
+        target->last_probe = *result;
+        // 429 says nothing about the service's health, keep the previous verdict
+        if (result->reason != PROBE_REASON_THROTTLED) {
+            target->has_result = true;
+            target->last_result = *result;
+        }
+    }
+    check_history_record(job->target, result);
+    mqtt_publisher_record_result(job->target, result);
+    LOGR_I(LOG_MOD_CHECKER, "Target %d: %s, status %d (%u ms)", job->target,
+           result->healthy ? "OK" : probe_reason_name(result->reason), result->status_code, result->latency_ms);
+    for (uint8_t i = 0; i < s_target_count; i++) {
+        if (s_targets[i].has_result) {
+            any_result = true;
+            aggregate = aggregate && s_targets[i].last_result.healthy;
+        }
+    }
+    xSemaphoreGive(s_state_mutex);
+    
+    if (!wifi_manager_is_connected()) {
+        aggregate = false;
+    } else if (any_result) {
+        // An outage starts when the first failing probe started
+        slo_observe(aggregate, result->latency_ms);
+    }
+    if (any_result) {
+        update_health_status(aggregate);
+    }
+}
+
+static void set_target(uint8_t index, const health_target_config_t* config)
+{
+    // Caller holds s_state_mutex
+    target_state_t* target = &s_targets[index];
+    memset(target, 0, sizeof(*target));
+    target->config = *config;
+    target->config.url[sizeof(target->config.url) - 1] = '\0';
+    uint16_t port;
+    if (!probe_parse_address(target->config.url, target->host, sizeof(target->host), &port)) {
+        ESP_LOGW(TAG, "Target %d has no valid host: %s", index, target->config.url);
+    }
+    ESP_LOGI(TAG, "Target %d: %s (%s)", index, target->config.url, probe_type_name(target->config.type));
+}
+
+static TickType_t next_check_delay(void)
+{
+    uint32_t delay_ms = check_interval_ms;
+    
+    if (s_schedule_mode == SCHEDULE_MODE_SPREAD && check_interval_ms > 0) {
+        // Slots are multiples of the interval on the SNTP clock, uptime until it syncs,
+        // shifted by a per-device offset so devices that boot together still spread out
+        uint64_t now_ms = time_sync_epoch_ms();
+        if (now_ms == 0) {
+            now_ms = (uint64_t)xTaskGetTickCount() * portTICK_PERIOD_MS;
+        }
+        uint32_t offset_ms = s_device_hash % check_interval_ms;
+        uint32_t phase_ms = (uint32_t)((now_ms + check_interval_ms - offset_ms) % check_interval_ms);
+        delay_ms = check_interval_ms - phase_ms;
         
-        if (status_code == 200) {
-            ESP_LOGI(TAG, "Health check successful");
-            update_health_status(true);
-        } else {
-            ESP_LOGW(TAG, "Health check failed with status: %d", status_code);
-            update_health_status(false);
+        // Timer rounding can fire just before our slot, never check twice in one. Only a check that
+        // already ran counts, so a start or reconfigure late in the slot still checks at its end
+        bool checked = s_dispatched &&
+                       xTaskGetTickCount() - s_last_dispatch < pdMS_TO_TICKS(check_interval_ms / 2);
+        if (delay_ms < check_interval_ms / 2 && checked) {
+            delay_ms += check_interval_ms;
         }
+        
+        uint32_t jitter_max_ms = check_interval_ms / 10;
+        if (jitter_max_ms > SCHEDULE_MAX_JITTER_MS) {
+            jitter_max_ms = SCHEDULE_MAX_JITTER_MS;
+        }
+        if (jitter_max_ms > 0) {
+            delay_ms += esp_random() % jitter_max_ms;
+        }
+    }
+    
+    TickType_t ticks = pdMS_TO_TICKS(delay_ms);
+    return ticks > 0 ? ticks : 1;
+}
+
+static void apply_backoff(target_state_t* target, const probe_result_t* result)
+{
+    // Caller holds s_state_mutex
+    if (result->status_code != 429 && result->status_code != 503) {
+        target->backoff_ms = 0;
+        return;
+    }
+    
+    // Retry-After wins, otherwise double the wait starting from one interval
+    uint32_t backoff_ms = result->retry_after_ms;
+    if (backoff_ms == 0) {
+        backoff_ms = target->backoff_ms > 0 ? target->backoff_ms * 2 : check_interval_ms;
+    }
+    if (backoff_ms > BACKOFF_MAX_MS) {
+        backoff_ms = BACKOFF_MAX_MS;
+    }
+    target->backoff_ms = backoff_ms;
+    target->not_before = xTaskGetTickCount() + pdMS_TO_TICKS(backoff_ms);
+    LOGR_W(LOG_MOD_CHECKER, "Target %d answered %d, backing off %u ms", target - s_targets,
+           result->status_code, backoff_ms);
+}
+
+static void apply_latency(target_state_t* target, const probe_result_t* result)
+{
+    // Caller holds s_state_mutex. Only answers that made it count, failures already fail the target
+    if (!result->healthy) {
+        return;
+    }
+    
+    // Integer EWMA kept scaled up, like TCP's smoothed RTT: O(1) state and no rounding drift
+    uint32_t sample = result->latency_ms;
+    if (target->latency_ewma == 0) {
+        // The low bit keeps a first sample of 0 ms apart from no sample at all
+        target->latency_ewma = (sample << LATENCY_EWMA_SHIFT) | 1;
     } else {
-        ESP_LOGE(TAG, "HTTP request failed: %s", esp_err_to_name(err));
-        update_health_status(false);
+        target->latency_ewma += sample - (target->latency_ewma >> LATENCY_EWMA_SHIFT);
     }
     
-    esp_http_client_cleanup(client);
-    vTaskDelete(NULL);
-}
-
-static esp_err_t http_event_handler(esp_http_client_event_t *evt)
-{
-    switch (evt->event_id) {
-        case HTTP_EVENT_ERROR:
-            ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
-            break;
-        case HTTP_EVENT_ON_CONNECTED:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
-            break;
-        case HTTP_EVENT_HEADER_SENT:
-            ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
-            break;
-        case HTTP_EVENT_ON_HEADER:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-            break;
-        case HTTP_EVENT_ON_DATA:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            break;
-        case HTTP_EVENT_ON_FINISH:
-            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-            break;
-        case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
-            break;
-        default:
-            break;
+    uint32_t ewma_ms = target->latency_ewma >> LATENCY_EWMA_SHIFT;
+    uint8_t state = next_latency_state(target->latency_state, ewma_ms, &target->config);
+    if (state != target->latency_state) {
+        LOGR_W(LOG_MOD_CHECKER, "Target %d latency %s -> %s (average %u ms)", target - s_targets,
+               health_checker_latency_state_name(target->latency_state), health_checker_latency_state_name(state),
+               ewma_ms);
+        target->latency_state = state;
     }
-    return ESP_OK;
+}
+
+static uint8_t next_latency_state(uint8_t state, uint32_t ewma_ms, const health_target_config_t* config)
+{
+    // A state trips at its threshold and clears only below LATENCY_RECOVER_PERCENT of it,
+    // so an average hovering around a threshold does not flap
+    uint32_t failed_ms = config->latency_failed_ms;
+    if (failed_ms > 0 && state == LATENCY_STATE_FAILED) {
+        failed_ms = failed_ms * LATENCY_RECOVER_PERCENT / 100;
+    }
+    if (failed_ms > 0 && ewma_ms >= failed_ms) {
+        return LATENCY_STATE_FAILED;
+    }
+    
+    uint32_t degraded_ms = config->latency_degraded_ms;
+    if (degraded_ms > 0 && state != LATENCY_STATE_OK) {
+        degraded_ms = degraded_ms * LATENCY_RECOVER_PERCENT / 100;
+    }
+    if (degraded_ms > 0 && ewma_ms >= degraded_ms) {
+        return LATENCY_STATE_DEGRADED;
+    }
+    return LATENCY_STATE_OK;
 }
 
 static void update_health_status(bool status)
 {
+    // Called from probe workers and the timer task
+    xSemaphoreTake(s_status_mutex, portMAX_DELAY);
     if (last_health_status != status) {
         last_health_status = status;
         gpio_control_set_relay(status);
+        slo_relay_changed(status);
         health_checker_save_last_status(status);
-        ESP_LOGI(TAG, "Health status updated: %s, relay: %s", 
-                 status ? "OK" : "FAIL", 
-                 status ? "ON" : "OFF");
+        mqtt_publisher_publish_state(status);
+        LOGR_I(LOG_MOD_CHECKER, "Health status updated: %s, relay: %s",
+               status ? "OK" : "FAIL",
+               status ? "ON" : "OFF");
     }
+    xSemaphoreGive(s_status_mutex);
 }
 
 void health_checker_save_last_status(bool status)
@@ -3,14 +3,69 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "esp_err.h"
+#include "config.h"
+#include "probe_pool.h"
+
+// Latency verdict of a target, from the EWMA of its healthy probes
+typedef enum {
+    LATENCY_STATE_OK = 0,
+    LATENCY_STATE_DEGRADED,  // Reported only, the relay is not affected
+    LATENCY_STATE_FAILED,    // Healthy answers count as failures (PROBE_REASON_SLOW)
+} latency_state_t;
+
+// Where the result of an on-demand check came from
+typedef enum {
+    PROBE_NOW_FRESH = 0,  // A probe was started for this request
+    PROBE_NOW_JOINED,     // The probe already in flight was waited for
+    PROBE_NOW_RECENT,     // A result younger than PROBE_NOW_MIN_INTERVAL_MS was reused
+    PROBE_NOW_BACKOFF,    // The target is backing off after 429/503, no probe was started
+} probe_now_source_t;
+
+typedef struct {
+    bool requested;
+    bool has_result;          // False only for a target backing off before its first verdict
+    uint8_t source;           // probe_now_source_t
+    uint32_t age_ms;          // Of the result when it was fetched
+    uint32_t retry_after_ms;  // PROBE_NOW_BACKOFF only
+    probe_result_t result;
+} probe_now_t;
+
+typedef struct {
+    uint32_t fresh;
+    uint32_t joined;
+    uint32_t recent;
+    uint32_t backoff;
+    uint32_t timeouts;  // Requests whose probes did not report in time
+} probe_now_stats_t;
 
 // Function prototypes
-void health_checker_start(const char* url, uint32_t interval_ms);
+void health_checker_init(void);
+void health_checker_start(const health_target_config_t* targets, uint8_t target_count, uint32_t interval_ms,
+                          uint8_t schedule_mode);
 void health_checker_stop(void);
+void health_checker_reconfigure(const health_target_config_t* targets, uint8_t target_count, uint32_t interval_ms,
+                                uint8_t schedule_mode);  // Keeps relay state
 bool health_checker_is_running(void);
 bool health_checker_get_last_status(void);
 void health_checker_on_wifi_connected(void);  // Notify when WiFi is connected
 void health_checker_save_last_status(bool status);  // Save last status to NVS
 bool health_checker_load_last_status(void);  // Load last status from NVS
+void health_checker_report_status(bool status);  // Feed an externally determined status (e.g. heartbeat)
+uint8_t health_checker_get_target_count(void);
+bool health_checker_get_target_result(uint8_t target, probe_result_t* result);  // False until the target has reported
+uint32_t health_checker_get_target_backoff_ms(uint8_t target);  // Remaining 429/503 back-off
+bool health_checker_get_target_latency(uint8_t target, uint32_t* ewma_ms, uint8_t* state);  // False before a sample
+const char* health_checker_latency_state_name(uint8_t state);
+// Outcome counts per probe_reason_t and the phase budgets currently applied
+bool health_checker_get_target_stats(uint8_t target, uint32_t counts[PROBE_REASON_COUNT], probe_budget_t* budget);
+// Checks the targets in mask now, at most once per PROBE_NOW_MIN_INTERVAL_MS each, without waiting.
+// ESP_ERR_NOT_FOUND when mask selects no configured target
+esp_err_t health_checker_probe_start(uint8_t mask, uint32_t* id);
+// Results of a started request, done is false while a probe has not reported. ESP_ERR_NOT_FOUND for
+// an unknown or dropped id, ESP_ERR_TIMEOUT once a probe is overdue
+esp_err_t health_checker_probe_result(uint32_t id, probe_now_t results[MAX_HEALTH_TARGETS], bool* done);
+const char* health_checker_probe_now_source_name(uint8_t source);
+void health_checker_get_probe_now_stats(probe_now_stats_t* stats);
 
 #endif // HEALTH_CHECKER_H
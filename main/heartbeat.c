@@ -0,0 +1,363 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "config.h"
+#include "heartbeat.h"
+#include "health_checker.h"
+#include "slo.h"
+#include "log_ring.h"
+
+static const char *TAG = "HEARTBEAT";
+
+#define HEARTBEAT_RECV_TIMEOUT_MS 1000  // Longest the task sleeps before checking stop, rebind and the deadline
+#define HEARTBEAT_STOP_WAIT_MS 3000
+#define HEARTBEAT_REBIND_MS 5000        // Retry period while the UDP port cannot be bound
+
+// Global variables
+static SemaphoreHandle_t s_state_mutex = NULL;  // Serializes heartbeats, the deadline verdict and stop
+static SemaphoreHandle_t s_listener_done = NULL;
+static TaskHandle_t s_listener_task = NULL;     // Cleared once its done signal is taken, a stop that timed out keeps it
+static char s_token[MAX_HEARTBEAT_TOKEN_LENGTH];
+static volatile uint16_t s_port = 0;
+static volatile bool s_running = false;
+static volatile bool s_listener_running = false;
+static volatile bool s_listening = false;      // UDP port bound
+static TickType_t s_timeout_ticks = 0;
+static TickType_t s_deadline = 0;
+static bool s_deadline_armed = false;          // Cleared once the deadline has tripped, re-armed by a heartbeat
+static bool s_received = false;
+static TickType_t s_last_heartbeat_tick = 0;
+
+// Function prototypes
+static void heartbeat_listener_task(void *pvParameters);
+static int open_socket(uint16_t port);
+static TickType_t check_deadline(void);
+static bool token_matches(const char* token, size_t token_len);
+static bool start_listener(void);
+static void stop_listener(void);
+static void set_token(const char* token);
+static void arm_deadline(uint32_t timeout_ms);
+
+void heartbeat_start(uint16_t port, const char* token, uint32_t timeout_ms)
+{
+    ESP_LOGI(TAG, "Starting heartbeat monitor");
+    ESP_LOGI(TAG, "UDP port: %d, deadline: %d ms", port, timeout_ms);
+    
+    if (s_running) {
+        heartbeat_stop();
+    }
+    
+    if (s_state_mutex == NULL) {
+        s_state_mutex = xSemaphoreCreateMutex();
+        s_listener_done = xSemaphoreCreateBinary();
+        if (s_state_mutex == NULL || s_listener_done == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate heartbeat resources");
+            return;
+        }
+    }
+    
+    set_token(token);
+    s_port = port;
+    s_received = false;
+    
+    // Same restore behaviour as the polling checker
+    health_checker_report_status(health_checker_load_last_status());
+    
+    // The deadline is tracked by the listener task, re-armed by every valid heartbeat
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    arm_deadline(timeout_ms);
+    s_running = true;
+    xSemaphoreGive(s_state_mutex);
+    
+    if (!start_listener()) {
+        heartbeat_stop();
+        return;
+    }
+    
+    ESP_LOGI(TAG, "Heartbeat monitor started");
+}
+
+void heartbeat_stop(void)
+{
+    if (!s_running) {
+        return;
+    }
+    
+    ESP_LOGI(TAG, "Stopping heartbeat monitor");
+    
+    // After this no heartbeat or deadline can touch the relay
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    s_running = false;
+    s_deadline_armed = false;
+    xSemaphoreGive(s_state_mutex);
+    
+    stop_listener();
+    
+    slo_pause();
+    health_checker_report_status(false);  // Turn off relay and save status
+    ESP_LOGI(TAG, "Heartbeat monitor stopped");
+}
+
+void heartbeat_reconfigure(uint16_t port, const char* token, uint32_t timeout_ms)
+{
+    if (!s_running) {
+        return;
+    }
+    
+    ESP_LOGI(TAG, "Reconfiguring heartbeat monitor: UDP port %d, deadline %d ms", port, timeout_ms);
+    
+    // The new deadline counts from now, the relay keeps its current state
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    set_token(token);
+    arm_deadline(timeout_ms);
+    xSemaphoreGive(s_state_mutex);
+    
+    // The listener notices the new port and rebinds itself, no second task is started
+    if (port != s_port) {
+        s_port = port;
+        xTaskNotifyGive(s_listener_task);
+    }
+}
+
+bool heartbeat_is_running(void)
+{
+    return s_running;
+}
+
+bool heartbeat_is_listening(void)
+{
+    return s_running && s_listening;
+}
+
+esp_err_t heartbeat_feed(const char* token, size_t token_len)
+{
+    if (!s_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    
+    // Checked again under the mutex, a stop may have run meanwhile
+    if (!s_running) {
+        xSemaphoreGive(s_state_mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    if (!token_matches(token, token_len)) {
+        xSemaphoreGive(s_state_mutex);
+        LOGR_W(LOG_MOD_HEARTBEAT, "Rejected heartbeat with invalid token");
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    s_last_heartbeat_tick = xTaskGetTickCount();
+    s_received = true;
+    s_deadline = s_last_heartbeat_tick + s_timeout_ticks;
+    s_deadline_armed = true;
+    slo_observe(true, 0);
+    health_checker_report_status(true);
+    
+    xSemaphoreGive(s_state_mutex);
+    
+    LOGR_D(LOG_MOD_HEARTBEAT, "Heartbeat received");
+    return ESP_OK;
+}
+
+uint32_t heartbeat_get_last_age_ms(void)
+{
+    if (!s_received) {
+        return UINT32_MAX;
+    }
+    return (xTaskGetTickCount() - s_last_heartbeat_tick) * portTICK_PERIOD_MS;
+}
+
+static void heartbeat_listener_task(void *pvParameters)
+{
+    int sock = -1;
+    uint16_t bound_port = 0;
+    TickType_t next_bind = xTaskGetTickCount();
+    char buffer[MAX_HEARTBEAT_TOKEN_LENGTH + 8];
+    
+    while (s_listener_running) {
+        // A port change from reconfigure, the old socket goes first so a failed bind is retried below
+        if (sock >= 0 && bound_port != s_port) {
+            close(sock);
+            sock = -1;
+            s_listening = false;
+            next_bind = xTaskGetTickCount();
+        }
+        
+        if (sock < 0 && (int32_t)(xTaskGetTickCount() - next_bind) >= 0) {
+            bound_port = s_port;
+            sock = open_socket(bound_port);
+            s_listening = sock >= 0;
+            next_bind = xTaskGetTickCount() + pdMS_TO_TICKS(HEARTBEAT_REBIND_MS);
+        }
+        
+        // Never sleep past the deadline, the verdict is given on this task rather than the timer task
+        TickType_t wait = check_deadline();
+        if (wait > pdMS_TO_TICKS(HEARTBEAT_RECV_TIMEOUT_MS)) {
+            wait = pdMS_TO_TICKS(HEARTBEAT_RECV_TIMEOUT_MS);
+        }
+        if (wait == 0) {
+            wait = 1;
+        }
+        
+        if (sock < 0) {
+            ulTaskNotifyTake(pdTRUE, wait);
+            continue;
+        }
+        
+        uint32_t wait_ms = wait * portTICK_PERIOD_MS;
+        struct timeval timeout = {
+            .tv_sec = wait_ms / 1000,
+            .tv_usec = (wait_ms % 1000) * 1000,
+        };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        
+        int len = recvfrom(sock, buffer, sizeof(buffer), 0, NULL, NULL);
+        if (len < 0) {
+            continue;  // Timeout, check stop, port and deadline again
+        }
+        
+        // Senders commonly append a newline (e.g. echo | nc -u)
+        while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r')) {
+            len--;
+        }
+        heartbeat_feed(buffer, len);
+    }
+    
+    if (sock >= 0) {
+        close(sock);
+    }
+    s_listening = false;
+    
+    xSemaphoreGive(s_listener_done);
+    vTaskDelete(NULL);
+}
+
+static int open_socket(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        LOGR_E(LOG_MOD_HEARTBEAT, "Failed to create UDP socket: errno %d, retrying", errno);
+        return -1;
+    }
+    
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOGR_E(LOG_MOD_HEARTBEAT, "Failed to bind UDP port %d: errno %d, retrying", port, errno);
+        close(sock);
+        return -1;
+    }
+    
+    ESP_LOGI(TAG, "Listening for heartbeats on UDP port %d", port);
+    return sock;
+}
+
+static TickType_t check_deadline(void)
+{
+    TickType_t wait = portMAX_DELAY;
+    
+    xSemaphoreTake(s_state_mutex, portMAX_DELAY);
+    if (s_deadline_armed) {
+        int32_t remaining = (int32_t)(s_deadline - xTaskGetTickCount());
+        if (remaining > 0) {
+            wait = (TickType_t)remaining;
+        } else {
+            s_deadline_armed = false;
+            LOGR_W(LOG_MOD_HEARTBEAT, "No heartbeat within deadline");
+            // The sender went quiet after its last heartbeat
+            uint32_t age_ms = heartbeat_get_last_age_ms();
+            slo_observe(false, age_ms != UINT32_MAX ? age_ms : 0);
+            health_checker_report_status(false);
+        }
+    }
+    xSemaphoreGive(s_state_mutex);
+    
+    return wait;
+}
+
+static bool token_matches(const char* token, size_t token_len)
+{
+    size_t expected_len = strlen(s_token);
+    if (expected_len == 0) {
+        return true;
+    }
+    if (token == NULL || token_len != expected_len) {
+        return false;
+    }
+    
+    // Constant time compare, the token is a shared secret
+    uint8_t diff = 0;
+    for (size_t i = 0; i < expected_len; i++) {
+        diff |= (uint8_t)(token[i] ^ s_token[i]);
+    }
+    return diff == 0;
+}
+
+static bool start_listener(void)
+{
+    // A previous listener that missed its stop deadline must be gone before a new one runs
+    if (s_listener_task != NULL &&
+        xSemaphoreTake(s_listener_done, pdMS_TO_TICKS(HEARTBEAT_STOP_WAIT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Previous heartbeat listener still running");
+        return false;
+    }
+    s_listener_task = NULL;
+    
+    s_listener_running = true;
+    if (xTaskCreate(heartbeat_listener_task, "heartbeat_task", HEARTBEAT_TASK_STACK, NULL, 5,
+                    &s_listener_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create heartbeat listener task");
+        s_listener_running = false;
+        s_listener_task = NULL;
+        return false;
+    }
+    return true;
+}
+
+static void stop_listener(void)
+{
+    if (!s_listener_running) {
+        return;
+    }
+    s_listener_running = false;
+    xTaskNotifyGive(s_listener_task);
+    
+    // Wait for the listener to close its socket so the port can be reused
+    if (xSemaphoreTake(s_listener_done, pdMS_TO_TICKS(HEARTBEAT_STOP_WAIT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Heartbeat listener did not stop in time");
+        return;
+    }
+    s_listener_task = NULL;
+}
+
+static void set_token(const char* token)
+{
+    strncpy(s_token, token, sizeof(s_token) - 1);
+    s_token[sizeof(s_token) - 1] = '\0';
+    if (strlen(s_token) == 0) {
+        ESP_LOGW(TAG, "No heartbeat token configured, any heartbeat will be accepted");
+    }
+}
+
+static void arm_deadline(uint32_t timeout_ms)
+{
+    if (timeout_ms < HEARTBEAT_MIN_TIMEOUT_MS) {
+        timeout_ms = HEARTBEAT_MIN_TIMEOUT_MS;
+    }
+    s_timeout_ticks = pdMS_TO_TICKS(timeout_ms);
+    s_deadline = xTaskGetTickCount() + s_timeout_ticks;
+    s_deadline_armed = true;
+}
@@ -0,0 +1,17 @@
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Function prototypes
+void heartbeat_start(uint16_t port, const char* token, uint32_t timeout_ms);
+void heartbeat_stop(void);
+void heartbeat_reconfigure(uint16_t port, const char* token, uint32_t timeout_ms);  // Keeps relay state
+bool heartbeat_is_running(void);
+bool heartbeat_is_listening(void);  // UDP port bound, a failed bind is retried every few seconds
+esp_err_t heartbeat_feed(const char* token, size_t token_len);  // ESP_ERR_INVALID_ARG on token mismatch
+uint32_t heartbeat_get_last_age_ms(void);  // UINT32_MAX if none received yet
+
+#endif // HEARTBEAT_H
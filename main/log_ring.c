@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "config.h"
+#include "log_ring.h"
+
+static const char *TAG = "LOG_RING";
+
+#define LOG_RING_LINE_LENGTH 160
+#define LOG_RING_FORMAT_LENGTH 96  // Longest format string, copied out of flash before use
+
+// Global variables
+uint8_t g_log_levels[LOG_MOD_COUNT];
+static log_record_t s_records[LOG_RING_CAPACITY];
+static uint32_t s_total = 0;       // Records ever written, also the next sequence number
+static uint32_t s_uart_seq = 0;    // Next record for the UART drain
+static log_ring_stats_t s_stats;
+
+static const char *s_module_names[LOG_MOD_COUNT] = {
+    [LOG_MOD_CHECKER] = "HEALTH_CHECKER",
+    [LOG_MOD_PROBE] = "PROBE",
+    [LOG_MOD_POOL] = "PROBE_POOL",
+    [LOG_MOD_GPIO] = "GPIO_CONTROL",
+    [LOG_MOD_HEARTBEAT] = "HEARTBEAT",
+    [LOG_MOD_MQTT] = "MQTT_PUBLISHER",
+};
+
+static const char *s_level_names[] = { "none", "error", "warn", "info", "debug", "verbose" };
+static const char s_level_letters[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+
+// Function prototypes
+static void log_ring_task(void *pvParameters);
+static uint32_t oldest_seq(void);
+
+void log_ring_init(void)
+{
+    for (int i = 0; i < LOG_MOD_COUNT; i++) {
+        g_log_levels[i] = CONFIG_LOG_DEFAULT_LEVEL;
+    }
+    
+    if (xTaskCreate(log_ring_task, "log_ring", LOG_RING_TASK_STACK, NULL, 1, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create log drain task");
+        return;
+    }
+    ESP_LOGI(TAG, "Log ring: %d records, %d bytes", LOG_RING_CAPACITY, (int)sizeof(s_records));
+}
+
+void log_ring_write(uint8_t module, uint8_t level, const char *fmt, int nargs, ...)
+{
+    int64_t start_us = esp_timer_get_time();
+    
+    log_record_t record = {
+        .time_ms = xTaskGetTickCount() * portTICK_PERIOD_MS,
+        .fmt = fmt,
+        .module = module,
+        .level = level,
+    };
+    va_list ap;
+    va_start(ap, nargs);
+    for (int i = 0; i < nargs && i < LOG_RING_MAX_ARGS; i++) {
+        record.args[i] = va_arg(ap, uintptr_t);
+    }
+    va_end(ap);
+    
+    // A struct copy is all the hot path pays, formatting happens in the drain task
+    taskENTER_CRITICAL();
+    s_records[s_total % LOG_RING_CAPACITY] = record;
+    s_total++;
+    s_stats.written++;
+    if ((int32_t)(s_uart_seq - oldest_seq()) < 0) {
+        s_stats.dropped += oldest_seq() - s_uart_seq;
+        s_uart_seq = oldest_seq();
+    }
+    s_stats.write_us_total += (uint32_t)(esp_timer_get_time() - start_us);
+    taskEXIT_CRITICAL();
+}
+
+bool log_ring_set_level(const char *module_name, esp_log_level_t level)
+{
+    bool found = false;
+    
+    // "*" sets every module, including plain ESP_LOG tags
+    if (strcmp(module_name, "*") == 0) {
+        for (int i = 0; i < LOG_MOD_COUNT; i++) {
+            g_log_levels[i] = level;
+        }
+        esp_log_level_set("*", level);
+        return true;
+    }
+    
+    for (int i = 0; i < LOG_MOD_COUNT; i++) {
+        if (strcasecmp(module_name, s_module_names[i]) == 0) {
+            g_log_levels[i] = level;
+            found = true;
+        }
+    }
+    // The same tag may also log through ESP_LOG outside the hot path
+    esp_log_level_set(module_name, level);
+    
+    ESP_LOGI(TAG, "Log level for %s set to %s", module_name, log_ring_level_name(level));
+    return found;
+}
+
+const char* log_ring_module_name(uint8_t module)
+{
+    return module < LOG_MOD_COUNT ? s_module_names[module] : "?";
+}
+
+const char* log_ring_level_name(uint8_t level)
+{
+    return level <= ESP_LOG_VERBOSE ? s_level_names[level] : "?";
+}
+
+bool log_ring_parse_level(const char *name, esp_log_level_t *level)
+{
+    for (int i = 0; i <= ESP_LOG_VERBOSE; i++) {
+        if (strcasecmp(name, s_level_names[i]) == 0) {
+            *level = (esp_log_level_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void log_ring_get_stats(log_ring_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    *stats = s_stats;
+    taskEXIT_CRITICAL();
+}
+
+size_t log_ring_read(uint32_t *seq, log_record_t *records, size_t max)
+{
+    size_t count = 0;
+    
+    taskENTER_CRITICAL();
+    if ((int32_t)(*seq - oldest_seq()) < 0) {
+        *seq = oldest_seq();
+    }
+    while (count < max && *seq != s_total) {
+        records[count++] = s_records[*seq % LOG_RING_CAPACITY];
+        (*seq)++;
+    }
+    taskEXIT_CRITICAL();
+    
+    return count;
+}
+
+uint32_t log_ring_oldest_seq(void)
+{
+    return oldest_seq();
+}
+
+int log_ring_format(const log_record_t *record, char *buffer, size_t size)
+{
+    int64_t start_us = esp_timer_get_time();
+    
+    int len = snprintf(buffer, size, "%c (%u) %s: ",
+                       s_level_letters[record->level <= ESP_LOG_VERBOSE ? record->level : 0],
+                       record->time_ms, log_ring_module_name(record->module));
+    if (len >= 0 && (size_t)len < size) {
+        char fmt[LOG_RING_FORMAT_LENGTH];
+        flash_strlcpy(fmt, record->fmt, sizeof(fmt));
+        
+        // Unused trailing arguments are ignored by the format
+        int body = snprintf(buffer + len, size - len, fmt,
+                            record->args[0], record->args[1], record->args[2], record->args[3]);
+        if (body > 0) {
+            len += body;
+        }
+    }
+    if (len >= (int)size) {
+        len = size - 1;
+    }
+    
+    taskENTER_CRITICAL();
+    s_stats.formatted++;
+    s_stats.format_us_total += (uint32_t)(esp_timer_get_time() - start_us);
+    taskEXIT_CRITICAL();
+    
+    return len;
+}
+
+static void log_ring_task(void *pvParameters)
+{
+    log_record_t records[4];
+    char line[LOG_RING_LINE_LENGTH];
+    
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(LOG_RING_DRAIN_INTERVAL_MS));
+        
+        // Lowest priority, the UART only gets what is left after the checks
+        size_t count;
+        do {
+            uint32_t seq = s_uart_seq;
+            count = log_ring_read(&seq, records, sizeof(records) / sizeof(records[0]));
+            taskENTER_CRITICAL();
+            // A writer may have pushed s_uart_seq past what we read
+            if ((int32_t)(seq - s_uart_seq) > 0) {
+                s_uart_seq = seq;
+            }
+            taskEXIT_CRITICAL();
+            
+            for (size_t i = 0; i < count; i++) {
+                log_ring_format(&records[i], line, sizeof(line));
+                printf("%s\n", line);
+            }
+        } while (count > 0);
+    }
+}
+
+static uint32_t oldest_seq(void)
+{
+    return s_total > LOG_RING_CAPACITY ? s_total - LOG_RING_CAPACITY : 0;
+}
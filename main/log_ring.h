@@ -0,0 +1,82 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_log.h"
+#include "config.h"
+#include "flash_data.h"
+
+// Modules that log through the ring, names match their ESP_LOG tags
+typedef enum {
+    LOG_MOD_CHECKER = 0,
+    LOG_MOD_PROBE,
+    LOG_MOD_POOL,
+    LOG_MOD_GPIO,
+    LOG_MOD_HEARTBEAT,
+    LOG_MOD_MQTT,
+    LOG_MOD_COUNT
+} log_module_t;
+
+#define LOG_RING_MAX_ARGS 4
+
+// Binary record, formatted only when drained
+typedef struct {
+    uint32_t time_ms;
+    const char *fmt;  // String literal in flash, doubles as the format id
+    uintptr_t args[LOG_RING_MAX_ARGS];
+    uint8_t module;   // log_module_t
+    uint8_t level;    // esp_log_level_t
+} log_record_t;
+
+typedef struct {
+    uint32_t written;
+    uint32_t dropped;          // Overwritten before the UART drain reached them
+    uint32_t write_us_total;   // Time spent in the hot path
+    uint32_t formatted;
+    uint32_t format_us_total;  // Time spent formatting, what the hot path used to pay
+} log_ring_stats_t;
+
+// Runtime level per module, read inline by the macros below
+extern uint8_t g_log_levels[LOG_MOD_COUNT];
+
+// Function prototypes
+void log_ring_init(void);
+void log_ring_write(uint8_t module, uint8_t level, const char *fmt, int nargs, ...);
+bool log_ring_set_level(const char *module_name, esp_log_level_t level);  // Also updates ESP_LOG for the tag
+const char* log_ring_module_name(uint8_t module);
+const char* log_ring_level_name(uint8_t level);
+bool log_ring_parse_level(const char *name, esp_log_level_t *level);
+void log_ring_get_stats(log_ring_stats_t *stats);
+// Reads records from seq onwards without consuming them, returns the number copied.
+// *seq is moved forward, past any records that were already overwritten.
+size_t log_ring_read(uint32_t *seq, log_record_t *records, size_t max);
+uint32_t log_ring_oldest_seq(void);
+int log_ring_format(const log_record_t *record, char *buffer, size_t size);
+
+// Arguments must be integers or pointers to static strings, they are stored by value
+// and formatted later. Levels above LOG_RING_COMPILE_LEVEL compile to nothing.
+#define LOG_RING_CAT_(a, b) a##b
+#define LOG_RING_CAT(a, b) LOG_RING_CAT_(a, b)
+#define LOG_RING_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+#define LOG_RING_NARGS(...) LOG_RING_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define LOG_RING_ARGS_0()
+#define LOG_RING_ARGS_1(a) , (uintptr_t)(a)
+#define LOG_RING_ARGS_2(a, b) , (uintptr_t)(a), (uintptr_t)(b)
+#define LOG_RING_ARGS_3(a, b, c) , (uintptr_t)(a), (uintptr_t)(b), (uintptr_t)(c)
+#define LOG_RING_ARGS_4(a, b, c, d) , (uintptr_t)(a), (uintptr_t)(b), (uintptr_t)(c), (uintptr_t)(d)
+
+#define LOG_RING(module, level, fmt, ...) do { \
+        if ((level) <= LOG_RING_COMPILE_LEVEL && (level) <= g_log_levels[module]) { \
+            log_ring_write((module), (level), FLASH_STR(fmt), LOG_RING_NARGS(__VA_ARGS__) \
+                           LOG_RING_CAT(LOG_RING_ARGS_, LOG_RING_NARGS(__VA_ARGS__))(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+#define LOGR_E(module, fmt, ...) LOG_RING(module, ESP_LOG_ERROR, fmt, ##__VA_ARGS__)
+#define LOGR_W(module, fmt, ...) LOG_RING(module, ESP_LOG_WARN, fmt, ##__VA_ARGS__)
+#define LOGR_I(module, fmt, ...) LOG_RING(module, ESP_LOG_INFO, fmt, ##__VA_ARGS__)
+#define LOGR_D(module, fmt, ...) LOG_RING(module, ESP_LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif // LOG_RING_H
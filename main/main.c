@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -13,26 +14,46 @@
 #include "config.h"
 #include "wifi_manager.h"
 #include "config_server.h"
+#include "config_update.h"
+#include "config_store.h"
 #include "health_checker.h"
+#include "probe.h"
+#include "heartbeat.h"
+#include "api_server.h"
+#include "mqtt_publisher.h"
+#include "syslog_sink.h"
+#include "check_history.h"
+#include "slo.h"
+#include "log_ring.h"
 #include "gpio_control.h"
 
 static const char *TAG = "MAIN";
 
 // Global variables
-device_config_t g_device_config;
 bool g_config_mode = false;
 
 // Function prototypes
 static void button_task(void *pvParameters);
-static void load_config_from_nvs(void);
-static void save_config_to_nvs(void);
+static void load_config_from_nvs(device_config_t* config);
+static void save_config_to_nvs(const device_config_t* config);
 static void enter_config_mode(void);
 static void enter_execution_mode(void);
+static void start_monitoring(void);
+static bool monitoring_active(void);
+static void start_mqtt_publisher(void);
+static void start_syslog_sink(void);
+static void wifi_reconnect_task(void *pvParameters);
+static uint8_t get_wifi_profiles(const device_config_t* config, wifi_profile_t* profiles);
+static void config_published(const device_config_t* old_config, const device_config_t* new_config,
+                             uint32_t version, void* ctx);
 
 void app_main(void)
 {
     ESP_LOGI(TAG, "Starting Monitor Health Checker");
     
+    // Deferred logging first so every module can use it
+    log_ring_init();
+    
     // Initialize NVS
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -44,8 +65,21 @@ void app_main(void)
     // Initialize GPIO
     gpio_control_init();
     
-    // Load configuration from NVS
-    load_config_from_nvs();
+    // Initialize health checker state, result history and availability windows
+    health_checker_init();
+    check_history_init();
+    slo_init();
+    
+    // Load configuration from NVS, every other task reads it through config_store snapshots
+    device_config_t *loaded = calloc(1, sizeof(device_config_t));
+    if (loaded == NULL) {
+        ESP_LOGE(TAG, "No memory to load the configuration");
+        esp_restart();
+    }
+    load_config_from_nvs(loaded);
+    config_store_init(loaded);
+    free(loaded);
+    config_store_subscribe(config_published, NULL);
     
     // Initialize WiFi
     wifi_manager_init();
@@ -54,7 +88,11 @@ void app_main(void)
     xTaskCreate(button_task, "button_task", 2048, NULL, 10, NULL);
     
     // Check if device is configured
-    if (g_device_config.configured) {
+    const device_config_t* config = config_store_acquire();
+    bool configured = config->configured;
+    config_store_release(config);
+    
+    if (configured) {
         ESP_LOGI(TAG, "Device is configured, entering execution mode");
         enter_execution_mode();
     } else {
@@ -93,47 +131,128 @@ static void button_task(void *pvParameters)
     }
 }
 
-static void load_config_from_nvs(void)
+static void load_config_from_nvs(device_config_t* config)
 {
     nvs_handle_t nvs_handle;
     esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
     
     if (err != ESP_OK) {
         ESP_LOGI(TAG, "NVS namespace not found, using defaults");
-        memset(&g_device_config, 0, sizeof(g_device_config));
-        g_device_config.check_interval_ms = DEFAULT_HEALTH_CHECK_INTERVAL_MS;
+        memset(config, 0, sizeof(*config));
+        config->check_interval_ms = DEFAULT_HEALTH_CHECK_INTERVAL_MS;
+        config->heartbeat_port = HEARTBEAT_DEFAULT_PORT;
+        config->heartbeat_timeout_ms = HEARTBEAT_DEFAULT_TIMEOUT_MS;
         return;
     }
     
-    size_t required_size = sizeof(g_device_config.wifi_ssid);
-    nvs_get_str(nvs_handle, NVS_KEY_WIFI_SSID, g_device_config.wifi_ssid, &required_size);
+    size_t required_size = sizeof(config->wifi_ssid);
+    nvs_get_str(nvs_handle, NVS_KEY_WIFI_SSID, config->wifi_ssid, &required_size);
+    
+    required_size = sizeof(config->wifi_password);
+    nvs_get_str(nvs_handle, NVS_KEY_WIFI_PASSWORD, config->wifi_password, &required_size);
     
-    required_size = sizeof(g_device_config.wifi_password);
-    nvs_get_str(nvs_handle, NVS_KEY_WIFI_PASSWORD, g_device_config.wifi_password, &required_size);
+    // Backup networks are stored as one blob, like the additional targets
+    uint8_t wifi_backup_count = 0;
+    if (nvs_get_u8(nvs_handle, NVS_KEY_WIFI_BACKUP_COUNT, &wifi_backup_count) == ESP_OK &&
+        wifi_backup_count > 0 && wifi_backup_count <= MAX_WIFI_BACKUPS) {
+        required_size = sizeof(config->wifi_backups);
+        if (nvs_get_blob(nvs_handle, NVS_KEY_WIFI_BACKUPS, config->wifi_backups, &required_size) == ESP_OK &&
+            required_size == sizeof(config->wifi_backups)) {
+            config->wifi_backup_count = wifi_backup_count;
+        } else {
+            ESP_LOGW(TAG, "Stored WiFi backups do not match this firmware, ignoring them");
+            memset(config->wifi_backups, 0, sizeof(config->wifi_backups));
+        }
+    }
     
-    required_size = sizeof(g_device_config.health_check_url);
-    nvs_get_str(nvs_handle, NVS_KEY_HEALTH_URL, g_device_config.health_check_url, &required_size);
+    required_size = sizeof(config->targets[0].url);
+    if (nvs_get_str(nvs_handle, NVS_KEY_HEALTH_URL, config->targets[0].url, &required_size) == ESP_OK) {
+        config->target_count = 1;
+    }
     
-    required_size = sizeof(g_device_config.check_interval_ms);
-    if (nvs_get_u32(nvs_handle, NVS_KEY_CHECK_INTERVAL, &g_device_config.check_interval_ms) != ESP_OK) {
-        g_device_config.check_interval_ms = DEFAULT_HEALTH_CHECK_INTERVAL_MS;
+    // Targets and their options are stored as one blob, the primary included; its URL also keeps its own key
+    // A blob of another layout still reads fine with a short length, so it goes to a scratch copy
+    // and is kept only when its version and size both match this firmware
+    uint8_t target_count = 0;
+    uint8_t targets_version = 0;
+    bool targets_loaded = false;
+    nvs_get_u8(nvs_handle, NVS_KEY_TARGETS_VERSION, &targets_version);
+    if (nvs_get_u8(nvs_handle, NVS_KEY_TARGET_COUNT, &target_count) == ESP_OK &&
+        target_count >= 1 && target_count <= MAX_HEALTH_TARGETS) {
+        health_target_config_t *stored = malloc(sizeof(config->targets));
+        required_size = sizeof(config->targets);
+        if (stored != NULL && targets_version == TARGETS_BLOB_VERSION &&
+            nvs_get_blob(nvs_handle, NVS_KEY_TARGETS, stored, &required_size) == ESP_OK &&
+            required_size == sizeof(config->targets)) {
+            memcpy(config->targets, stored, sizeof(config->targets));
+            config->target_count = target_count;
+            targets_loaded = true;
+        } else {
+            ESP_LOGW(TAG, "Stored targets do not match this firmware, keeping primary URL only");
+        }
+        free(stored);
     }
     
+    // Only the primary URL is known without the blob, tcp:// and udp:// must not fall back to HTTP
+    if (!targets_loaded && config->target_count > 0) {
+        config->targets[0].type = probe_type_from_url(config->targets[0].url);
+    }
+    
+    required_size = sizeof(config->check_interval_ms);
+    if (nvs_get_u32(nvs_handle, NVS_KEY_CHECK_INTERVAL, &config->check_interval_ms) != ESP_OK) {
+        config->check_interval_ms = DEFAULT_HEALTH_CHECK_INTERVAL_MS;
+    }
+    
+    uint8_t schedule_mode = SCHEDULE_MODE_SPREAD;
+    nvs_get_u8(nvs_handle, NVS_KEY_SCHEDULE_MODE, &schedule_mode);
+    config->schedule_mode = schedule_mode;
+    
+    uint8_t monitor_mode = MONITOR_MODE_POLL;
+    nvs_get_u8(nvs_handle, NVS_KEY_MONITOR_MODE, &monitor_mode);
+    config->monitor_mode = monitor_mode;
+    
+    if (nvs_get_u16(nvs_handle, NVS_KEY_HEARTBEAT_PORT, &config->heartbeat_port) != ESP_OK) {
+        config->heartbeat_port = HEARTBEAT_DEFAULT_PORT;
+    }
+    if (nvs_get_u32(nvs_handle, NVS_KEY_HEARTBEAT_TIMEOUT, &config->heartbeat_timeout_ms) != ESP_OK) {
+        config->heartbeat_timeout_ms = HEARTBEAT_DEFAULT_TIMEOUT_MS;
+    }
+    required_size = sizeof(config->heartbeat_token);
+    nvs_get_str(nvs_handle, NVS_KEY_HEARTBEAT_TOKEN, config->heartbeat_token, &required_size);
+    
+    required_size = sizeof(config->mqtt_uri);
+    nvs_get_str(nvs_handle, NVS_KEY_MQTT_URI, config->mqtt_uri, &required_size);
+    
+    required_size = sizeof(config->mqtt_topic);
+    nvs_get_str(nvs_handle, NVS_KEY_MQTT_TOPIC, config->mqtt_topic, &required_size);
+    
+    required_size = sizeof(config->api_token);
+    nvs_get_str(nvs_handle, NVS_KEY_API_TOKEN, config->api_token, &required_size);
+    
+    required_size = sizeof(config->syslog_server);
+    nvs_get_str(nvs_handle, NVS_KEY_SYSLOG_SERVER, config->syslog_server, &required_size);
+    
     uint8_t configured = 0;
     if (nvs_get_u8(nvs_handle, NVS_KEY_CONFIGURED, &configured) == ESP_OK) {
-        g_device_config.configured = (configured == 1);
+        config->configured = (configured == 1);
     }
     
     nvs_close(nvs_handle);
     
     ESP_LOGI(TAG, "Configuration loaded from NVS");
-    ESP_LOGI(TAG, "WiFi SSID: %s", g_device_config.wifi_ssid);
-    ESP_LOGI(TAG, "Health URL: %s", g_device_config.health_check_url);
-    ESP_LOGI(TAG, "Check interval: %d ms", g_device_config.check_interval_ms);
-    ESP_LOGI(TAG, "Configured: %s", g_device_config.configured ? "Yes" : "No");
+    ESP_LOGI(TAG, "WiFi SSID: %s", config->wifi_ssid);
+    for (uint8_t i = 0; i < config->wifi_backup_count; i++) {
+        ESP_LOGI(TAG, "WiFi backup %d: %s", i + 1, config->wifi_backups[i].ssid);
+    }
+    for (uint8_t i = 0; i < config->target_count; i++) {
+        ESP_LOGI(TAG, "Health URL %d: %s", i, config->targets[i].url);
+    }
+    ESP_LOGI(TAG, "Check interval: %d ms", config->check_interval_ms);
+    ESP_LOGI(TAG, "Monitor mode: %s", config->monitor_mode == MONITOR_MODE_HEARTBEAT ? "heartbeat" : "poll");
+    ESP_LOGI(TAG, "Configured: %s", config->configured ? "Yes" : "No");
 }
 
-static void save_config_to_nvs(void)
+static void save_config_to_nvs(const device_config_t* config)
 {
     nvs_handle_t nvs_handle;
     esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
@@ -143,11 +262,25 @@ static void save_config_to_nvs(void)
         return;
     }
     
-    nvs_set_str(nvs_handle, NVS_KEY_WIFI_SSID, g_device_config.wifi_ssid);
-    nvs_set_str(nvs_handle, NVS_KEY_WIFI_PASSWORD, g_device_config.wifi_password);
-    nvs_set_str(nvs_handle, NVS_KEY_HEALTH_URL, g_device_config.health_check_url);
-    nvs_set_u32(nvs_handle, NVS_KEY_CHECK_INTERVAL, g_device_config.check_interval_ms);
-    nvs_set_u8(nvs_handle, NVS_KEY_CONFIGURED, g_device_config.configured ? 1 : 0);
+    nvs_set_str(nvs_handle, NVS_KEY_WIFI_SSID, config->wifi_ssid);
+    nvs_set_str(nvs_handle, NVS_KEY_WIFI_PASSWORD, config->wifi_password);
+    nvs_set_u8(nvs_handle, NVS_KEY_WIFI_BACKUP_COUNT, config->wifi_backup_count);
+    nvs_set_blob(nvs_handle, NVS_KEY_WIFI_BACKUPS, config->wifi_backups, sizeof(config->wifi_backups));
+    nvs_set_str(nvs_handle, NVS_KEY_HEALTH_URL, config->targets[0].url);
+    nvs_set_u8(nvs_handle, NVS_KEY_TARGET_COUNT, config->target_count);
+    nvs_set_blob(nvs_handle, NVS_KEY_TARGETS, config->targets, sizeof(config->targets));
+    nvs_set_u8(nvs_handle, NVS_KEY_TARGETS_VERSION, TARGETS_BLOB_VERSION);
+    nvs_set_u32(nvs_handle, NVS_KEY_CHECK_INTERVAL, config->check_interval_ms);
+    nvs_set_u8(nvs_handle, NVS_KEY_SCHEDULE_MODE, config->schedule_mode);
+    nvs_set_u8(nvs_handle, NVS_KEY_MONITOR_MODE, config->monitor_mode);
+    nvs_set_u16(nvs_handle, NVS_KEY_HEARTBEAT_PORT, config->heartbeat_port);
+    nvs_set_u32(nvs_handle, NVS_KEY_HEARTBEAT_TIMEOUT, config->heartbeat_timeout_ms);
+    nvs_set_str(nvs_handle, NVS_KEY_HEARTBEAT_TOKEN, config->heartbeat_token);
+    nvs_set_str(nvs_handle, NVS_KEY_MQTT_URI, config->mqtt_uri);
+    nvs_set_str(nvs_handle, NVS_KEY_MQTT_TOPIC, config->mqtt_topic);
+    nvs_set_str(nvs_handle, NVS_KEY_API_TOKEN, config->api_token);
+    nvs_set_str(nvs_handle, NVS_KEY_SYSLOG_SERVER, config->syslog_server);
+    nvs_set_u8(nvs_handle, NVS_KEY_CONFIGURED, config->configured ? 1 : 0);
     
     nvs_commit(nvs_handle);
     nvs_close(nvs_handle);
@@ -160,18 +293,28 @@ static void enter_config_mode(void)
     ESP_LOGI(TAG, "Entering configuration mode");
     g_config_mode = true;
     
-    // Stop health checker if running
-    health_checker_stop();
+    // Stop execution mode API server, the configuration server takes over port 80 and keeps
+    // the monitoring endpoints while monitoring runs on
+    api_server_stop();
     
-    // Turn off relay
-    gpio_control_set_relay(false);
+    if (monitoring_active()) {
+        // Keep checking and keep the relay as it is, the AP is added next to the station
+        wifi_manager_start_apsta();
+    } else {
+        // Stop MQTT publishing and remote logging, the station goes away
+        mqtt_publisher_stop();
+        syslog_sink_stop();
+        
+        // Turn off relay
+        gpio_control_set_relay(false);
+        
+        // Start AP mode
+        wifi_manager_start_ap();
+    }
     
     // Set blue LED to indicate config mode
     gpio_control_set_blue_led(true);
     
-    // Start AP mode
-    wifi_manager_start_ap();
-    
     // Start configuration server
     config_server_start();
 }
@@ -187,17 +330,94 @@ static void enter_execution_mode(void)
     // Turn off blue LED
     gpio_control_set_blue_led(false);
     
-    // Connect to WiFi
-    wifi_manager_connect_sta(g_device_config.wifi_ssid, g_device_config.wifi_password);
+    if (monitoring_active()) {
+        // Leaving AP+STA configuration, new settings were already applied in place
+        wifi_manager_stop_ap();
+    } else {
+        // Connect to WiFi
+        wifi_profile_t profiles[MAX_WIFI_PROFILES];
+        const device_config_t* config = config_store_acquire();
+        uint8_t profile_count = get_wifi_profiles(config, profiles);
+        config_store_release(config);
+        wifi_manager_connect_sta(profiles, profile_count);
+        
+        // Remote logging first, so the monitoring start-up is in the stream
+        start_syslog_sink();
+        
+        // Start MQTT publishing before the checker so the first state change is published
+        start_mqtt_publisher();
+        
+        // Start health checker, or wait for pushed heartbeats instead
+        start_monitoring();
+    }
     
-    // Start health checker
-    health_checker_start(g_device_config.health_check_url, g_device_config.check_interval_ms);
+    // Start execution mode API server
+    api_server_start();
+}
+
+static bool monitoring_active(void)
+{
+    return health_checker_is_running() || heartbeat_is_running();
+}
+
+static void start_monitoring(void)
+{
+    // Both copy what they need, the snapshot is only held while starting
+    const device_config_t* config = config_store_acquire();
+    if (config->monitor_mode == MONITOR_MODE_HEARTBEAT) {
+        heartbeat_start(config->heartbeat_port, config->heartbeat_token, config->heartbeat_timeout_ms);
+    } else {
+        health_checker_start(config->targets, config->target_count, config->check_interval_ms,
+                             config->schedule_mode);
+    }
+    config_store_release(config);
+}
+
+static void start_mqtt_publisher(void)
+{
+    const device_config_t* config = config_store_acquire();
+    if (strlen(config->mqtt_uri) > 0) {
+        mqtt_publisher_start(config->mqtt_uri, config->mqtt_topic);
+    }
+    config_store_release(config);
+}
+
+static void start_syslog_sink(void)
+{
+    const device_config_t* config = config_store_acquire();
+    if (strlen(config->syslog_server) > 0) {
+        syslog_sink_start(config->syslog_server);
+    }
+    config_store_release(config);
+}
+
+// Task for reconnecting after the response to the config request has been sent
+static void wifi_reconnect_task(void *pvParameters)
+{
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    wifi_profile_t profiles[MAX_WIFI_PROFILES];
+    const device_config_t* config = config_store_acquire();
+    uint8_t profile_count = get_wifi_profiles(config, profiles);
+    config_store_release(config);
+    wifi_manager_update_sta(profiles, profile_count);
+    vTaskDelete(NULL);
+}
+
+// The primary network followed by the backups, in priority order
+static uint8_t get_wifi_profiles(const device_config_t* config, wifi_profile_t* profiles)
+{
+    strcpy(profiles[0].ssid, config->wifi_ssid);
+    strcpy(profiles[0].password, config->wifi_password);
+    memcpy(&profiles[1], config->wifi_backups, sizeof(wifi_profile_t) * config->wifi_backup_count);
+    return 1 + config->wifi_backup_count;
 }
 
 // Global functions for other modules
 void save_device_config(void)
 {
-    save_config_to_nvs();
+    const device_config_t* config = config_store_acquire();
+    save_config_to_nvs(config);
+    config_store_release(config);
 }
 
 void switch_to_execution_mode(void)
@@ -205,7 +425,58 @@ void switch_to_execution_mode(void)
     enter_execution_mode();
 }
 
-device_config_t* get_device_config(void)
+uint32_t apply_device_config(const device_config_t* config)
+{
+    // What changed for the caller's response, the listener below works from the exact versions swapped
+    const device_config_t* current = config_store_acquire();
+    uint32_t changes = config_update_diff(current, config);
+    config_store_release(current);
+    
+    config_store_publish(config);
+    return changes;
+}
+
+// Runs on the publishing task for every new version
+static void config_published(const device_config_t* old_config, const device_config_t* new_config,
+                             uint32_t version, void* ctx)
 {
-    return &g_device_config;
+    uint32_t changes = config_update_diff(old_config, new_config);
+    save_config_to_nvs(new_config);
+    
+    // Nothing runs yet on the first configuration, entering execution mode starts it all
+    if (!monitoring_active() || changes == 0) {
+        return;
+    }
+    
+    ESP_LOGI(TAG, "Applying configuration version %u, changes: 0x%02x", version, changes);
+    
+    // Only a mode switch restarts monitoring, everything else is applied in place
+    if (changes & CONFIG_CHANGE_MODE) {
+        health_checker_stop();
+        heartbeat_stop();
+        start_monitoring();
+    } else if (new_config->monitor_mode == MONITOR_MODE_HEARTBEAT) {
+        if (changes & CONFIG_CHANGE_HEARTBEAT) {
+            heartbeat_reconfigure(new_config->heartbeat_port, new_config->heartbeat_token,
+                                  new_config->heartbeat_timeout_ms);
+        }
+    } else if (changes & CONFIG_CHANGE_CHECKS) {
+        health_checker_reconfigure(new_config->targets, new_config->target_count,
+                                   new_config->check_interval_ms, new_config->schedule_mode);
+    }
+    
+    if (changes & CONFIG_CHANGE_MQTT) {
+        mqtt_publisher_stop();
+        start_mqtt_publisher();
+    }
+    
+    if (changes & CONFIG_CHANGE_SYSLOG) {
+        syslog_sink_stop();
+        start_syslog_sink();
+    }
+    
+    // Wi-Fi is only touched when its own settings change
+    if (changes & CONFIG_CHANGE_WIFI) {
+        xTaskCreate(wifi_reconnect_task, "wifi_reconnect", 2048, NULL, 5, NULL);
+    }
 }
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "mqtt_client.h"
+#include "cJSON.h"
+#include "flash_data.h"
+#include "config.h"
+#include "mqtt_publisher.h"
+#include "log_ring.h"
+
+static const char *TAG = "MQTT_PUBLISHER";
+
+#define MQTT_TOPIC_BUFFER_LENGTH (MAX_MQTT_TOPIC_LENGTH + 16)
+#define MQTT_POLL_INTERVAL_MS 1000  // Wake-up period while data is pending
+
+// Message passed from the checker to the publisher task
+typedef enum {
+    MQTT_MSG_STATE,
+    MQTT_MSG_RESULT,
+} mqtt_msg_type_t;
+
+typedef struct {
+    uint8_t type;  // mqtt_msg_type_t
+    uint8_t target;
+    bool healthy;
+    uint8_t reason;
+    int16_t status_code;
+    uint32_t latency_ms;
+    uint32_t timestamp_ms;  // Uptime when the result was recorded
+} mqtt_msg_t;
+
+// Global variables
+static esp_mqtt_client_handle_t s_client = NULL;
+static QueueHandle_t s_queue = NULL;
+static SemaphoreHandle_t s_client_mutex = NULL;
+static volatile bool s_started = false;
+static volatile bool s_connected = false;
+static char s_status_topic[MQTT_TOPIC_BUFFER_LENGTH];
+static char s_state_topic[MQTT_TOPIC_BUFFER_LENGTH];
+static char s_results_topic[MQTT_TOPIC_BUFFER_LENGTH];
+static mqtt_msg_t s_batch[MQTT_BATCH_MAX_RESULTS];
+static int s_batch_count = 0;
+static TickType_t s_batch_started = 0;
+static TickType_t s_last_batch_sent = 0;
+static uint32_t s_dropped = 0;
+static bool s_have_state = false;
+static bool s_state_pending = false;
+static bool s_last_state = false;
+
+// Function prototypes
+static void mqtt_publisher_task(void *pvParameters);
+static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event);
+static void publish_state(void);
+static void publish_batch(void);
+static void batch_append(const mqtt_msg_t* msg);
+static uint32_t uptime_ms(void);
+
+void mqtt_publisher_start(const char* uri, const char* topic_prefix)
+{
+    if (s_started) {
+        mqtt_publisher_stop();
+    }
+    
+    // Topic prefix defaults to MQTT_TOPIC_PREFIX/<mac>
+    char prefix[MAX_MQTT_TOPIC_LENGTH];
+    if (topic_prefix != NULL && strlen(topic_prefix) > 0) {
+        strncpy(prefix, topic_prefix, sizeof(prefix) - 1);
+        prefix[sizeof(prefix) - 1] = '\0';
+    } else {
+        uint8_t mac[6];
+        esp_read_mac(mac, ESP_MAC_WIFI_STA);
+        snprintf(prefix, sizeof(prefix), "%s/%02x%02x%02x%02x%02x%02x", MQTT_TOPIC_PREFIX,
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+    snprintf(s_status_topic, sizeof(s_status_topic), "%s/status", prefix);
+    snprintf(s_state_topic, sizeof(s_state_topic), "%s/state", prefix);
+    snprintf(s_results_topic, sizeof(s_results_topic), "%s/results", prefix);
+    
+    ESP_LOGI(TAG, "Starting MQTT publisher");
+    ESP_LOGI(TAG, "Broker: %s", uri);
+    ESP_LOGI(TAG, "Topic prefix: %s", prefix);
+    
+    if (s_queue == NULL) {
+        s_queue = xQueueCreate(MQTT_QUEUE_LENGTH, sizeof(mqtt_msg_t));
+        s_client_mutex = xSemaphoreCreateMutex();
+        if (s_queue == NULL || s_client_mutex == NULL ||
+            xTaskCreate(mqtt_publisher_task, "mqtt_publisher", MQTT_TASK_STACK, NULL, 4, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create MQTT publisher task");
+            return;
+        }
+    }
+    
+    // Broker marks us offline (retained) if the connection drops without a clean disconnect
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .uri = uri,
+        .event_handle = mqtt_event_handler,
+        .lwt_topic = s_status_topic,
+        .lwt_msg = "offline",
+        .lwt_qos = 1,
+        .lwt_retain = 1,
+        .keepalive = 60,
+    };
+    
+    s_client = esp_mqtt_client_init(&mqtt_cfg);
+    if (s_client == NULL) {
+        ESP_LOGE(TAG, "Failed to initialize MQTT client");
+        return;
+    }
+    
+    // Connection and reconnection run on the MQTT client's own task
+    s_batch_count = 0;
+    s_started = true;
+    esp_mqtt_client_start(s_client);
+}
+
+void mqtt_publisher_stop(void)
+{
+    if (!s_started) {
+        return;
+    }
+    
+    ESP_LOGI(TAG, "Stopping MQTT publisher");
+    
+    // Wait for the publisher task to finish any publish in progress
+    xSemaphoreTake(s_client_mutex, portMAX_DELAY);
+    s_started = false;
+    if (s_connected) {
+        esp_mqtt_client_publish(s_client, s_status_topic, "offline", 0, 1, 1);
+    }
+    esp_mqtt_client_stop(s_client);
+    esp_mqtt_client_destroy(s_client);
+    s_client = NULL;
+    s_connected = false;
+    xSemaphoreGive(s_client_mutex);
+}
+
+bool mqtt_publisher_is_connected(void)
+{
+    return s_connected;
+}
+
+void mqtt_publisher_publish_state(bool healthy)
+{
+    if (!s_started) {
+        return;
+    }
+    
+    mqtt_msg_t msg = {
+        .type = MQTT_MSG_STATE,
+        .healthy = healthy,
+        .timestamp_ms = uptime_ms(),
+    };
+    // State transitions jump ahead of batched results
+    if (xQueueSendToFront(s_queue, &msg, 0) != pdTRUE) {
+        s_dropped++;
+    }
+}
+
+void mqtt_publisher_record_result(uint8_t target, const probe_result_t* result)
+{
+    if (!s_started) {
+        return;
+    }
+    
+    mqtt_msg_t msg = {
+        .type = MQTT_MSG_RESULT,
+        .target = target,
+        .healthy = result->healthy,
+        .reason = result->reason,
+        .status_code = (int16_t)result->status_code,
+        .latency_ms = result->latency_ms,
+        .timestamp_ms = uptime_ms(),
+    };
+    if (xQueueSend(s_queue, &msg, 0) != pdTRUE) {
+        s_dropped++;
+    }
+}
+
+static void mqtt_publisher_task(void *pvParameters)
+{
+    mqtt_msg_t msg;
+    
+    while (1) {
+        // Sleep until a message arrives, or poll while something is waiting to be sent
+        TickType_t wait = (s_batch_count > 0 || s_state_pending) ? pdMS_TO_TICKS(MQTT_POLL_INTERVAL_MS) : portMAX_DELAY;
+        
+        if (xQueueReceive(s_queue, &msg, wait) == pdTRUE) {
+            if (msg.type == MQTT_MSG_STATE) {
+                s_last_state = msg.healthy;
+                s_have_state = true;
+                s_state_pending = true;
+            } else {
+                batch_append(&msg);
+            }
+        }
+        
+        xSemaphoreTake(s_client_mutex, portMAX_DELAY);
+        if (s_started && s_connected) {
+            if (s_state_pending) {
+                publish_state();
+            }
+            
+            TickType_t now = xTaskGetTickCount();
+            bool batch_due = (s_batch_count >= MQTT_BATCH_MAX_RESULTS) ||
+                             (s_batch_count > 0 && (now - s_batch_started) >= pdMS_TO_TICKS(MQTT_BATCH_INTERVAL_MS));
+            bool rate_ok = (now - s_last_batch_sent) >= pdMS_TO_TICKS(MQTT_MIN_PUBLISH_INTERVAL_MS);
+            if (batch_due && rate_ok) {
+                publish_batch();
+                s_last_batch_sent = now;
+            }
+        }
+        xSemaphoreGive(s_client_mutex);
+    }
+}
+
+static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
+{
+    switch (event->event_id) {
+        case MQTT_EVENT_CONNECTED:
+            ESP_LOGI(TAG, "MQTT connected");
+            s_connected = true;
+            esp_mqtt_client_publish(event->client, s_status_topic, "online", 0, 1, 1);
+            // Refresh the retained state after every (re)connect
+            if (s_have_state) {
+                s_state_pending = true;
+            }
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            ESP_LOGW(TAG, "MQTT disconnected");
+            s_connected = false;
+            break;
+        case MQTT_EVENT_ERROR:
+            ESP_LOGD(TAG, "MQTT_EVENT_ERROR");
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+static void publish_state(void)
+{
+    char payload[96];
+    snprintf(payload, sizeof(payload), "{\"healthy\":%s,\"relay\":\"%s\",\"uptime_s\":%u}",
+             s_last_state ? "true" : "false", s_last_state ? "on" : "off", uptime_ms() / 1000);
+    
+    if (esp_mqtt_client_publish(s_client, s_state_topic, payload, 0, 1, 1) >= 0) {
+        s_state_pending = false;
+        ESP_LOGD(TAG, "Published state: %s", payload);
+    }
+}
+
+static void publish_batch(void)
+{
+    uint32_t now_ms = uptime_ms();
+    
+    cJSON *json = cJSON_CreateObject();
+    JSON_ADD_NUMBER(json, "uptime_s", now_ms / 1000);
+    JSON_ADD_NUMBER(json, "free_heap", esp_get_free_heap_size());
+    JSON_ADD_NUMBER(json, "dropped", s_dropped);
+    
+    cJSON *results = cJSON_CreateArray();
+    for (int i = 0; i < s_batch_count; i++) {
+        cJSON *item = cJSON_CreateObject();
+        JSON_ADD_NUMBER(item, "target", s_batch[i].target);
+        JSON_ADD_NUMBER(item, "age_ms", now_ms - s_batch[i].timestamp_ms);
+        JSON_ADD_BOOL(item, "healthy", s_batch[i].healthy);
+        JSON_ADD_NUMBER(item, "status_code", s_batch[i].status_code);
+        JSON_ADD_NUMBER(item, "latency_ms", s_batch[i].latency_ms);
+        if (!s_batch[i].healthy) {
+            JSON_ADD_STRING(item, "reason", probe_reason_name(s_batch[i].reason));
+        }
+        cJSON_AddItemToArray(results, item);
+    }
+    JSON_ADD_ITEM(json, "results", results);
+    
+    char *payload = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    if (payload == NULL) {
+        return;
+    }
+    
+    // QoS 0: results are periodic, a lost batch is superseded by the next one
+    if (esp_mqtt_client_publish(s_client, s_results_topic, payload, 0, 0, 0) >= 0) {
+        LOGR_D(LOG_MOD_MQTT, "Published %d results", s_batch_count);
+        s_batch_count = 0;
+    }
+    free(payload);
+}
+
+static void batch_append(const mqtt_msg_t* msg)
+{
+    // Keep the newest results while the broker is unreachable
+    if (s_batch_count >= MQTT_BATCH_MAX_RESULTS) {
+        memmove(&s_batch[0], &s_batch[1], sizeof(s_batch[0]) * (MQTT_BATCH_MAX_RESULTS - 1));
+        s_batch_count--;
+        s_dropped++;
+    }
+    if (s_batch_count == 0) {
+        s_batch_started = xTaskGetTickCount();
+    }
+    s_batch[s_batch_count++] = *msg;
+}
+
+static uint32_t uptime_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
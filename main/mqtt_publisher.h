@@ -0,0 +1,15 @@
+#ifndef MQTT_PUBLISHER_H
+#define MQTT_PUBLISHER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "probe.h"
+
+// Function prototypes
+void mqtt_publisher_start(const char* uri, const char* topic_prefix);
+void mqtt_publisher_stop(void);
+bool mqtt_publisher_is_connected(void);
+void mqtt_publisher_publish_state(bool healthy);  // Sent right away, never blocks
+void mqtt_publisher_record_result(uint8_t target, const probe_result_t* result);  // Batched, never blocks
+
+#endif // MQTT_PUBLISHER_H
@@ -0,0 +1,1314 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "lwip/tcpip.h"
+#include "config.h"
+#include "probe.h"
+#include "log_ring.h"
+#include "probe_pool.h"
+#include "buf_pool.h"
+#include "wifi_manager.h"
+
+static const char *TAG = "PROBE";
+
+#define UDP_DEFAULT_PAYLOAD "ping"
+#define HTTP_DEFAULT_PORT 80
+#define HTTPS_DEFAULT_PORT 443
+#define TIMEOUT_SLACK_MS 100  // A failure this close to the budget counts as a timeout
+
+// reader_line() failures
+#define LINE_TIMEOUT -1
+#define LINE_CLOSED -2    // Or reset
+#define LINE_TOO_LONG -3  // No CRLF in a full block
+
+// Buffered reads on one connection, pipelined responses arrive back to back
+typedef struct {
+    int sock;
+    char* buf;            // Pool block of PROBE_BUF_SIZE bytes
+    size_t len;           // Bytes buffered, buf is kept NUL terminated
+    size_t max_response;  // Headers and body of one response
+} http_reader_t;
+
+typedef enum {
+    READ_OK = 0,   // Response read, the path result is filled in
+    READ_CLOSED,   // The connection went away before any byte of this response
+    READ_FAILED,   // The path result has the reason, the connection is unusable
+} read_outcome_t;
+
+// Handshake progress seen by the SDK HTTP client
+typedef struct {
+    probe_result_t* result;
+    bool connected;
+    bool responded;
+    int64_t connected_us;
+    uint32_t body_len;  // Of the current request
+} http_context_t;
+
+// Lookup handed to the tcpip thread, whoever finishes last frees it
+typedef struct {
+    TaskHandle_t task;
+    bool done;        // Answer in, the probe frees it
+    bool abandoned;   // Probe gave up, the DNS callback frees it
+    bool found;
+    uint32_t ip;      // Network order
+    char host[MAX_HOST_LENGTH];
+} dns_lookup_t;
+
+// Function prototypes
+static void probe_http(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                       char* buf, probe_result_t* result);
+static void probe_http_client(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                              char* buf, probe_result_t* result);
+static void probe_http_paths(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                             char* buf, probe_result_t* result);
+static void probe_client_paths(esp_http_client_handle_t client, http_context_t* context,
+                               const health_target_config_t* target, int32_t timeout_ms, TickType_t deadline,
+                               char* buf, probe_result_t* result);
+static char* take_buffer(const probe_budget_t* budget, TickType_t deadline);
+static size_t max_response(const health_target_config_t* target);
+static bool send_path_requests(http_reader_t* reader, const health_target_config_t* target, const char* host,
+                               uint16_t port, uint8_t from, uint8_t to, uint8_t count);
+static read_outcome_t read_response(http_reader_t* reader, TickType_t first_byte_deadline, TickType_t deadline,
+                                    probe_path_result_t* path, bool* keep_alive, uint32_t* retry_after_ms);
+static int reader_fill(http_reader_t* reader, TickType_t deadline);
+static int reader_line(http_reader_t* reader, TickType_t deadline);
+static void reader_consume(http_reader_t* reader, size_t len);
+static bool skip_bytes(http_reader_t* reader, size_t len, TickType_t deadline);
+static bool skip_chunked(http_reader_t* reader, size_t max_body, TickType_t deadline, bool* too_large);
+static void skip_to_close(http_reader_t* reader, size_t max_body, TickType_t deadline, bool* too_large);
+static bool header_has_token(const char* value, const char* token);
+static void fail_paths(probe_result_t* result, uint8_t from, uint8_t to, uint8_t reason);
+static void merge_paths(probe_result_t* result);
+static uint16_t elapsed_ms_since(int64_t start_us);
+static void probe_tcp(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                      probe_result_t* result);
+static void probe_udp(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                      probe_result_t* result);
+static bool resolve_target(const health_target_config_t* target, uint16_t default_port, TickType_t deadline,
+                           struct sockaddr_in* addr, probe_result_t* result);
+static bool resolve_host(const char* host, TickType_t deadline, uint32_t* ip, bool* timed_out);
+static void dns_start(void* arg);
+static void dns_found(const char* name, const ip_addr_t* ipaddr, void* arg);
+static int open_connection(const struct sockaddr_in* addr, TickType_t deadline, probe_result_t* result);
+static void close_connection(int sock);
+static int wait_socket(int sock, bool for_write, TickType_t deadline);
+static TickType_t phase_deadline(uint32_t budget_ms, TickType_t deadline);
+static uint32_t resolve_phase(uint16_t configured_ms, uint32_t default_ms, uint32_t total_ms);
+static void classify_status(probe_result_t* result);
+static uint8_t status_reason(int status_code);
+static uint32_t parse_retry_after(const char* value);
+static int32_t remaining_ms(TickType_t deadline);
+static esp_err_t http_event_handler(esp_http_client_event_t *evt);
+
+void probe_budget_resolve(const health_target_config_t* target, uint32_t interval_ms, probe_budget_t* budget)
+{
+    budget->total_ms = target->timeout_ms > 0 ? target->timeout_ms : HEALTH_CHECK_TIMEOUT_MS;
+    
+    // A probe that outlives the interval would overlap the next check of the same target
+    uint32_t max_total_ms = interval_ms / 100 * PROBE_BUDGET_PERCENT;
+    if (max_total_ms > 0 && budget->total_ms > max_total_ms) {
+        budget->total_ms = max_total_ms;
+    }
+    
+    budget->connect_ms = resolve_phase(target->connect_timeout_ms, PROBE_CONNECT_TIMEOUT_MS, budget->total_ms);
+    budget->tls_ms = resolve_phase(target->tls_timeout_ms, PROBE_TLS_TIMEOUT_MS, budget->total_ms);
+    budget->first_byte_ms = resolve_phase(target->first_byte_timeout_ms, PROBE_FIRST_BYTE_TIMEOUT_MS, budget->total_ms);
+}
+
+void probe_run(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+               probe_result_t* result)
+{
+    memset(result, 0, sizeof(*result));
+    result->err = ESP_FAIL;
+    
+    // Double check WiFi connection before proceeding
+    if (!wifi_manager_is_connected()) {
+        LOGR_W(LOG_MOD_PROBE, "WiFi disconnected before probe, aborting");
+        result->reason = PROBE_REASON_NO_NETWORK;
+        result->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    
+    if (remaining_ms(deadline) <= 0) {
+        result->reason = PROBE_REASON_TIMEOUT;
+        result->err = ESP_ERR_TIMEOUT;
+        return;
+    }
+    
+    // HTTP probes, plain or https, hold a pool block throughout. Waiting for it is not latency
+    char* buf = NULL;
+    if (target->type != PROBE_TYPE_TCP && target->type != PROBE_TYPE_UDP) {
+        buf = take_buffer(budget, deadline);
+        if (buf == NULL) {
+            LOGR_W(LOG_MOD_PROBE, "No probe buffer free, giving up");
+            result->reason = PROBE_REASON_NO_RESOURCES;
+            result->err = ESP_ERR_NO_MEM;
+            return;
+        }
+    }
+    
+    int64_t start_us = esp_timer_get_time();
+    
+    switch (target->type) {
+        case PROBE_TYPE_TCP:
+            probe_tcp(target, budget, deadline, result);
+            break;
+        case PROBE_TYPE_UDP:
+            probe_udp(target, budget, deadline, result);
+            break;
+        case PROBE_TYPE_HTTP:
+        default:
+            // The SDK client bounds every phase with one timeout, plain HTTP can do better
+            if (strncmp(target->url, "https://", 8) == 0) {
+                probe_http_client(target, budget, deadline, buf, result);
+            } else if (probe_path_count(target) > 1) {
+                probe_http_paths(target, budget, deadline, buf, result);
+            } else {
+                probe_http(target, budget, deadline, buf, result);
+            }
+            break;
+    }
+    buf_pool_give(buf);
+    
+    result->latency_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    if (result->healthy) {
+        result->reason = PROBE_REASON_OK;
+        result->err = ESP_OK;
+    }
+}
+
+bool probe_parse_address(const char* url, char* host, size_t host_size, uint16_t* port)
+{
+    // [scheme://][user@]host[:port][/path] -> host, port (0 if absent)
+    const char* start = strstr(url, "://");
+    start = (start != NULL) ? start + 3 : url;
+    const char* at = strchr(start, '@');
+    const char* slash = strchr(start, '/');
+    if (at != NULL && (slash == NULL || at < slash)) {
+        start = at + 1;
+    }
+    
+    size_t len = strcspn(start, ":/?#");
+    if (len == 0 || len >= host_size) {
+        return false;
+    }
+    memcpy(host, start, len);
+    host[len] = '\0';
+    
+    *port = 0;
+    if (start[len] == ':') {
+        char* end = NULL;
+        long value = strtol(start + len + 1, &end, 10);
+        if (end == start + len + 1 || value <= 0 || value > 65535) {
+            return false;
+        }
+        *port = (uint16_t)value;
+    }
+    
+    return true;
+}
+
+const char* probe_url_path(const char* url)
+{
+    const char* start = strstr(url, "://");
+    start = (start != NULL) ? start + 3 : url;
+    const char* path = strchr(start, '/');
+    return path != NULL ? path : "/";
+}
+
+uint8_t probe_path_count(const health_target_config_t* target)
+{
+    uint8_t count = 1;
+    if (target->type == PROBE_TYPE_HTTP) {
+        while (count <= MAX_TARGET_PATHS && target->paths[count - 1][0] != '\0') {
+            count++;
+        }
+    }
+    return count;
+}
+
+const char* probe_path(const health_target_config_t* target, uint8_t index)
+{
+    return index == 0 ? probe_url_path(target->url) : target->paths[index - 1];
+}
+
+probe_type_t probe_type_from_url(const char* url)
+{
+    if (strncmp(url, "tcp://", 6) == 0) {
+        return PROBE_TYPE_TCP;
+    }
+    if (strncmp(url, "udp://", 6) == 0) {
+        return PROBE_TYPE_UDP;
+    }
+    return PROBE_TYPE_HTTP;
+}
+
+const char* probe_type_name(probe_type_t type)
+{
+    switch (type) {
+        case PROBE_TYPE_TCP:
+            return "tcp";
+        case PROBE_TYPE_UDP:
+            return "udp";
+        case PROBE_TYPE_HTTP:
+        default:
+            return "http";
+    }
+}
+
+const char* probe_reason_name(probe_reason_t reason)
+{
+    switch (reason) {
+        case PROBE_REASON_OK:
+            return "ok";
+        case PROBE_REASON_NO_NETWORK:
+            return "no_network";
+        case PROBE_REASON_BAD_CONFIG:
+            return "bad_config";
+        case PROBE_REASON_DNS:
+            return "dns";
+        case PROBE_REASON_CONNECT:
+            return "connect";
+        case PROBE_REASON_TIMEOUT:
+            return "timeout";
+        case PROBE_REASON_HTTP_STATUS:
+            return "http_status";
+        case PROBE_REASON_BAD_RESPONSE:
+            return "bad_response";
+        case PROBE_REASON_NO_RESOURCES:
+            return "no_resources";
+        case PROBE_REASON_THROTTLED:
+            return "throttled";
+        case PROBE_REASON_CONNECT_TIMEOUT:
+            return "connect_timeout";
+        case PROBE_REASON_TLS_TIMEOUT:
+            return "tls_timeout";
+        case PROBE_REASON_FIRST_BYTE_TIMEOUT:
+            return "first_byte_timeout";
+        case PROBE_REASON_WATCHDOG:
+            return "watchdog";
+        case PROBE_REASON_SLOW:
+            return "slow";
+        case PROBE_REASON_TOO_LARGE:
+            return "too_large";
+        default:
+            return "unknown";
+    }
+}
+
+static void probe_http(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                       char* buf, probe_result_t* result)
+{
+    char host[MAX_HOST_LENGTH];
+    uint16_t port = 0;
+    struct sockaddr_in addr;
+    TickType_t connect_deadline = phase_deadline(budget->connect_ms, deadline);
+    if (!probe_parse_address(target->url, host, sizeof(host), &port) ||
+        !resolve_target(target, HTTP_DEFAULT_PORT, connect_deadline, &addr, result)) {
+        if (result->reason == PROBE_REASON_OK) {
+            result->reason = PROBE_REASON_BAD_CONFIG;
+        }
+        return;
+    }
+    
+    int sock = open_connection(&addr, connect_deadline, result);
+    if (sock < 0) {
+        return;
+    }
+    
+    // One block for the request, then for the reader that goes through the response
+    char* buffer = buf;
+    char port_suffix[7] = "";
+    if (port != 0 && port != HTTP_DEFAULT_PORT) {
+        snprintf(port_suffix, sizeof(port_suffix), ":%u", port);
+    }
+    int len = snprintf(buffer, PROBE_BUF_SIZE,
+                       "GET %s HTTP/1.1\r\nHost: %s%s\r\nUser-Agent: health-check-monitor\r\nConnection: close\r\n\r\n",
+                       probe_url_path(target->url), host, port_suffix);
+    if (len < 0 || len >= PROBE_BUF_SIZE) {
+        ESP_LOGE(TAG, "URL too long for request buffer: %s", target->url);
+        result->reason = PROBE_REASON_BAD_CONFIG;
+        close_connection(sock);
+        return;
+    }
+    if (send(sock, buffer, len, 0) != len) {
+        LOGR_W(LOG_MOD_PROBE, "HTTP request send failed: errno %d", errno);
+        result->reason = PROBE_REASON_CONNECT;
+        close_connection(sock);
+        return;
+    }
+    
+    // Same reader as the pipelined paths, so headers and body are held to max_response the same way
+    http_reader_t reader = {
+        .sock = sock,
+        .buf = buffer,
+        .len = 0,
+        .max_response = max_response(target),
+    };
+    buffer[0] = '\0';
+    probe_path_result_t response = { 0 };
+    bool keep_alive;
+    read_outcome_t outcome = read_response(&reader, phase_deadline(budget->first_byte_ms, deadline), deadline,
+                                           &response, &keep_alive, &result->retry_after_ms);
+    close_connection(sock);
+    
+    if (outcome != READ_OK) {
+        result->reason = (outcome == READ_CLOSED) ? PROBE_REASON_CONNECT : response.reason;
+        result->status_code = response.status_code;
+        result->err = (result->reason == PROBE_REASON_TIMEOUT ||
+                       result->reason == PROBE_REASON_FIRST_BYTE_TIMEOUT) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+        return;
+    }
+    result->status_code = response.status_code;
+    
+    // Redirects are left to the SDK client, which follows them within what is left of the budget
+    if (result->status_code >= 300 && result->status_code < 400) {
+        LOGR_D(LOG_MOD_PROBE, "Redirected with status %d, following", result->status_code);
+        result->status_code = 0;
+        result->retry_after_ms = 0;
+        probe_http_client(target, budget, deadline, buf, result);
+        return;
+    }
+    
+    result->err = ESP_OK;
+    classify_status(result);
+}
+
+static void probe_http_paths(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                             char* buf, probe_result_t* result)
+{
+    char host[MAX_HOST_LENGTH];
+    uint16_t port = 0;
+    struct sockaddr_in addr;
+    // The lookup is part of the first connection's phase, later connections get a fresh one
+    TickType_t connect_deadline = phase_deadline(budget->connect_ms, deadline);
+    if (!probe_parse_address(target->url, host, sizeof(host), &port) ||
+        !resolve_target(target, HTTP_DEFAULT_PORT, connect_deadline, &addr, result)) {
+        if (result->reason == PROBE_REASON_OK) {
+            result->reason = PROBE_REASON_BAD_CONFIG;
+        }
+        return;
+    }
+    
+    uint8_t count = probe_path_count(target);
+    result->path_count = count;
+    
+    http_reader_t reader = {
+        .sock = -1,
+        .buf = buf,
+        .max_response = max_response(target),
+    };
+    bool persistent = false;  // The server kept the connection open after a response
+    bool pipeline = true;     // Cleared once the server dropped pipelined requests
+    uint8_t served = 0;       // Responses read on the current connection
+    uint8_t next = 0;         // First path without a result
+    
+    while (next < count) {
+        if (remaining_ms(deadline) <= 0) {
+            fail_paths(result, next, count, PROBE_REASON_TIMEOUT);
+            break;
+        }
+        if (reader.sock < 0) {
+            if (next > 0) {
+                connect_deadline = phase_deadline(budget->connect_ms, deadline);
+            }
+            reader.sock = open_connection(&addr, connect_deadline, result);
+            if (reader.sock < 0) {
+                fail_paths(result, next, count, result->reason);
+                break;
+            }
+            reader.len = 0;
+            reader.buf[0] = '\0';
+            served = 0;
+        }
+        
+        // The first request goes alone, its response tells whether the connection can be kept.
+        // The rest are pipelined on it, or sent one at a time once pipelining failed
+        uint8_t batch_end = (persistent && pipeline) ? count : next + 1;
+        if (batch_end - next > 1) {
+            result->pipelined = true;
+        }
+        int64_t sent_us = esp_timer_get_time();
+        read_outcome_t outcome = send_path_requests(&reader, target, host, port, next, batch_end, count) ?
+                                 READ_OK : READ_CLOSED;
+        
+        uint8_t i = next;
+        bool keep_alive = false;
+        while (outcome == READ_OK && i < batch_end) {
+            outcome = read_response(&reader, phase_deadline(budget->first_byte_ms, deadline), deadline,
+                                    &result->paths[i], &keep_alive, &result->retry_after_ms);
+            if (outcome != READ_OK) {
+                break;
+            }
+            result->paths[i].latency_ms = elapsed_ms_since(sent_us);
+            i++;
+            served++;
+            if (!keep_alive) {
+                break;
+            }
+        }
+        
+        if (outcome == READ_OK && keep_alive) {
+            persistent = true;
+            next = i;
+            continue;
+        }
+        
+        // Anything else ends this connection, unanswered paths are retried on a new one
+        close_connection(reader.sock);
+        reader.sock = -1;
+        
+        if (outcome == READ_OK) {
+            persistent = false;
+        } else if (outcome == READ_FAILED) {
+            uint8_t reason = result->paths[i].reason;
+            i++;
+            // A timeout has used up the budget of the paths behind it too
+            if (reason == PROBE_REASON_TIMEOUT || reason == PROBE_REASON_FIRST_BYTE_TIMEOUT) {
+                fail_paths(result, i, count, PROBE_REASON_TIMEOUT);
+                i = count;
+            }
+        } else if (served == 0) {
+            // Closed on a fresh connection, this path does not get another one
+            fail_paths(result, i, i + 1, PROBE_REASON_CONNECT);
+            i++;
+        } else if (batch_end - next > 1) {
+            LOGR_D(LOG_MOD_PROBE, "Pipelined requests dropped after %d responses, going sequential", served);
+            pipeline = false;
+            result->pipelined = false;
+        }
+        next = i;
+    }
+    
+    if (reader.sock >= 0) {
+        close_connection(reader.sock);
+    }
+    merge_paths(result);
+}
+
+static void probe_http_client(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                              char* buf, probe_result_t* result)
+{
+    // The client resolves with a blocking getaddrinfo(), a bounded lookup first leaves the answer
+    // in the lwIP cache where it finds it at once
+    struct sockaddr_in addr;
+    if (!resolve_target(target, HTTPS_DEFAULT_PORT, phase_deadline(budget->connect_ms, deadline), &addr, result)) {
+        return;
+    }
+    
+    // The SDK client applies one timeout to the handshake and to every read, so the phases
+    // share the largest of their budgets and are told apart afterwards by how far they got
+    int32_t timeout_ms = budget->connect_ms + budget->tls_ms;
+    if (timeout_ms < (int32_t)budget->first_byte_ms) {
+        timeout_ms = budget->first_byte_ms;
+    }
+    int32_t left_ms = remaining_ms(deadline);
+    if (left_ms <= 0) {
+        result->reason = PROBE_REASON_TIMEOUT;
+        result->err = ESP_ERR_TIMEOUT;
+        return;
+    }
+    if (timeout_ms > left_ms) {
+        timeout_ms = left_ms;  // Never outlive the job deadline
+    }
+    
+    http_context_t context = {
+        .result = result,
+    };
+    esp_http_client_config_t config = {
+        .url = target->url,
+        .event_handler = http_event_handler,
+        .user_data = &context,
+        .timeout_ms = timeout_ms,
+        .buffer_size = PROBE_CLIENT_BUFFER_SIZE,
+        .method = HTTP_METHOD_GET,
+        .skip_cert_common_name_check = true,  // Skip certificate verification for HTTPS
+        .cert_pem = NULL,
+        .client_cert_pem = NULL,
+        .client_key_pem = NULL,
+    };
+    
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to initialize HTTP client");
+        result->reason = PROBE_REASON_NO_RESOURCES;
+        result->err = ESP_ERR_NO_MEM;
+        return;
+    }
+    
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = esp_http_client_perform(client);
+    int64_t end_us = esp_timer_get_time();
+    result->err = err;
+    
+    if (err == ESP_OK) {
+        result->status_code = esp_http_client_get_status_code(client);
+        classify_status(result);
+        // The client has already read the whole body, the cap only decides the verdict
+        if (context.body_len > max_response(target)) {
+            LOGR_W(LOG_MOD_PROBE, "Response body of %u bytes over the cap", context.body_len);
+            result->healthy = false;
+            result->reason = PROBE_REASON_TOO_LARGE;
+        }
+    } else if (!context.connected) {
+        // Connect and TLS are a single step for the client, past the connect budget it is the TLS side
+        uint32_t elapsed_ms = (uint32_t)((end_us - start_us) / 1000);
+        if (elapsed_ms + TIMEOUT_SLACK_MS < (uint32_t)timeout_ms) {
+            result->reason = PROBE_REASON_CONNECT;
+        } else if (strncmp(target->url, "https://", 8) == 0 && elapsed_ms > budget->connect_ms) {
+            result->reason = PROBE_REASON_TLS_TIMEOUT;
+        } else {
+            result->reason = PROBE_REASON_CONNECT_TIMEOUT;
+        }
+        LOGR_E(LOG_MOD_PROBE, "HTTP connect failed: %s", probe_reason_name(result->reason));
+    } else if (!context.responded) {
+        uint32_t waited_ms = (uint32_t)((end_us - context.connected_us) / 1000);
+        result->reason = (waited_ms + TIMEOUT_SLACK_MS < (uint32_t)timeout_ms) ?
+                         PROBE_REASON_CONNECT : PROBE_REASON_FIRST_BYTE_TIMEOUT;
+        LOGR_E(LOG_MOD_PROBE, "HTTP request failed: %s", probe_reason_name(result->reason));
+    } else {
+        LOGR_E(LOG_MOD_PROBE, "HTTP request failed: %s", esp_err_to_name(err));
+        result->reason = PROBE_REASON_TIMEOUT;
+    }
+    
+    // Further paths reuse the client, and its connection while the server keeps it open
+    if (target->type == PROBE_TYPE_HTTP && probe_path_count(target) > 1) {
+        result->paths[0].healthy = result->healthy;
+        result->paths[0].reason = result->healthy ? PROBE_REASON_OK : result->reason;
+        result->paths[0].status_code = result->status_code;
+        result->paths[0].latency_ms = elapsed_ms_since(start_us);
+        probe_client_paths(client, &context, target, context.connected ? timeout_ms : 0, deadline, buf, result);
+    }
+    
+    esp_http_client_cleanup(client);
+}
+
+static void probe_client_paths(esp_http_client_handle_t client, http_context_t* context,
+                               const health_target_config_t* target, int32_t timeout_ms, TickType_t deadline,
+                               char* buf, probe_result_t* result)
+{
+    // paths[0] is filled in, timeout_ms is 0 when the first request never got a connection
+    uint8_t count = probe_path_count(target);
+    result->path_count = count;
+    if (timeout_ms == 0) {
+        fail_paths(result, 1, count, result->paths[0].reason);
+        merge_paths(result);
+        return;
+    }
+    
+    // The pool block is free once the first request is done, the URLs are built in it
+    char* url = buf;
+    int origin_len = probe_url_path(target->url) - target->url;
+    for (uint8_t i = 1; i < count; i++) {
+        // The client timeout cannot be shortened, a path that might overrun the deadline is not started
+        if (remaining_ms(deadline) < timeout_ms) {
+            fail_paths(result, i, count, PROBE_REASON_TIMEOUT);
+            break;
+        }
+        snprintf(url, PROBE_BUF_SIZE, "%.*s%s", origin_len, target->url, target->paths[i - 1]);
+        esp_http_client_set_url(client, url);
+        
+        probe_path_result_t* path = &result->paths[i];
+        context->body_len = 0;
+        int64_t start_us = esp_timer_get_time();
+        esp_err_t err = esp_http_client_perform(client);
+        path->latency_ms = elapsed_ms_since(start_us);
+        if (err == ESP_OK) {
+            path->status_code = esp_http_client_get_status_code(client);
+            path->reason = status_reason(path->status_code);
+            if (context->body_len > max_response(target)) {
+                path->reason = PROBE_REASON_TOO_LARGE;
+            }
+            path->healthy = (path->reason == PROBE_REASON_OK);
+        } else {
+            path->reason = (path->latency_ms + TIMEOUT_SLACK_MS < timeout_ms) ?
+                           PROBE_REASON_CONNECT : PROBE_REASON_TIMEOUT;
+        }
+    }
+    merge_paths(result);
+}
+
+static void probe_tcp(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                      probe_result_t* result)
+{
+    struct sockaddr_in addr;
+    TickType_t connect_deadline = phase_deadline(budget->connect_ms, deadline);
+    if (!resolve_target(target, 0, connect_deadline, &addr, result)) {
+        return;
+    }
+    
+    int sock = open_connection(&addr, connect_deadline, result);
+    if (sock >= 0) {
+        result->healthy = true;
+        close_connection(sock);
+    }
+}
+
+static void probe_udp(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+                      probe_result_t* result)
+{
+    // No handshake, the connect budget only bounds the lookup
+    struct sockaddr_in addr;
+    if (!resolve_target(target, 0, phase_deadline(budget->connect_ms, deadline), &addr, result)) {
+        return;
+    }
+    
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        result->reason = PROBE_REASON_NO_RESOURCES;
+        return;
+    }
+    probe_pool_set_socket(sock);
+    
+    // Connected UDP so ICMP port unreachable surfaces as an error on recv
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        result->reason = PROBE_REASON_CONNECT;
+        close_connection(sock);
+        return;
+    }
+    
+    const char* payload = strlen(target->payload) > 0 ? target->payload : UDP_DEFAULT_PAYLOAD;
+    if (send(sock, payload, strlen(payload), 0) < 0) {
+        result->reason = PROBE_REASON_CONNECT;
+        close_connection(sock);
+        return;
+    }
+    
+    int32_t wait_ms = remaining_ms(deadline);
+    if (wait_ms <= 0) {
+        wait_ms = 1;
+    }
+    struct timeval tv = {
+        .tv_sec = wait_ms / 1000,
+        .tv_usec = (wait_ms % 1000) * 1000,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    
+    char reply[MAX_PROBE_PAYLOAD_LENGTH];
+    int len = recv(sock, reply, sizeof(reply), 0);
+    if (len >= 0) {
+        size_t expect_len = strlen(target->expect);
+        if (expect_len == 0 || ((size_t)len >= expect_len && memcmp(reply, target->expect, expect_len) == 0)) {
+            result->healthy = true;
+        } else {
+            result->reason = PROBE_REASON_BAD_RESPONSE;
+        }
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        result->reason = PROBE_REASON_TIMEOUT;
+        result->err = ESP_ERR_TIMEOUT;
+    } else {
+        result->reason = PROBE_REASON_CONNECT;
+    }
+    
+    close_connection(sock);
+}
+
+static bool resolve_target(const health_target_config_t* target, uint16_t default_port, TickType_t deadline,
+                           struct sockaddr_in* addr, probe_result_t* result)
+{
+    char host[MAX_HOST_LENGTH];
+    uint16_t port = 0;
+    if (!probe_parse_address(target->url, host, sizeof(host), &port) || (port == 0 && default_port == 0)) {
+        ESP_LOGE(TAG, "Target needs host:port: %s", target->url);
+        result->reason = PROBE_REASON_BAD_CONFIG;
+        return false;
+    }
+    
+    uint32_t ip = 0;
+    bool timed_out = false;
+    if (!resolve_host(host, deadline, &ip, &timed_out)) {
+        if (timed_out) {
+            // The lookup spends the connect budget, so running out of it is a connect timeout
+            ESP_LOGW(TAG, "DNS lookup for %s timed out", host);
+            result->reason = PROBE_REASON_CONNECT_TIMEOUT;
+            result->err = ESP_ERR_TIMEOUT;
+        } else {
+            ESP_LOGW(TAG, "DNS lookup failed for %s", host);
+            result->reason = PROBE_REASON_DNS;
+        }
+        return false;
+    }
+    
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = ip;
+    addr->sin_port = htons(port != 0 ? port : default_port);
+    
+    return true;
+}
+
+static bool resolve_host(const char* host, TickType_t deadline, uint32_t* ip, bool* timed_out)
+{
+    // getaddrinfo() blocks through every lwIP retry, well past any probe budget. The lookup runs
+    // on the tcpip thread instead and is simply left behind when the deadline comes first
+    dns_lookup_t* lookup = calloc(1, sizeof(dns_lookup_t));
+    if (lookup == NULL) {
+        return false;
+    }
+    lookup->task = xTaskGetCurrentTaskHandle();
+    strncpy(lookup->host, host, sizeof(lookup->host) - 1);
+    
+    if (tcpip_callback(dns_start, lookup) != ERR_OK) {
+        free(lookup);
+        return false;
+    }
+    
+    while (1) {
+        taskENTER_CRITICAL();
+        bool done = lookup->done;
+        if (!done && remaining_ms(deadline) <= 0) {
+            lookup->abandoned = true;
+        }
+        bool abandoned = lookup->abandoned;
+        taskEXIT_CRITICAL();
+        
+        if (done) {
+            break;
+        }
+        if (abandoned) {
+            *timed_out = true;
+            return false;
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(remaining_ms(deadline)) + 1);
+    }
+    
+    bool found = lookup->found;
+    *ip = lookup->ip;
+    free(lookup);
+    return found;
+}
+
+static void dns_start(void* arg)
+{
+    dns_lookup_t* lookup = (dns_lookup_t*)arg;
+    ip_addr_t ipaddr;
+    
+    // Cached names and literal addresses are answered right away
+    err_t err = dns_gethostbyname(lookup->host, &ipaddr, dns_found, lookup);
+    if (err != ERR_INPROGRESS) {
+        dns_found(lookup->host, err == ERR_OK ? &ipaddr : NULL, lookup);
+    }
+}
+
+static void dns_found(const char* name, const ip_addr_t* ipaddr, void* arg)
+{
+    dns_lookup_t* lookup = (dns_lookup_t*)arg;
+    
+    // Read under the lock, once done is set the probe may free the lookup at any time
+    taskENTER_CRITICAL();
+    bool abandoned = lookup->abandoned;
+    TaskHandle_t task = lookup->task;
+    if (!abandoned) {
+        lookup->found = ipaddr != NULL && IP_IS_V4(ipaddr);
+        if (lookup->found) {
+            lookup->ip = ip4_addr_get_u32(ip_2_ip4(ipaddr));
+        }
+        lookup->done = true;
+    }
+    taskEXIT_CRITICAL();
+    
+    if (abandoned) {
+        free(lookup);
+    } else {
+        xTaskNotifyGive(task);
+    }
+}
+
+static int open_connection(const struct sockaddr_in* addr, TickType_t deadline, probe_result_t* result)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        result->reason = PROBE_REASON_NO_RESOURCES;
+        return -1;
+    }
+    probe_pool_set_socket(sock);
+    
+    // Non-blocking connect so the handshake is bounded by its phase budget
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    int sock_err = 0;
+    if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        sock_err = errno;
+    }
+    if (sock_err == EINPROGRESS) {
+        int ret = wait_socket(sock, true, deadline);
+        if (ret == 0) {
+            result->reason = PROBE_REASON_CONNECT_TIMEOUT;
+            result->err = ESP_ERR_TIMEOUT;
+            close_connection(sock);
+            return -1;
+        }
+        sock_err = errno;  // Also set when the watchdog shut the socket down
+        if (ret > 0) {
+            socklen_t len = sizeof(sock_err);
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &sock_err, &len);
+        }
+    }
+    if (sock_err != 0) {
+        LOGR_W(LOG_MOD_PROBE, "TCP connect failed: errno %d", sock_err);
+        result->reason = PROBE_REASON_CONNECT;
+        close_connection(sock);
+        return -1;
+    }
+    
+    return sock;
+}
+
+static void close_connection(int sock)
+{
+    // Unregister first so the watchdog never shuts down a recycled descriptor
+    probe_pool_set_socket(-1);
+    close(sock);
+}
+
+static int wait_socket(int sock, bool for_write, TickType_t deadline)
+{
+    int32_t wait_ms = remaining_ms(deadline);
+    if (wait_ms <= 0) {
+        return 0;
+    }
+    
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    struct timeval tv = {
+        .tv_sec = wait_ms / 1000,
+        .tv_usec = (wait_ms % 1000) * 1000,
+    };
+    return select(sock + 1, for_write ? NULL : &fds, for_write ? &fds : NULL, NULL, &tv);
+}
+
+static TickType_t phase_deadline(uint32_t budget_ms, TickType_t deadline)
+{
+    // A phase never runs past the deadline of the whole probe
+    TickType_t phase_end = xTaskGetTickCount() + pdMS_TO_TICKS(budget_ms);
+    return (int32_t)(phase_end - deadline) < 0 ? phase_end : deadline;
+}
+
+static char* take_buffer(const probe_budget_t* budget, TickType_t deadline)
+{
+    // Waiting must not eat into more than the connect budget
+    int32_t wait_ms = remaining_ms(phase_deadline(budget->connect_ms, deadline));
+    if (wait_ms > PROBE_BUF_WAIT_MS) {
+        wait_ms = PROBE_BUF_WAIT_MS;
+    }
+    return buf_pool_take(wait_ms > 0 ? pdMS_TO_TICKS(wait_ms) : 0);
+}
+
+static size_t max_response(const health_target_config_t* target)
+{
+    return target->max_response > 0 ? target->max_response : PROBE_MAX_RESPONSE;
+}
+
+static uint32_t resolve_phase(uint16_t configured_ms, uint32_t default_ms, uint32_t total_ms)
+{
+    uint32_t phase_ms = configured_ms > 0 ? configured_ms : default_ms;
+    return phase_ms < total_ms ? phase_ms : total_ms;
+}
+
+static void classify_status(probe_result_t* result)
+{
+    result->reason = status_reason(result->status_code);
+    result->healthy = (result->reason == PROBE_REASON_OK);
+    if (result->reason == PROBE_REASON_HTTP_STATUS) {
+        LOGR_W(LOG_MOD_PROBE, "Health check failed with status: %d", result->status_code);
+    }
+}
+
+static uint8_t status_reason(int status_code)
+{
+    if (status_code == 200) {
+        return PROBE_REASON_OK;
+    }
+    return status_code == 429 ? PROBE_REASON_THROTTLED : PROBE_REASON_HTTP_STATUS;
+}
+
+static uint32_t parse_retry_after(const char* value)
+{
+    // Only the delay-seconds form, an HTTP-date falls back to the default back-off
+    long seconds = strtol(value, NULL, 10);
+    if (seconds <= 0) {
+        return 0;
+    }
+    return seconds >= BACKOFF_MAX_MS / 1000 ? BACKOFF_MAX_MS : (uint32_t)seconds * 1000;
+}
+
+static bool send_path_requests(http_reader_t* reader, const health_target_config_t* target, const char* host,
+                               uint16_t port, uint8_t from, uint8_t to, uint8_t count)
+{
+    // Requests of a batch go out in as few segments as fit the free tail of the reader's block
+    int sock = reader->sock;
+    char* buffer = reader->buf + reader->len + 1;
+    size_t buffer_size = PROBE_BUF_SIZE - reader->len - 1;
+    char port_suffix[7] = "";
+    if (port != 0 && port != HTTP_DEFAULT_PORT) {
+        snprintf(port_suffix, sizeof(port_suffix), ":%u", port);
+    }
+    
+    int len = 0;
+    for (uint8_t i = from; i < to; i++) {
+        // The last request of the probe lets the server close, earlier ones keep the connection
+        const char* connection = (i == count - 1) ? "Connection: close\r\n" : "";
+        int n = snprintf(buffer + len, buffer_size - len,
+                         "GET %s HTTP/1.1\r\nHost: %s%s\r\nUser-Agent: health-check-monitor\r\n%s\r\n",
+                         probe_path(target, i), host, port_suffix, connection);
+        if (n >= (int)buffer_size - len && len > 0) {
+            if (send(sock, buffer, len, 0) != len) {
+                return false;
+            }
+            len = 0;
+            i--;
+            continue;
+        }
+        if (n < 0 || n >= (int)buffer_size - len) {
+            ESP_LOGE(TAG, "Path too long for request buffer: %s", probe_path(target, i));
+            return false;
+        }
+        len += n;
+    }
+    
+    if (send(sock, buffer, len, 0) != len) {
+        LOGR_W(LOG_MOD_PROBE, "HTTP request send failed: errno %d", errno);
+        return false;
+    }
+    return true;
+}
+
+static read_outcome_t read_response(http_reader_t* reader, TickType_t first_byte_deadline, TickType_t deadline,
+                                    probe_path_result_t* path, bool* keep_alive, uint32_t* retry_after_ms)
+{
+    *keep_alive = false;
+    
+    // A pipelined response may already be buffered
+    if (reader->len == 0) {
+        int n = reader_fill(reader, first_byte_deadline);
+        if (n == 0) {
+            return READ_CLOSED;
+        }
+        if (n < 0) {
+            path->reason = PROBE_REASON_FIRST_BYTE_TIMEOUT;
+            return READ_FAILED;
+        }
+    }
+    
+    // Status line and headers one line at a time, so large cookies or security headers only cost
+    // the block they pass through. HTTP/1.1 keeps the connection unless told otherwise, 1.0 only when asked to
+    int major = 0;
+    int minor = 0;
+    int status_code = 0;
+    bool persistent = false;
+    bool chunked = false;
+    long content_length = -1;
+    size_t header_len = 0;
+    bool skipping = false;  // In the tail of a line longer than the block
+    bool headers_done = false;
+    while (!headers_done) {
+        int line_len = reader_line(reader, deadline);
+        if (line_len == LINE_TOO_LONG && status_code != 0) {
+            // None of the headers we read gets this long, keep the last byte in case it is the CR
+            header_len += reader->len - 1;
+            reader_consume(reader, reader->len - 1);
+            skipping = true;
+        } else if (line_len < 0) {
+            path->reason = line_len == LINE_TIMEOUT ? PROBE_REASON_TIMEOUT : PROBE_REASON_BAD_RESPONSE;
+            return READ_FAILED;
+        } else {
+            char* line = reader->buf;
+            line[line_len] = '\0';
+            header_len += line_len + 2;
+            if (skipping) {
+                skipping = false;
+            } else if (status_code == 0) {
+                if (sscanf(line, "HTTP/%d.%d %d", &major, &minor, &status_code) != 3 || status_code <= 0) {
+                    path->reason = PROBE_REASON_BAD_RESPONSE;
+                    return READ_FAILED;
+                }
+                persistent = (major == 1 && minor >= 1);
+            } else if (line_len == 0) {
+                headers_done = true;
+            } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                content_length = strtol(line + 15, NULL, 10);
+            } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+                chunked = header_has_token(line + 18, "chunked");
+            } else if (strncasecmp(line, "Connection:", 11) == 0) {
+                if (header_has_token(line + 11, "close")) {
+                    persistent = false;
+                } else if (header_has_token(line + 11, "keep-alive")) {
+                    persistent = true;
+                }
+            } else if (strncasecmp(line, "Retry-After:", 12) == 0 && (status_code == 429 || status_code == 503)) {
+                uint32_t retry_ms = parse_retry_after(line + 12);
+                if (retry_ms > *retry_after_ms) {
+                    *retry_after_ms = retry_ms;
+                }
+            }
+            reader_consume(reader, line_len + 2);
+        }
+        if (header_len > reader->max_response) {
+            path->reason = PROBE_REASON_TOO_LARGE;
+            return READ_FAILED;
+        }
+    }
+    
+    path->status_code = (uint16_t)status_code;
+    path->reason = status_reason(status_code);
+    path->healthy = (path->reason == PROBE_REASON_OK);
+    
+    // The body is never needed, but the next response only starts after it. Past the cap the
+    // connection is dropped rather than drained
+    size_t max_body = reader->max_response - header_len;
+    bool too_large = false;
+    bool framed;
+    if ((status_code >= 100 && status_code < 200) || status_code == 204 || status_code == 304) {
+        framed = true;
+    } else if (chunked) {
+        framed = skip_chunked(reader, max_body, deadline, &too_large);
+    } else if (content_length > (long)max_body) {
+        framed = false;
+        too_large = true;
+    } else if (content_length >= 0) {
+        framed = skip_bytes(reader, content_length, deadline);
+    } else {
+        framed = false;
+        skip_to_close(reader, max_body, deadline, &too_large);
+    }
+    if (too_large) {
+        LOGR_W(LOG_MOD_PROBE, "Response with status %d over the %u byte cap", status_code, reader->max_response);
+        path->healthy = false;
+        path->reason = PROBE_REASON_TOO_LARGE;
+        return READ_FAILED;
+    }
+    *keep_alive = persistent && framed;
+    return READ_OK;
+}
+
+static int reader_fill(http_reader_t* reader, TickType_t deadline)
+{
+    // Bytes added, 0 once the peer closed or reset the connection, -1 on timeout
+    while (1) {
+        int n = recv(reader->sock, reader->buf + reader->len, PROBE_BUF_SIZE - 1 - reader->len, 0);
+        if (n > 0) {
+            reader->len += n;
+            reader->buf[reader->len] = '\0';
+            return n;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return 0;
+        }
+        int ret = wait_socket(reader->sock, false, deadline);
+        if (ret == 0) {
+            return -1;
+        }
+        if (ret < 0) {
+            return 0;
+        }
+    }
+}
+
+static int reader_line(http_reader_t* reader, TickType_t deadline)
+{
+    // Length of the buffered line without its CRLF, or one of the LINE_* failures
+    char* eol;
+    while ((eol = strstr(reader->buf, "\r\n")) == NULL) {
+        if (reader->len >= PROBE_BUF_SIZE - 1) {
+            return LINE_TOO_LONG;
+        }
+        int n = reader_fill(reader, deadline);
+        if (n <= 0) {
+            return n < 0 ? LINE_TIMEOUT : LINE_CLOSED;
+        }
+    }
+    return eol - reader->buf;
+}
+
+static void reader_consume(http_reader_t* reader, size_t len)
+{
+    memmove(reader->buf, reader->buf + len, reader->len - len + 1);
+    reader->len -= len;
+}
+
+static bool skip_bytes(http_reader_t* reader, size_t len, TickType_t deadline)
+{
+    while (len > 0) {
+        if (reader->len == 0 && reader_fill(reader, deadline) <= 0) {
+            return false;
+        }
+        // Bytes past this body stay buffered for the next response
+        size_t take = reader->len < len ? reader->len : len;
+        reader_consume(reader, take);
+        len -= take;
+    }
+    return true;
+}
+
+static bool skip_chunked(http_reader_t* reader, size_t max_body, TickType_t deadline, bool* too_large)
+{
+    // Size line, data and CRLF per chunk, up to the zero-size chunk
+    while (1) {
+        int line_len = reader_line(reader, deadline);
+        if (line_len < 0) {
+            return false;
+        }
+        unsigned long size = strtoul(reader->buf, NULL, 16);
+        reader_consume(reader, line_len + 2);
+        if (size == 0) {
+            break;
+        }
+        if (size > max_body) {
+            *too_large = true;
+            return false;
+        }
+        max_body -= size;
+        if (!skip_bytes(reader, size + 2, deadline)) {
+            return false;
+        }
+    }
+    
+    // Optional trailers, then the empty line
+    while (1) {
+        int line_len = reader_line(reader, deadline);
+        if (line_len < 0) {
+            return false;
+        }
+        reader_consume(reader, line_len + 2);
+        if (line_len == 0) {
+            return true;
+        }
+    }
+}
+
+static void skip_to_close(http_reader_t* reader, size_t max_body, TickType_t deadline, bool* too_large)
+{
+    // The body runs until the server closes, counted against the cap on the way
+    size_t body_len = 0;
+    while (1) {
+        body_len += reader->len;
+        reader_consume(reader, reader->len);
+        if (body_len > max_body) {
+            *too_large = true;
+            return;
+        }
+        if (reader_fill(reader, deadline) <= 0) {
+            return;
+        }
+    }
+}
+
+static bool header_has_token(const char* value, const char* token)
+{
+    // Comma separated, case insensitive, up to the end of the header line
+    size_t token_len = strlen(token);
+    while (*value != '\0' && *value != '\r') {
+        while (*value == ' ' || *value == '\t' || *value == ',') {
+            value++;
+        }
+        size_t len = strcspn(value, ",\r");
+        while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) {
+            len--;
+        }
+        if (len == token_len && strncasecmp(value, token, len) == 0) {
+            return true;
+        }
+        value += strcspn(value, ",\r");
+    }
+    return false;
+}
+
+static void fail_paths(probe_result_t* result, uint8_t from, uint8_t to, uint8_t reason)
+{
+    for (uint8_t i = from; i < to && i < PROBE_MAX_PATHS; i++) {
+        result->paths[i].healthy = false;
+        result->paths[i].reason = reason;
+    }
+}
+
+static void merge_paths(probe_result_t* result)
+{
+    // Healthy only if every path is, otherwise the first failing path speaks for the target
+    result->healthy = true;
+    result->status_code = 200;
+    for (uint8_t i = 0; i < result->path_count; i++) {
+        const probe_path_result_t* path = &result->paths[i];
+        if (!path->healthy) {
+            result->healthy = false;
+            result->reason = path->reason;
+            result->status_code = path->status_code;
+            break;
+        }
+    }
+    
+    if (result->healthy) {
+        result->err = ESP_OK;
+    } else if (result->reason == PROBE_REASON_TIMEOUT || result->reason == PROBE_REASON_FIRST_BYTE_TIMEOUT ||
+               result->reason == PROBE_REASON_CONNECT_TIMEOUT) {
+        result->err = ESP_ERR_TIMEOUT;
+    } else {
+        result->err = ESP_FAIL;
+    }
+}
+
+static uint16_t elapsed_ms_since(int64_t start_us)
+{
+    int64_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+    return elapsed_ms > UINT16_MAX ? UINT16_MAX : (uint16_t)elapsed_ms;
+}
+
+static int32_t remaining_ms(TickType_t deadline)
+{
+    return (int32_t)(deadline - xTaskGetTickCount()) * portTICK_PERIOD_MS;
+}
+
+static esp_err_t http_event_handler(esp_http_client_event_t *evt)
+{
+    switch (evt->event_id) {
+        case HTTP_EVENT_ERROR:
+            ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
+            break;
+        case HTTP_EVENT_ON_CONNECTED:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+            if (evt->user_data != NULL) {
+                http_context_t *context = evt->user_data;
+                context->connected = true;
+                context->connected_us = esp_timer_get_time();
+            }
+            break;
+        case HTTP_EVENT_HEADER_SENT:
+            ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
+            break;
+        case HTTP_EVENT_ON_HEADER:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            if (evt->user_data != NULL) {
+                http_context_t *context = evt->user_data;
+                context->responded = true;
+                if (strcasecmp(evt->header_key, "Retry-After") == 0) {
+                    context->result->retry_after_ms = parse_retry_after(evt->header_value);
+                }
+            }
+            break;
+        case HTTP_EVENT_ON_DATA:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+            if (evt->user_data != NULL) {
+                http_context_t *context = evt->user_data;
+                context->body_len += evt->data_len;
+            }
+            break;
+        case HTTP_EVENT_ON_FINISH:
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
+            break;
+        case HTTP_EVENT_DISCONNECTED:
+            ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,77 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "config.h"
+
+// Why a probe failed
+typedef enum {
+    PROBE_REASON_OK = 0,
+    PROBE_REASON_NO_NETWORK,     // WiFi down when the probe ran
+    PROBE_REASON_BAD_CONFIG,     // URL or port could not be parsed
+    PROBE_REASON_DNS,            // Host name did not resolve
+    PROBE_REASON_CONNECT,        // Connection refused or reset
+    PROBE_REASON_TIMEOUT,        // Deadline reached before an answer
+    PROBE_REASON_HTTP_STATUS,    // Answered with a non-200 status
+    PROBE_REASON_BAD_RESPONSE,   // Answered, but not what was expected
+    PROBE_REASON_NO_RESOURCES,   // Out of sockets or memory
+    PROBE_REASON_THROTTLED,      // 429, the server is up but asked us to back off
+    PROBE_REASON_CONNECT_TIMEOUT,     // TCP handshake did not finish within its budget
+    PROBE_REASON_TLS_TIMEOUT,         // TLS handshake did not finish within its budget
+    PROBE_REASON_FIRST_BYTE_TIMEOUT,  // Request sent, no response within its budget
+    PROBE_REASON_WATCHDOG,            // Overran the deadline, abandoned by the pool watchdog
+    PROBE_REASON_SLOW,                // Answered, but the target's latency average is over latency_failed
+    PROBE_REASON_TOO_LARGE,           // Response over the target's max_response
+    PROBE_REASON_COUNT
+} probe_reason_t;
+
+// The URL's own path and the target's extra paths
+#define PROBE_MAX_PATHS (1 + MAX_TARGET_PATHS)
+
+// Outcome of one path of a multi-path HTTP target
+typedef struct {
+    bool healthy;
+    uint8_t reason;        // probe_reason_t
+    uint16_t status_code;
+    uint16_t latency_ms;   // From sending its request until its response headers
+} probe_path_result_t;
+
+// Outcome of a probe, latency covers the whole probe including DNS
+typedef struct {
+    bool healthy;
+    uint8_t reason;  // probe_reason_t
+    int status_code;
+    uint32_t latency_ms;
+    uint32_t retry_after_ms;  // From a Retry-After header, 0 if absent
+    esp_err_t err;
+    // Multi-path targets only, the fields above then describe the first failing path
+    uint8_t path_count;
+    bool pipelined;  // Responses came from requests sent back to back on one connection
+    probe_path_result_t paths[PROBE_MAX_PATHS];
+} probe_result_t;
+
+// Resolved phase budgets for one probe, each one is capped by total_ms
+typedef struct {
+    uint32_t connect_ms;
+    uint32_t tls_ms;
+    uint32_t first_byte_ms;
+    uint32_t total_ms;
+} probe_budget_t;
+
+// Function prototypes
+void probe_budget_resolve(const health_target_config_t* target, uint32_t interval_ms, probe_budget_t* budget);
+void probe_run(const health_target_config_t* target, const probe_budget_t* budget, TickType_t deadline,
+               probe_result_t* result);
+bool probe_parse_address(const char* url, char* host, size_t host_size, uint16_t* port);
+const char* probe_url_path(const char* url);
+uint8_t probe_path_count(const health_target_config_t* target);  // 1 for single-path targets
+const char* probe_path(const health_target_config_t* target, uint8_t index);
+probe_type_t probe_type_from_url(const char* url);
+const char* probe_type_name(probe_type_t type);
+const char* probe_reason_name(probe_reason_t reason);
+
+#endif // PROBE_H
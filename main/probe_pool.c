@@ -0,0 +1,416 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "config.h"
+#include "probe_pool.h"
+#include "buf_pool.h"
+#include "log_ring.h"
+
+static const char *TAG = "PROBE_POOL";
+
+#define HOST_SLOT_POLL_MS 20
+#define COMPLETION_SLOTS (PROBE_POOL_QUEUE_LENGTH + PROBE_POOL_WORKERS)
+
+// Workers only ever wait for a socket in lwIP if the budget leaves none for them
+_Static_assert(SOCKETS_TOTAL <= CONFIG_LWIP_MAX_SOCKETS, "socket budget exceeds CONFIG_LWIP_MAX_SOCKETS");
+
+// Active connections per host
+typedef struct {
+    char host[MAX_HOST_LENGTH];
+    uint8_t active;
+} host_slot_t;
+
+// Finished probe waiting for its turn to be delivered
+typedef struct {
+    bool used;
+    probe_job_t job;
+    probe_result_t result;
+} completion_t;
+
+// What a worker is running, watched for overruns
+typedef struct {
+    TaskHandle_t task;
+    bool busy;
+    bool abandoned;   // Result already delivered by the watchdog
+    bool host_held;   // Host slot taken and not yet released by either side
+    int sock;         // Socket registered by the probe, -1 if none
+    TickType_t started;
+    probe_job_t job;
+} worker_t;
+
+// Global variables
+static QueueHandle_t s_job_queue = NULL;
+static SemaphoreHandle_t s_host_mutex = NULL;
+static SemaphoreHandle_t s_submit_mutex = NULL;
+static SemaphoreHandle_t s_complete_mutex = NULL;
+static SemaphoreHandle_t s_worker_mutex = NULL;
+static worker_t s_workers[PROBE_POOL_WORKERS];
+static probe_pool_stats_t s_stats;
+static host_slot_t s_hosts[PROBE_POOL_WORKERS];
+static completion_t s_completions[COMPLETION_SLOTS];
+static uint32_t s_next_submit_seq = 0;
+static uint32_t s_next_deliver_seq = 0;
+static probe_pool_run_fn_t s_run_fn = NULL;
+static probe_pool_done_fn_t s_done_fn = NULL;
+
+// Function prototypes
+static void probe_worker_task(void *pvParameters);
+static bool deadline_expired(TickType_t deadline);
+static bool acquire_host_slot(const probe_job_t* job);
+static void release_host_slot(const probe_job_t* job);
+static void complete_job(const probe_job_t* job, const probe_result_t* result);
+static void hold_host_slot(worker_t* worker);
+static void drop_host_slot(worker_t* worker);
+static bool finish_job(worker_t* worker);
+static void probe_watchdog_task(void *pvParameters);
+static void count_stat(uint32_t* counter);
+
+esp_err_t probe_pool_init(probe_pool_run_fn_t run_fn, probe_pool_done_fn_t done_fn)
+{
+    if (s_job_queue != NULL) {
+        s_run_fn = run_fn;
+        s_done_fn = done_fn;
+        return ESP_OK;
+    }
+    
+    ESP_LOGI(TAG, "Starting probe pool: %d workers, %d per host", PROBE_POOL_WORKERS, PROBE_POOL_MAX_PER_HOST);
+    
+    s_run_fn = run_fn;
+    s_done_fn = done_fn;
+    
+    // Blocks the HTTP probes of the workers draw from
+    buf_pool_init();
+    
+    s_job_queue = xQueueCreate(PROBE_POOL_QUEUE_LENGTH, sizeof(probe_job_t));
+    s_host_mutex = xSemaphoreCreateMutex();
+    s_submit_mutex = xSemaphoreCreateMutex();
+    s_complete_mutex = xSemaphoreCreateMutex();
+    s_worker_mutex = xSemaphoreCreateMutex();
+    
+    if (s_job_queue == NULL || s_host_mutex == NULL ||
+        s_submit_mutex == NULL || s_complete_mutex == NULL || s_worker_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate probe pool resources");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    memset(s_hosts, 0, sizeof(s_hosts));
+    memset(s_completions, 0, sizeof(s_completions));
+    memset(s_workers, 0, sizeof(s_workers));
+    
+    for (int i = 0; i < PROBE_POOL_WORKERS; i++) {
+        s_workers[i].sock = -1;
+        if (xTaskCreate(probe_worker_task, "probe_worker", PROBE_POOL_TASK_STACK, &s_workers[i], 5,
+                        &s_workers[i].task) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create probe worker %d", i);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    
+    // A task rather than a timer: delivering a result runs the whole status update (GPIO, NVS, MQTT),
+    // which needs more stack than the timer task has and must not hold up other timers
+    if (xTaskCreate(probe_watchdog_task, "probe_watchdog", PROBE_POOL_TASK_STACK, NULL, 5, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create probe watchdog");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    return ESP_OK;
+}
+
+esp_err_t probe_pool_submit(probe_job_t* job)
+{
+    if (s_job_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    // Sequence numbers must stay contiguous, so only consume one when the job is queued
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(s_submit_mutex, portMAX_DELAY);
+    job->seq = s_next_submit_seq;
+    if (xQueueSend(s_job_queue, job, 0) == pdTRUE) {
+        s_next_submit_seq++;
+        count_stat(&s_stats.submitted);
+    } else {
+        LOGR_W(LOG_MOD_POOL, "Probe queue full, dropping job for target %d", job->target);
+        count_stat(&s_stats.dropped);
+        err = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(s_submit_mutex);
+    
+    return err;
+}
+
+void probe_pool_flush(void)
+{
+    if (s_job_queue == NULL) {
+        return;
+    }
+    
+    xSemaphoreTake(s_submit_mutex, portMAX_DELAY);
+    xSemaphoreTake(s_complete_mutex, portMAX_DELAY);
+    
+    xQueueReset(s_job_queue);
+    memset(s_completions, 0, sizeof(s_completions));
+    // Anything older than this is stale and gets discarded on completion
+    s_next_deliver_seq = s_next_submit_seq;
+    
+    xSemaphoreGive(s_complete_mutex);
+    xSemaphoreGive(s_submit_mutex);
+    
+    ESP_LOGD(TAG, "Probe pool flushed");
+}
+
+void probe_pool_set_socket(int sock)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    
+    xSemaphoreTake(s_worker_mutex, portMAX_DELAY);
+    for (int i = 0; i < PROBE_POOL_WORKERS; i++) {
+        if (s_workers[i].task == task) {
+            s_workers[i].sock = sock;
+            break;
+        }
+    }
+    xSemaphoreGive(s_worker_mutex);
+}
+
+void probe_pool_get_stats(probe_pool_stats_t* stats)
+{
+    taskENTER_CRITICAL();
+    *stats = s_stats;
+    taskEXIT_CRITICAL();
+}
+
+static void probe_worker_task(void *pvParameters)
+{
+    worker_t* worker = (worker_t*)pvParameters;
+    probe_job_t job;
+    
+    while (1) {
+        if (xQueueReceive(s_job_queue, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        
+        xSemaphoreTake(s_worker_mutex, portMAX_DELAY);
+        worker->job = job;
+        worker->started = xTaskGetTickCount();
+        worker->abandoned = false;
+        worker->host_held = false;
+        worker->busy = true;
+        xSemaphoreGive(s_worker_mutex);
+        
+        probe_result_t result = {
+            .healthy = false,
+            .reason = PROBE_REASON_TIMEOUT,
+            .status_code = 0,
+            .latency_ms = 0,
+            .err = ESP_ERR_TIMEOUT,
+        };
+        
+        // One worker runs one probe with one socket, so the worker count is the global socket limit
+        if (deadline_expired(job.deadline)) {
+            LOGR_W(LOG_MOD_POOL, "Probe for target %d expired in queue", job.target);
+            count_stat(&s_stats.expired);
+        } else if (!acquire_host_slot(&job)) {
+            LOGR_W(LOG_MOD_POOL, "No connection slot for target %d before deadline", job.target);
+            count_stat(&s_stats.expired);
+        } else {
+            hold_host_slot(worker);
+            s_run_fn(&job, &result);
+            drop_host_slot(worker);
+        }
+        
+        if (finish_job(worker)) {
+            complete_job(&job, &result);
+        }
+    }
+}
+
+static void hold_host_slot(worker_t* worker)
+{
+    xSemaphoreTake(s_worker_mutex, portMAX_DELAY);
+    worker->host_held = true;
+    xSemaphoreGive(s_worker_mutex);
+}
+
+static void drop_host_slot(worker_t* worker)
+{
+    // The watchdog may have released it already when it abandoned the job
+    xSemaphoreTake(s_worker_mutex, portMAX_DELAY);
+    if (worker->host_held) {
+        worker->host_held = false;
+        release_host_slot(&worker->job);
+    }
+    xSemaphoreGive(s_worker_mutex);
+}
+
+static bool finish_job(worker_t* worker)
+{
+    // The watchdog may have reported this job already, its late result is dropped
+    xSemaphoreTake(s_worker_mutex, portMAX_DELAY);
+    bool deliver = !worker->abandoned;
+    worker->busy = false;
+    worker->sock = -1;
+    xSemaphoreGive(s_worker_mutex);
+    
+    if (!deliver) {
+        LOGR_W(LOG_MOD_POOL, "Late result for target %d discarded", worker->job.target);
+    }
+    return deliver;
+}
+
+static void probe_watchdog_task(void *pvParameters)
+{
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(PROBE_WATCHDOG_PERIOD_MS));
+        
+        TickType_t now = xTaskGetTickCount();
+        
+        for (int i = 0; i < PROBE_POOL_WORKERS; i++) {
+            worker_t* worker = &s_workers[i];
+            probe_job_t job;
+            bool overrun = false;
+            
+            xSemaphoreTake(s_worker_mutex, portMAX_DELAY);
+            if (worker->busy && !worker->abandoned &&
+                (int32_t)(now - (worker->job.deadline + pdMS_TO_TICKS(PROBE_WATCHDOG_GRACE_MS))) >= 0) {
+                worker->abandoned = true;
+                job = worker->job;
+                overrun = true;
+                // Wakes a probe blocked on the socket, a probe inside the SDK client runs into its own timeout
+                if (worker->sock >= 0) {
+                    shutdown(worker->sock, SHUT_RDWR);
+                }
+                // With one connection per host a stuck probe would otherwise block the next check of its host
+                if (worker->host_held) {
+                    worker->host_held = false;
+                    release_host_slot(&worker->job);
+                }
+            }
+            xSemaphoreGive(s_worker_mutex);
+            
+            if (overrun) {
+                probe_result_t result = {
+                    .healthy = false,
+                    .reason = PROBE_REASON_WATCHDOG,
+                    .status_code = 0,
+                    .latency_ms = (now - worker->started) * portTICK_PERIOD_MS,
+                    .err = ESP_ERR_TIMEOUT,
+                };
+                LOGR_W(LOG_MOD_POOL, "Probe for target %d overran its deadline, abandoned", job.target);
+                count_stat(&s_stats.watchdog);
+                // Delivered now so the relay does not wait for a stalled server
+                complete_job(&job, &result);
+            }
+        }
+    }
+}
+
+static bool deadline_expired(TickType_t deadline)
+{
+    return (int32_t)(deadline - xTaskGetTickCount()) <= 0;
+}
+
+static bool acquire_host_slot(const probe_job_t* job)
+{
+    while (1) {
+        xSemaphoreTake(s_host_mutex, portMAX_DELAY);
+        
+        host_slot_t* match = NULL;
+        host_slot_t* free_slot = NULL;
+        for (int i = 0; i < PROBE_POOL_WORKERS; i++) {
+            if (s_hosts[i].active > 0 && strcmp(s_hosts[i].host, job->host) == 0) {
+                match = &s_hosts[i];
+                break;
+            }
+            if (s_hosts[i].active == 0 && free_slot == NULL) {
+                free_slot = &s_hosts[i];
+            }
+        }
+        
+        bool acquired = false;
+        if (match != NULL && match->active < PROBE_POOL_MAX_PER_HOST) {
+            match->active++;
+            acquired = true;
+        } else if (match == NULL && free_slot != NULL) {
+            strncpy(free_slot->host, job->host, sizeof(free_slot->host) - 1);
+            free_slot->host[sizeof(free_slot->host) - 1] = '\0';
+            free_slot->active = 1;
+            acquired = true;
+        }
+        
+        xSemaphoreGive(s_host_mutex);
+        
+        if (acquired) {
+            return true;
+        }
+        if (deadline_expired(job->deadline)) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(HOST_SLOT_POLL_MS));
+    }
+}
+
+static void release_host_slot(const probe_job_t* job)
+{
+    xSemaphoreTake(s_host_mutex, portMAX_DELAY);
+    for (int i = 0; i < PROBE_POOL_WORKERS; i++) {
+        if (s_hosts[i].active > 0 && strcmp(s_hosts[i].host, job->host) == 0) {
+            s_hosts[i].active--;
+            break;
+        }
+    }
+    xSemaphoreGive(s_host_mutex);
+}
+
+static void complete_job(const probe_job_t* job, const probe_result_t* result)
+{
+    xSemaphoreTake(s_complete_mutex, portMAX_DELAY);
+    
+    // Results from before the last flush are stale
+    if ((int32_t)(job->seq - s_next_deliver_seq) < 0) {
+        xSemaphoreGive(s_complete_mutex);
+        return;
+    }
+    
+    for (int i = 0; i < COMPLETION_SLOTS; i++) {
+        if (!s_completions[i].used) {
+            s_completions[i].used = true;
+            s_completions[i].job = *job;
+            s_completions[i].result = *result;
+            break;
+        }
+    }
+    
+    // Deliver every result whose predecessors have all completed
+    bool delivered = true;
+    while (delivered) {
+        delivered = false;
+        for (int i = 0; i < COMPLETION_SLOTS; i++) {
+            if (s_completions[i].used && s_completions[i].job.seq == s_next_deliver_seq) {
+                if (s_done_fn != NULL) {
+                    s_done_fn(&s_completions[i].job, &s_completions[i].result);
+                }
+                s_completions[i].used = false;
+                s_next_deliver_seq++;
+                delivered = true;
+                break;
+            }
+        }
+    }
+    
+    xSemaphoreGive(s_complete_mutex);
+}
+
+static void count_stat(uint32_t* counter)
+{
+    // Bumped from every worker and the watchdog
+    taskENTER_CRITICAL();
+    (*counter)++;
+    taskEXIT_CRITICAL();
+}
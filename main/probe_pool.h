@@ -0,0 +1,40 @@
+#ifndef PROBE_POOL_H
+#define PROBE_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "config.h"
+#include "probe.h"
+
+// A single probe request handed to the worker pool
+typedef struct {
+    uint32_t seq;                 // Assigned by the pool, defines delivery order
+    uint8_t target;               // Index of the target being probed
+    char host[MAX_HOST_LENGTH];   // Used for the per-host connection limit
+    TickType_t deadline;          // Absolute tick by which the probe must finish
+} probe_job_t;
+
+// Runs the probe on a worker task, should return before job->deadline. A probe that overruns
+// it by PROBE_WATCHDOG_GRACE_MS is reported as failed and its late result is discarded.
+typedef void (*probe_pool_run_fn_t)(const probe_job_t* job, probe_result_t* result);
+// Receives results one at a time, in submission (deadline) order
+typedef void (*probe_pool_done_fn_t)(const probe_job_t* job, const probe_result_t* result);
+
+// Counters since boot
+typedef struct {
+    uint32_t submitted;
+    uint32_t dropped;    // Queue full
+    uint32_t expired;    // Deadline reached before a worker or a host slot was free
+    uint32_t watchdog;   // Overran the deadline and were abandoned
+} probe_pool_stats_t;
+
+// Function prototypes
+esp_err_t probe_pool_init(probe_pool_run_fn_t run_fn, probe_pool_done_fn_t done_fn);
+esp_err_t probe_pool_submit(probe_job_t* job);  // Non-blocking, fails when the queue is full
+void probe_pool_flush(void);  // Drop queued jobs and discard results still in flight
+void probe_pool_set_socket(int sock);  // Called by probes on a worker, -1 once closed; the watchdog shuts it down on overrun
+void probe_pool_get_stats(probe_pool_stats_t* stats);
+
+#endif // PROBE_POOL_H
@@ -0,0 +1,352 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "config.h"
+#include "slo.h"
+#include "time_sync.h"
+
+static const char *TAG = "SLO";
+
+#define SLO_1H_BUCKETS 12   // 5 min each
+#define SLO_24H_BUCKETS 24  // 1 h each
+#define SLO_7D_BUCKETS 28   // 6 h each
+#define SLO_BUCKET_TOTAL (SLO_1H_BUCKETS + SLO_24H_BUCKETS + SLO_7D_BUCKETS)
+
+typedef enum {
+    SERVICE_UNKNOWN = 0,  // Not monitoring, time is not counted
+    SERVICE_UP,
+    SERVICE_DOWN,
+} service_state_t;
+
+// Ring layout of one window inside s_store.buckets
+typedef struct {
+    const char *name;
+    uint32_t bucket_s;
+    uint8_t count;
+    uint8_t first;
+} window_layout_t;
+
+// Everything that survives a reboot, saved as a single blob
+typedef struct {
+    uint32_t head_start_s[SLO_WINDOW_COUNT];  // Epoch second the head bucket starts at, 0 if never used
+    uint8_t head[SLO_WINDOW_COUNT];
+    slo_totals_t pending;                     // Collected before the clock was set
+    slo_totals_t buckets[SLO_BUCKET_TOTAL];
+} slo_store_t;
+
+static const window_layout_t s_windows[SLO_WINDOW_COUNT] = {
+    [SLO_WINDOW_1H] = { "1h", 300, SLO_1H_BUCKETS, 0 },
+    [SLO_WINDOW_24H] = { "24h", 3600, SLO_24H_BUCKETS, SLO_1H_BUCKETS },
+    [SLO_WINDOW_7D] = { "7d", 21600, SLO_7D_BUCKETS, SLO_1H_BUCKETS + SLO_24H_BUCKETS },
+};
+
+// Global variables
+static slo_store_t s_store;
+static SemaphoreHandle_t s_mutex = NULL;
+static uint8_t s_state = SERVICE_UNKNOWN;
+static TickType_t s_accounted_tick = 0;  // Time before this tick is already in the buckets
+static bool s_incident_open = false;
+static bool s_incident_detected = false;   // Relay already switched off for it
+static TickType_t s_incident_start = 0;    // Start of the first failed probe
+static TickType_t s_last_save_tick = 0;
+static bool s_dirty = false;
+
+// Function prototypes
+static void account_time(TickType_t until);
+static void add_time(uint32_t duration_ms, bool up, TickType_t until);
+static void add_event(bool detection, uint32_t duration_ms);
+static slo_totals_t* head_bucket(slo_window_t window, uint32_t now_s);
+static void fold_pending(uint32_t now_s);
+static void add_totals(slo_totals_t* dest, const slo_totals_t* src);
+static void save_locked(void);
+
+void slo_init(void)
+{
+    s_mutex = xSemaphoreCreateMutex();
+    memset(&s_store, 0, sizeof(s_store));
+    s_accounted_tick = xTaskGetTickCount();
+    s_last_save_tick = s_accounted_tick;
+    
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        return;
+    }
+    
+    size_t required_size = sizeof(s_store);
+    esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_SLO, &s_store, &required_size);
+    if (err == ESP_OK && required_size == sizeof(s_store)) {
+        ESP_LOGI(TAG, "Restored SLO windows (%d bytes)", (int)sizeof(s_store));
+    } else {
+        if (err == ESP_OK) {
+            ESP_LOGW(TAG, "Stored SLO windows do not match this firmware, starting over");
+        }
+        memset(&s_store, 0, sizeof(s_store));
+    }
+    nvs_close(nvs_handle);
+}
+
+void slo_observe(bool healthy, uint32_t since_ms)
+{
+    if (s_mutex == NULL) {
+        return;
+    }
+    
+    TickType_t now = xTaskGetTickCount();
+    
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    
+    // The previous state holds until the probe that produced this verdict started
+    TickType_t at = now - pdMS_TO_TICKS(since_ms);
+    if ((int32_t)(at - s_accounted_tick) < 0) {
+        at = s_accounted_tick;
+    }
+    account_time(at);
+    
+    if (!healthy && s_state != SERVICE_DOWN) {
+        s_incident_open = true;
+        s_incident_detected = false;
+        s_incident_start = at;
+    } else if (healthy && s_incident_open && !s_incident_detected) {
+        // Over before the relay reacted, nothing to detect or recover from
+        s_incident_open = false;
+    }
+    s_state = healthy ? SERVICE_UP : SERVICE_DOWN;
+    account_time(now);
+    
+    if (s_dirty && (now - s_last_save_tick) >= pdMS_TO_TICKS(SLO_SAVE_INTERVAL_MS)) {
+        save_locked();
+    }
+    
+    xSemaphoreGive(s_mutex);
+}
+
+void slo_relay_changed(bool on)
+{
+    if (s_mutex == NULL) {
+        return;
+    }
+    
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    if (s_incident_open) {
+        uint32_t age_ms = (xTaskGetTickCount() - s_incident_start) * portTICK_PERIOD_MS;
+        if (!on && !s_incident_detected) {
+            s_incident_detected = true;
+            add_event(true, age_ms);
+            ESP_LOGI(TAG, "Outage detected %u ms after the first failed probe", age_ms);
+        } else if (on && s_incident_detected) {
+            s_incident_open = false;
+            add_event(false, age_ms);
+            ESP_LOGI(TAG, "Recovered %u ms after the first failed probe", age_ms);
+        }
+    }
+    xSemaphoreGive(s_mutex);
+}
+
+void slo_pause(void)
+{
+    if (s_mutex == NULL) {
+        return;
+    }
+    
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    account_time(xTaskGetTickCount());
+    s_state = SERVICE_UNKNOWN;
+    s_incident_open = false;
+    xSemaphoreGive(s_mutex);
+}
+
+bool slo_get_totals(slo_window_t window, slo_totals_t* totals)
+{
+    if (window >= SLO_WINDOW_COUNT || s_mutex == NULL) {
+        return false;
+    }
+    memset(totals, 0, sizeof(*totals));
+    
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    account_time(xTaskGetTickCount());
+    
+    uint64_t now_ms = time_sync_epoch_ms();
+    if (now_ms != 0) {
+        // Rotating to now drops the buckets that aged out while nothing was recorded
+        head_bucket(window, (uint32_t)(now_ms / 1000));
+        const window_layout_t* layout = &s_windows[window];
+        for (uint8_t i = 0; i < layout->count; i++) {
+            add_totals(totals, &s_store.buckets[layout->first + i]);
+        }
+    }
+    add_totals(totals, &s_store.pending);
+    xSemaphoreGive(s_mutex);
+    
+    return true;
+}
+
+const char* slo_window_name(slo_window_t window)
+{
+    return window < SLO_WINDOW_COUNT ? s_windows[window].name : "?";
+}
+
+bool slo_is_down(void)
+{
+    return s_state == SERVICE_DOWN;
+}
+
+uint32_t slo_incident_age_ms(void)
+{
+    if (!s_incident_open) {
+        return 0;
+    }
+    return (xTaskGetTickCount() - s_incident_start) * portTICK_PERIOD_MS;
+}
+
+void slo_save(void)
+{
+    if (s_mutex == NULL) {
+        return;
+    }
+    
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    account_time(xTaskGetTickCount());
+    save_locked();
+    xSemaphoreGive(s_mutex);
+}
+
+static void account_time(TickType_t until)
+{
+    // Caller holds s_mutex
+    uint32_t elapsed_ms = (until - s_accounted_tick) * portTICK_PERIOD_MS;
+    s_accounted_tick = until;
+    if (s_state == SERVICE_UNKNOWN || elapsed_ms == 0) {
+        return;
+    }
+    add_time(elapsed_ms, s_state == SERVICE_UP, until);
+    s_dirty = true;
+}
+
+static void add_time(uint32_t duration_ms, bool up, TickType_t until)
+{
+    uint64_t end_ms = time_sync_epoch_ms();
+    if (end_ms == 0) {
+        if (up) {
+            s_store.pending.up_ms += duration_ms;
+        } else {
+            s_store.pending.down_ms += duration_ms;
+        }
+        return;
+    }
+    fold_pending((uint32_t)(end_ms / 1000));
+    end_ms -= (uint64_t)(xTaskGetTickCount() - until) * portTICK_PERIOD_MS;
+    
+    // Split the interval at bucket boundaries, each window has its own
+    for (uint8_t w = 0; w < SLO_WINDOW_COUNT; w++) {
+        const window_layout_t* layout = &s_windows[w];
+        uint64_t span_ms = (uint64_t)layout->bucket_s * layout->count * 1000;
+        uint64_t t_ms = end_ms - (duration_ms < span_ms ? duration_ms : span_ms);  // Older time left the window
+        while (t_ms < end_ms) {
+            slo_totals_t* bucket = head_bucket(w, (uint32_t)(t_ms / 1000));
+            uint64_t bucket_end_ms = ((uint64_t)s_store.head_start_s[w] + layout->bucket_s) * 1000;
+            uint32_t chunk_ms = (uint32_t)((bucket_end_ms < end_ms ? bucket_end_ms : end_ms) - t_ms);
+            if (up) {
+                bucket->up_ms += chunk_ms;
+            } else {
+                bucket->down_ms += chunk_ms;
+            }
+            t_ms += chunk_ms;
+        }
+    }
+}
+
+static void add_event(bool detection, uint32_t duration_ms)
+{
+    slo_totals_t event;
+    memset(&event, 0, sizeof(event));
+    if (detection) {
+        event.detections = 1;
+        event.detect_ms = duration_ms;
+    } else {
+        event.recoveries = 1;
+        event.recover_ms = duration_ms;
+    }
+    s_dirty = true;
+    
+    uint64_t now_ms = time_sync_epoch_ms();
+    if (now_ms == 0) {
+        add_totals(&s_store.pending, &event);
+        return;
+    }
+    fold_pending((uint32_t)(now_ms / 1000));
+    for (uint8_t w = 0; w < SLO_WINDOW_COUNT; w++) {
+        add_totals(head_bucket(w, (uint32_t)(now_ms / 1000)), &event);
+    }
+}
+
+static slo_totals_t* head_bucket(slo_window_t window, uint32_t now_s)
+{
+    const window_layout_t* layout = &s_windows[window];
+    slo_totals_t* buckets = &s_store.buckets[layout->first];
+    uint32_t start_s = now_s - now_s % layout->bucket_s;
+    
+    // First use, or everything in the ring has aged out
+    if (s_store.head_start_s[window] == 0 ||
+        start_s >= s_store.head_start_s[window] + layout->bucket_s * layout->count) {
+        memset(buckets, 0, sizeof(buckets[0]) * layout->count);
+        s_store.head[window] = 0;
+        s_store.head_start_s[window] = start_s;
+    }
+    
+    // A clock that stepped back keeps writing to the head
+    while (s_store.head_start_s[window] < start_s) {
+        s_store.head[window] = (s_store.head[window] + 1) % layout->count;
+        memset(&buckets[s_store.head[window]], 0, sizeof(buckets[0]));
+        s_store.head_start_s[window] += layout->bucket_s;
+    }
+    
+    return &buckets[s_store.head[window]];
+}
+
+static void fold_pending(uint32_t now_s)
+{
+    // Time before the first SNTP sync has no place on the clock, it lands in the current bucket
+    if (s_store.pending.up_ms == 0 && s_store.pending.down_ms == 0 &&
+        s_store.pending.detections == 0 && s_store.pending.recoveries == 0) {
+        return;
+    }
+    for (uint8_t w = 0; w < SLO_WINDOW_COUNT; w++) {
+        add_totals(head_bucket(w, now_s), &s_store.pending);
+    }
+    memset(&s_store.pending, 0, sizeof(s_store.pending));
+}
+
+static void add_totals(slo_totals_t* dest, const slo_totals_t* src)
+{
+    dest->up_ms += src->up_ms;
+    dest->down_ms += src->down_ms;
+    dest->detect_ms += src->detect_ms;
+    dest->recover_ms += src->recover_ms;
+    dest->detections += src->detections;
+    dest->recoveries += src->recoveries;
+}
+
+static void save_locked(void)
+{
+    // Caller holds s_mutex, rate limited by the callers to spare the flash
+    s_last_save_tick = xTaskGetTickCount();
+    s_dirty = false;
+    
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+        return;
+    }
+    
+    err = nvs_set_blob(nvs_handle, NVS_KEY_SLO, &s_store, sizeof(s_store));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error saving SLO windows: %s", esp_err_to_name(err));
+    }
+    nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+}
@@ -0,0 +1,38 @@
+#ifndef SLO_H
+#define SLO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Rolling windows, each one a ring of fixed-size buckets
+typedef enum {
+    SLO_WINDOW_1H = 0,
+    SLO_WINDOW_24H,
+    SLO_WINDOW_7D,
+    SLO_WINDOW_COUNT
+} slo_window_t;
+
+// Totals over one window
+typedef struct {
+    uint32_t up_ms;
+    uint32_t down_ms;
+    uint32_t detect_ms;    // Sum over detections, first failed probe until the relay switched off
+    uint32_t recover_ms;   // Sum over recoveries, first failed probe until the relay switched back on
+    uint16_t detections;
+    uint16_t recoveries;
+} slo_totals_t;
+
+// Function prototypes
+void slo_init(void);  // Restores the windows from NVS
+// A verdict on the monitored service; since_ms is how long before now it was taken,
+// so an outage starts when the failing probe (or the missed heartbeat) started
+void slo_observe(bool healthy, uint32_t since_ms);
+void slo_relay_changed(bool on);
+void slo_pause(void);  // Monitoring stopped or WiFi lost, time is not counted until the next verdict
+bool slo_get_totals(slo_window_t window, slo_totals_t* totals);  // False for an unknown window
+const char* slo_window_name(slo_window_t window);
+bool slo_is_down(void);
+uint32_t slo_incident_age_ms(void);  // 0 when there is no open incident
+void slo_save(void);
+
+#endif // SLO_H
@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "config.h"
+#include "syslog_sink.h"
+#include "log_ring.h"
+#include "probe.h"
+#include "time_sync.h"
+#include "wifi_manager.h"
+
+static const char *TAG = "SYSLOG";
+
+#define SYSLOG_FACILITY 16  // local0
+#define SYSLOG_APP_NAME "health-monitor"
+#define SYSLOG_MESSAGE_LENGTH (SYSLOG_LINE_LENGTH + 96)  // Line plus the RFC 5424 header
+#define SYSLOG_MSGID_LENGTH 33
+#define SYSLOG_HOSTNAME_LENGTH 24
+
+// One ESP_LOG line captured by the output hook
+typedef struct {
+    uint32_t time_ms;
+    uint8_t len;
+    char text[SYSLOG_LINE_LENGTH];
+} syslog_line_t;
+
+// Global variables
+static syslog_line_t *s_lines = NULL;  // SYSLOG_LINE_SLOTS of them, allocated on the first start
+static syslog_line_t s_partial;        // Line being assembled by the hook
+static uint32_t s_line_total = 0;      // Lines ever captured, also the next sequence number
+static uint32_t s_line_seq = 0;        // Next line for the sender
+static uint32_t s_ring_seq = 0;        // Next log ring record for the sender
+static putchar_like_t s_uart_putchar = &putchar;  // Where ESP_LOG wrote before the hook
+static volatile bool s_started = false;
+static volatile uint32_t s_generation = 0;  // Bumped on every start, the sender then resolves again
+static char s_host[MAX_HOST_LENGTH];
+static uint16_t s_port = SYSLOG_DEFAULT_PORT;
+static char s_hostname[SYSLOG_HOSTNAME_LENGTH];
+static char *s_datagram = NULL;
+static size_t s_datagram_len = 0;
+static uint8_t s_datagram_lines = 0;
+static TickType_t s_datagram_started = 0;
+static uint32_t s_tokens = SYSLOG_MAX_DATAGRAMS_PER_S;
+static TickType_t s_tokens_refilled = 0;
+static uint32_t s_reported_dropped = 0;
+static TickType_t s_reported_at = 0;
+static syslog_sink_stats_t s_stats;
+
+// Function prototypes
+static void syslog_sink_task(void *pvParameters);
+static int syslog_putchar(int c);
+static void commit_line(void);
+static int next_message(char *message, size_t size);
+static int format_message(char *message, size_t size, uint32_t time_ms, char *text);
+static bool has_secret(const char *body);
+static int format_timestamp(char *buffer, size_t size, uint32_t time_ms);
+static bool resolve_server(struct sockaddr_in *addr);
+static bool flush_datagram(int sock, const struct sockaddr_in *addr);
+static uint32_t uptime_ms(void);
+
+void syslog_sink_start(const char* server)
+{
+    char host[MAX_HOST_LENGTH];
+    uint16_t port = 0;
+    if (!probe_parse_address(server, host, sizeof(host), &port)) {
+        ESP_LOGE(TAG, "Invalid syslog server: %s", server);
+        return;
+    }
+    
+    // Buffers and the hook stay for good once created, the hook may run in any task at any time
+    if (s_lines == NULL) {
+        s_lines = calloc(SYSLOG_LINE_SLOTS, sizeof(syslog_line_t));
+        s_datagram = malloc(SYSLOG_DATAGRAM_SIZE);
+        if (s_lines == NULL || s_datagram == NULL ||
+            xTaskCreate(syslog_sink_task, "syslog_sink", SYSLOG_TASK_STACK, NULL, 1, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create syslog sink");
+            free(s_lines);
+            free(s_datagram);
+            s_lines = NULL;
+            s_datagram = NULL;
+            return;
+        }
+        
+        uint8_t mac[6];
+        esp_read_mac(mac, ESP_MAC_WIFI_STA);
+        snprintf(s_hostname, sizeof(s_hostname), "sonoff-%02x%02x%02x", mac[3], mac[4], mac[5]);
+        s_uart_putchar = esp_log_set_putchar(syslog_putchar);
+    }
+    
+    ESP_LOGI(TAG, "Streaming logs to %s:%d", host, port != 0 ? port : SYSLOG_DEFAULT_PORT);
+    
+    taskENTER_CRITICAL();
+    strcpy(s_host, host);
+    s_port = port != 0 ? port : SYSLOG_DEFAULT_PORT;
+    // Lines logged while stopped are not sent, ring records go back as far as the ring does
+    s_line_seq = s_line_total;
+    s_partial.len = 0;
+    if ((int32_t)(s_ring_seq - log_ring_oldest_seq()) < 0) {
+        s_ring_seq = log_ring_oldest_seq();
+    }
+    s_generation++;
+    s_started = true;
+    taskEXIT_CRITICAL();
+}
+
+void syslog_sink_stop(void)
+{
+    if (!s_started) {
+        return;
+    }
+    ESP_LOGI(TAG, "Stopping syslog sink");
+    s_started = false;
+}
+
+bool syslog_sink_is_running(void)
+{
+    return s_started;
+}
+
+void syslog_sink_get_stats(syslog_sink_stats_t* stats)
+{
+    taskENTER_CRITICAL();
+    *stats = s_stats;
+    taskEXIT_CRITICAL();
+}
+
+static int syslog_putchar(int c)
+{
+    // Runs in whatever task logged, including the Wi-Fi event handler: copy and move on
+    if (s_started) {
+        taskENTER_CRITICAL();
+        if (c == '\n') {
+            commit_line();
+        } else if (c != '\r' && s_partial.len < SYSLOG_LINE_LENGTH - 1) {
+            if (s_partial.len == 0) {
+                s_partial.time_ms = uptime_ms();
+            }
+            s_partial.text[s_partial.len++] = (char)c;
+        }
+        taskEXIT_CRITICAL();
+    }
+    return s_uart_putchar(c);
+}
+
+// Called with interrupts disabled
+static void commit_line(void)
+{
+    if (s_partial.len > 0) {
+        syslog_line_t *slot = &s_lines[s_line_total % SYSLOG_LINE_SLOTS];
+        slot->time_ms = s_partial.time_ms;
+        slot->len = s_partial.len;
+        memcpy(slot->text, s_partial.text, s_partial.len);
+        slot->text[slot->len] = '\0';
+        s_line_total++;
+        
+        // The sender fell behind, the oldest line is gone
+        if (s_line_total - s_line_seq > SYSLOG_LINE_SLOTS) {
+            s_line_seq++;
+            s_stats.dropped++;
+        }
+    }
+    s_partial.len = 0;
+}
+
+static void syslog_sink_task(void *pvParameters)
+{
+    int sock = -1;
+    struct sockaddr_in addr;
+    bool resolved = false;
+    uint32_t generation = 0;
+    TickType_t resolve_after = 0;
+    char message[SYSLOG_MESSAGE_LENGTH];
+    int message_len = 0;  // A formatted message that did not fit the last datagram
+    
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(SYSLOG_POLL_INTERVAL_MS));
+        
+        if (!s_started || generation != s_generation) {
+            // Stopped or pointed elsewhere, whatever was batched for the old server is dropped
+            if (sock >= 0) {
+                close(sock);
+                sock = -1;
+            }
+            s_datagram_len = 0;
+            s_datagram_lines = 0;
+            message_len = 0;
+            resolved = false;
+            resolve_after = xTaskGetTickCount();
+            generation = s_generation;
+            if (!s_started) {
+                continue;
+            }
+        }
+        if (!wifi_manager_is_connected()) {
+            continue;
+        }
+        
+        // Name lookups block, but only this task
+        if (!resolved && (int32_t)(xTaskGetTickCount() - resolve_after) >= 0) {
+            resolved = resolve_server(&addr);
+            if (!resolved) {
+                resolve_after = xTaskGetTickCount() + pdMS_TO_TICKS(SYSLOG_RESOLVE_RETRY_MS);
+            }
+        }
+        if (!resolved) {
+            continue;
+        }
+        if (sock < 0) {
+            sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            if (sock < 0) {
+                continue;
+            }
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+        }
+        
+        // Fill datagrams until the lines run out or the rate limit says stop; held back lines
+        // stay in their rings and are overwritten, never queued, if this goes on for too long
+        while (1) {
+            if (message_len == 0) {
+                message_len = next_message(message, sizeof(message));
+                if (message_len == 0) {
+                    break;
+                }
+            }
+            if (s_datagram_len > 0 && s_datagram_len + 1 + message_len > SYSLOG_DATAGRAM_SIZE &&
+                !flush_datagram(sock, &addr)) {
+                break;
+            }
+            if (s_datagram_len == 0) {
+                s_datagram_started = xTaskGetTickCount();
+            } else {
+                s_datagram[s_datagram_len++] = '\n';
+            }
+            memcpy(s_datagram + s_datagram_len, message, message_len);
+            s_datagram_len += message_len;
+            s_datagram_lines++;
+            message_len = 0;
+        }
+        
+        if (s_datagram_len > 0 &&
+            (xTaskGetTickCount() - s_datagram_started) >= pdMS_TO_TICKS(SYSLOG_BATCH_INTERVAL_MS)) {
+            flush_datagram(sock, &addr);
+        }
+    }
+}
+
+// Formats the oldest pending line of either source, returns 0 when there is none
+static int next_message(char *message, size_t size)
+{
+    char text[SYSLOG_LINE_LENGTH];
+    
+    // Lines lost since the last report are reported in the stream itself, once per batch interval
+    // so that a flood does not turn into a stream of reports
+    uint32_t dropped = s_stats.dropped;
+    if (dropped != s_reported_dropped &&
+        (xTaskGetTickCount() - s_reported_at) >= pdMS_TO_TICKS(SYSLOG_BATCH_INTERVAL_MS)) {
+        snprintf(text, sizeof(text), "W (%u) %s: %u lines dropped", uptime_ms(), TAG, dropped - s_reported_dropped);
+        s_reported_dropped = dropped;
+        s_reported_at = xTaskGetTickCount();
+        return format_message(message, size, uptime_ms(), text);
+    }
+    
+    uint32_t ring_seq = s_ring_seq;
+    uint32_t oldest = log_ring_oldest_seq();
+    if ((int32_t)(ring_seq - oldest) < 0) {
+        taskENTER_CRITICAL();
+        s_stats.dropped += oldest - ring_seq;
+        taskEXIT_CRITICAL();
+        ring_seq = oldest;
+    }
+    log_record_t record;
+    bool have_record = log_ring_read(&ring_seq, &record, 1) == 1;
+    
+    syslog_line_t line;
+    uint32_t line_seq = 0;
+    bool have_line = false;
+    taskENTER_CRITICAL();
+    if (s_line_seq != s_line_total) {
+        line_seq = s_line_seq;
+        line = s_lines[line_seq % SYSLOG_LINE_SLOTS];
+        have_line = true;
+    }
+    taskEXIT_CRITICAL();
+    
+    // Both sources are in time order, merge them by time
+    if (have_record && (!have_line || (int32_t)(record.time_ms - line.time_ms) <= 0)) {
+        s_ring_seq = ring_seq;
+        log_ring_format(&record, text, sizeof(text));
+        return format_message(message, size, record.time_ms, text);
+    }
+    if (have_line) {
+        taskENTER_CRITICAL();
+        // The hook may have moved past this line while it was copied, the copy is still whole
+        if (s_line_seq == line_seq) {
+            s_line_seq++;
+        }
+        taskEXIT_CRITICAL();
+        return format_message(message, size, line.time_ms, line.text);
+    }
+    return 0;
+}
+
+static int format_message(char *message, size_t size, uint32_t time_ms, char *text)
+{
+    // Drop the colour codes CONFIG_LOG_COLORS wraps around ESP_LOG lines
+    while (text[0] == '\033') {
+        char *end = strchr(text, 'm');
+        if (end == NULL) {
+            break;
+        }
+        text = end + 1;
+    }
+    char *reset = strchr(text, '\033');
+    if (reset != NULL) {
+        *reset = '\0';
+    }
+    
+    // "I (1234) TAG: message" from both ESP_LOG and the log ring, anything else goes out as info
+    int severity = 6;
+    char msgid[SYSLOG_MSGID_LENGTH] = "-";
+    const char *body = text;
+    const char *close = (text[0] != '\0' && text[1] == ' ' && text[2] == '(') ? strstr(text, ") ") : NULL;
+    const char *colon = (close != NULL) ? strstr(close + 2, ": ") : NULL;
+    if (colon != NULL && colon - (close + 2) > 0 && colon - (close + 2) < SYSLOG_MSGID_LENGTH) {
+        switch (text[0]) {
+            case 'E':
+                severity = 3;
+                break;
+            case 'W':
+                severity = 4;
+                break;
+            case 'I':
+                severity = 6;
+                break;
+            default:
+                severity = 7;
+                break;
+        }
+        // MSGID is printable ASCII without spaces
+        size_t len = colon - (close + 2);
+        for (size_t i = 0; i < len; i++) {
+            char c = close[2 + i];
+            msgid[i] = (c > ' ' && c < 127) ? c : '_';
+        }
+        msgid[len] = '\0';
+        body = colon + 2;
+    }
+    
+    // The collector is a plain UDP listener, never hand it a line that echoes a credential
+    if (has_secret(body)) {
+        body = "[redacted]";
+    }
+    
+    char timestamp[32];
+    format_timestamp(timestamp, sizeof(timestamp), time_ms);
+    
+    // <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG
+    int len = snprintf(message, size, "<%d>1 %s %s %s - %s - %s", SYSLOG_FACILITY * 8 + severity,
+                       timestamp, s_hostname, SYSLOG_APP_NAME, msgid, body);
+    if (len < 0) {
+        return 0;
+    }
+    return len < (int)size ? len : (int)size - 1;
+}
+
+static bool has_secret(const char *body)
+{
+    // JSON keys as they appear in the /config body and its replies
+    static const char *const keys[] = { "password\"", "token\"", "wifi_pass" };
+    
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (strstr(body, keys[i]) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int format_timestamp(char *buffer, size_t size, uint32_t time_ms)
+{
+    // NILVALUE until SNTP has set the clock, the collector then stamps the line itself
+    uint64_t epoch_ms = time_sync_epoch_ms();
+    if (epoch_ms == 0) {
+        return snprintf(buffer, size, "-");
+    }
+    
+    epoch_ms -= uptime_ms() - time_ms;
+    time_t seconds = (time_t)(epoch_ms / 1000);
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    return snprintf(buffer, size, "%04d-%02d-%02dT%02d:%02d:%02d.%03uZ",
+                    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                    (unsigned)(epoch_ms % 1000));
+}
+
+static bool resolve_server(struct sockaddr_in *addr)
+{
+    char host[MAX_HOST_LENGTH];
+    taskENTER_CRITICAL();
+    strcpy(host, s_host);
+    uint16_t port = s_port;
+    taskEXIT_CRITICAL();
+    
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || res == NULL) {
+        ESP_LOGW(TAG, "DNS lookup failed for %s, retrying in %d s", host, SYSLOG_RESOLVE_RETRY_MS / 1000);
+        return false;
+    }
+    
+    memcpy(addr, res->ai_addr, sizeof(*addr));
+    addr->sin_port = htons(port);
+    freeaddrinfo(res);
+    return true;
+}
+
+static bool flush_datagram(int sock, const struct sockaddr_in *addr)
+{
+    // Token bucket, a burst of SYSLOG_MAX_DATAGRAMS_PER_S and as many per second after it
+    TickType_t now = xTaskGetTickCount();
+    uint32_t refill = (now - s_tokens_refilled) * portTICK_PERIOD_MS * SYSLOG_MAX_DATAGRAMS_PER_S / 1000;
+    if (refill > 0) {
+        s_tokens = (s_tokens + refill > SYSLOG_MAX_DATAGRAMS_PER_S) ? SYSLOG_MAX_DATAGRAMS_PER_S : s_tokens + refill;
+        s_tokens_refilled = now;
+    }
+    if (s_tokens == 0) {
+        taskENTER_CRITICAL();
+        s_stats.throttled++;
+        taskEXIT_CRITICAL();
+        return false;
+    }
+    s_tokens--;
+    
+    // Never waits for buffers, a datagram the stack cannot take right now is dropped
+    int ret = sendto(sock, s_datagram, s_datagram_len, MSG_DONTWAIT, (const struct sockaddr *)addr, sizeof(*addr));
+    taskENTER_CRITICAL();
+    if (ret < 0) {
+        s_stats.send_errors++;
+        s_stats.dropped += s_datagram_lines;
+    } else {
+        s_stats.datagrams++;
+        s_stats.sent += s_datagram_lines;
+    }
+    taskEXIT_CRITICAL();
+    
+    s_datagram_len = 0;
+    s_datagram_lines = 0;
+    return true;
+}
+
+static uint32_t uptime_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
@@ -0,0 +1,21 @@
+#ifndef SYSLOG_SINK_H
+#define SYSLOG_SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t sent;         // Lines that went out
+    uint32_t dropped;      // Overwritten while the network or the rate limit held them back
+    uint32_t datagrams;
+    uint32_t send_errors;  // Datagrams the stack refused, their lines count as dropped
+    uint32_t throttled;    // Flushes postponed by the rate limit
+} syslog_sink_stats_t;
+
+// Function prototypes
+void syslog_sink_start(const char* server);  // host[:port], the port defaults to SYSLOG_DEFAULT_PORT
+void syslog_sink_stop(void);
+bool syslog_sink_is_running(void);
+void syslog_sink_get_stats(syslog_sink_stats_t* stats);
+
+#endif // SYSLOG_SINK_H
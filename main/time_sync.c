@@ -0,0 +1,47 @@
+#include <time.h>
+#include <sys/time.h>
+#include "esp_log.h"
+#include "lwip/apps/sntp.h"
+#include "config.h"
+#include "time_sync.h"
+
+static const char *TAG = "TIME_SYNC";
+
+#define TIME_SYNC_VALID_AFTER 1577836800  // 2020-01-01, anything earlier is the unset RTC
+
+// Global variables
+static bool s_started = false;
+static bool s_synced = false;
+
+void time_sync_start(void)
+{
+    if (s_started) {
+        return;
+    }
+    
+    ESP_LOGI(TAG, "Starting SNTP, server: %s", SNTP_SERVER);
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, SNTP_SERVER);
+    sntp_init();
+    s_started = true;
+}
+
+bool time_sync_is_synced(void)
+{
+    if (!s_synced && time(NULL) > TIME_SYNC_VALID_AFTER) {
+        s_synced = true;
+        ESP_LOGI(TAG, "Clock synchronized");
+    }
+    return s_synced;
+}
+
+uint64_t time_sync_epoch_ms(void)
+{
+    if (!time_sync_is_synced()) {
+        return 0;
+    }
+    
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
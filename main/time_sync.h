@@ -0,0 +1,12 @@
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Function prototypes
+void time_sync_start(void);  // Safe to call on every connect, SNTP is started once
+bool time_sync_is_synced(void);
+uint64_t time_sync_epoch_ms(void);  // 0 until the clock has been set
+
+#endif // TIME_SYNC_H
@@ -1,7 +1,10 @@
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
@@ -12,6 +15,7 @@
 #include "config.h"
 #include "wifi_manager.h"
 #include "health_checker.h"
+#include "time_sync.h"
 
 static const char *TAG = "WIFI_MANAGER";
 
@@ -20,12 +24,52 @@ static EventGroupHandle_t s_wifi_event_group;
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
 
+// An AP seen by a scan, or a profile joined by SSID alone when no scan found it (hidden networks)
+typedef struct {
+    int8_t profile;
+    int8_t rssi;
+    bool bssid_set;
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_candidate_t;
+
 static bool s_wifi_initialized = false;
 static bool s_wifi_connected = false;
 static int s_retry_num = 0;
 
+// Station state, shared by the event handler, the link timer and callers of the API
+static SemaphoreHandle_t s_lock = NULL;
+static TimerHandle_t s_link_timer = NULL;
+static wifi_profile_t s_profiles[MAX_WIFI_PROFILES];  // Priority order
+static uint8_t s_profile_count = 0;
+static bool s_active = false;      // Station wanted, false in AP-only mode
+static wifi_candidate_t s_link = { .profile = -1 };  // AP joined or being joined, profile -1 before the first
+static uint8_t s_failed_mask = 0;  // Profiles that could not be joined in this round
+static bool s_scanning = false;
+static bool s_idle = false;        // Round over without a link, the link timer scans again
+static bool s_switching = false;   // Disconnect requested to join s_link
+static bool s_rescan = false;      // Disconnect requested to pick from new profiles
+static uint8_t s_weak_checks = 0;
+static TickType_t s_roam_scan_tick = 0;
+static bool s_link_lost = false;   // An outage or roam is being timed
+static TickType_t s_link_lost_tick = 0;
+static wifi_candidate_t s_lost_link;
+static wifi_manager_stats_t s_stats;
+
 // Function prototypes
 static esp_err_t wifi_event_handler(void *ctx, system_event_t *event);
+static void get_ap_config(wifi_config_t *wifi_config);
+static void set_profiles(const wifi_profile_t* profiles, uint8_t count);
+static void start_scan(void);
+static void on_scan_done(void);
+static void on_disconnected(uint8_t reason);
+static void on_got_ip(void);
+static void link_timer_callback(TimerHandle_t xTimer);
+static bool select_candidate(const wifi_ap_record_t* records, uint16_t count, wifi_candidate_t* best);
+static bool better_candidate(int8_t profile, int8_t rssi, const wifi_candidate_t* best);
+static bool should_roam(const wifi_candidate_t* candidate);
+static void join(const wifi_candidate_t* candidate);
+static void start_link_timing(void);
 
 void wifi_manager_init(void)
 {
@@ -38,6 +82,9 @@ void wifi_manager_init(void)
     
     // Create event group
     s_wifi_event_group = xEventGroupCreate();
+    s_lock = xSemaphoreCreateMutex();
+    s_link_timer = xTimerCreate("wifi_link", pdMS_TO_TICKS(WIFI_LINK_CHECK_INTERVAL_MS), pdTRUE, NULL,
+                                link_timer_callback);
     
     // Initialize TCP/IP adapter
     tcpip_adapter_init();
@@ -58,23 +105,16 @@ void wifi_manager_start_ap(void)
     ESP_LOGI(TAG, "Starting WiFi AP mode");
     
     // Stop any existing WiFi connection
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_active = false;
+    xSemaphoreGive(s_lock);
+    xTimerStop(s_link_timer, 0);
     esp_wifi_stop();
+    s_wifi_connected = false;
     
     // Configure AP
-    wifi_config_t wifi_config = {
-        .ap = {
-            .ssid = CONFIG_AP_SSID,
-            .ssid_len = strlen(CONFIG_AP_SSID),
-            .channel = CONFIG_AP_CHANNEL,
-            .password = CONFIG_AP_PASSWORD,
-            .max_connection = CONFIG_AP_MAX_CONNECTIONS,
-            .authmode = WIFI_AUTH_WPA_WPA2_PSK
-        },
-    };
-    
-    if (strlen(CONFIG_AP_PASSWORD) == 0) {
-        wifi_config.ap.authmode = WIFI_AUTH_OPEN;
-    }
+    wifi_config_t wifi_config;
+    get_ap_config(&wifi_config);
     
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
@@ -83,25 +123,62 @@ void wifi_manager_start_ap(void)
     ESP_LOGI(TAG, "WiFi AP started. SSID: %s, Password: %s", CONFIG_AP_SSID, CONFIG_AP_PASSWORD);
 }
 
-void wifi_manager_connect_sta(const char* ssid, const char* password)
+void wifi_manager_start_apsta(void)
+{
+    ESP_LOGI(TAG, "Adding configuration AP alongside the station");
+    
+    // No esp_wifi_stop: the station keeps its connection while the AP comes up.
+    // The AP follows the station's channel, so the radio never has to hop.
+    wifi_config_t wifi_config;
+    get_ap_config(&wifi_config);
+    
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
+    
+    ESP_LOGI(TAG, "WiFi AP+STA started. SSID: %s, Password: %s", CONFIG_AP_SSID, CONFIG_AP_PASSWORD);
+}
+
+void wifi_manager_stop_ap(void)
+{
+    ESP_LOGI(TAG, "Removing configuration AP");
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+}
+
+void wifi_manager_update_sta(const wifi_profile_t* profiles, uint8_t count)
+{
+    ESP_LOGI(TAG, "Switching station to %d WiFi profile(s), preferred: %s", count, profiles[0].ssid);
+    
+    // Unlike wifi_manager_connect_sta this keeps the radio (and any AP) running
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    set_profiles(profiles, count);
+    if (s_wifi_connected) {
+        // The disconnect event scans and picks from the new profiles
+        s_rescan = true;
+        esp_wifi_disconnect();
+    } else if (!s_scanning) {
+        start_scan();
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void wifi_manager_connect_sta(const wifi_profile_t* profiles, uint8_t count)
 {
-    ESP_LOGI(TAG, "Connecting to WiFi: %s", ssid);
+    ESP_LOGI(TAG, "Connecting to WiFi, %d profile(s), preferred: %s", count, profiles[0].ssid);
     
     // Stop any existing WiFi connection
     esp_wifi_stop();
     
-    // Configure STA
-    wifi_config_t wifi_config = {0};
-    strncpy((char*)wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
-    strncpy((char*)wifi_config.sta.password, password, sizeof(wifi_config.sta.password));
-    wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    set_profiles(profiles, count);
+    s_active = true;
+    s_wifi_connected = false;
+    s_link_lost = false;
+    xSemaphoreGive(s_lock);
     
+    // The station start event runs the first scan, the profile is picked from its results
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
-    
-    s_retry_num = 0;
-    s_wifi_connected = false;
+    xTimerStart(s_link_timer, 0);
     
     ESP_LOGI(TAG, "WiFi connection initiated");
 }
@@ -109,6 +186,10 @@ void wifi_manager_connect_sta(const char* ssid, const char* password)
 void wifi_manager_stop(void)
 {
     ESP_LOGI(TAG, "Stopping WiFi");
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_active = false;
+    xSemaphoreGive(s_lock);
+    xTimerStop(s_link_timer, 0);
     esp_wifi_stop();
     s_wifi_connected = false;
 }
@@ -118,30 +199,47 @@ bool wifi_manager_is_connected(void)
     return s_wifi_connected;
 }
 
+void wifi_manager_get_stats(wifi_manager_stats_t* stats)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    if (s_wifi_connected && s_link.profile >= 0) {
+        strcpy(stats->ssid, s_profiles[s_link.profile].ssid);
+        stats->profile = s_link.profile;
+        stats->rssi = s_link.rssi;
+    } else {
+        stats->ssid[0] = '\0';
+        stats->profile = -1;
+        stats->rssi = 0;
+    }
+    xSemaphoreGive(s_lock);
+}
+
 static esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
 {
     switch(event->event_id) {
         case SYSTEM_EVENT_STA_START:
             ESP_LOGI(TAG, "WiFi station started");
-            esp_wifi_connect();
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            if (s_active) {
+                start_scan();
+            }
+            xSemaphoreGive(s_lock);
+            break;
+        case SYSTEM_EVENT_SCAN_DONE:
+            on_scan_done();
             break;
         case SYSTEM_EVENT_STA_DISCONNECTED:
-            if (s_retry_num < MAX_RETRY_COUNT) {
-                esp_wifi_connect();
-                s_retry_num++;
-                ESP_LOGI(TAG, "Retry to connect to AP (%d/%d)", s_retry_num, MAX_RETRY_COUNT);
-            } else {
-                xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
-                ESP_LOGI(TAG, "Failed to connect to AP");
-            }
-            s_wifi_connected = false;
+            on_disconnected(event->event_info.disconnected.reason);
             break;
         case SYSTEM_EVENT_STA_GOT_IP:
             ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->event_info.got_ip.ip_info.ip));
-            s_retry_num = 0;
-            s_wifi_connected = true;
+            on_got_ip();
             xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
             
+            // Scheduling slots follow the SNTP clock once it is set
+            time_sync_start();
+            
             // Notify health checker that WiFi is connected
             health_checker_on_wifi_connected();
             break;
@@ -160,3 +258,333 @@ static esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
     }
     return ESP_OK;
 }
+
+// Caller holds s_lock
+static void set_profiles(const wifi_profile_t* profiles, uint8_t count)
+{
+    if (count > MAX_WIFI_PROFILES) {
+        count = MAX_WIFI_PROFILES;
+    }
+    memcpy(s_profiles, profiles, sizeof(wifi_profile_t) * count);
+    s_profile_count = count;
+    s_link.profile = -1;
+    s_failed_mask = 0;
+    s_retry_num = 0;
+    s_idle = false;
+}
+
+// One scan of all channels serves every profile. Caller holds s_lock
+static void start_scan(void)
+{
+    if (s_scanning) {
+        return;
+    }
+    
+    wifi_scan_config_t scan_config = {
+        .ssid = NULL,
+        .bssid = NULL,
+        .channel = 0,
+        .show_hidden = false,
+        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+        .scan_time.active = { .min = 0, .max = WIFI_SCAN_DWELL_MS },
+    };
+    
+    esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+    if (err != ESP_OK) {
+        // Busy connecting or stopping, the link timer tries again
+        ESP_LOGW(TAG, "Scan not started: %s", esp_err_to_name(err));
+        s_idle = true;
+        return;
+    }
+    s_scanning = true;
+    s_idle = false;
+    s_stats.scans++;
+}
+
+static void on_scan_done(void)
+{
+    uint16_t count = WIFI_SCAN_MAX_RECORDS;
+    wifi_ap_record_t *records = malloc(sizeof(wifi_ap_record_t) * count);
+    if (records == NULL || esp_wifi_scan_get_ap_records(&count, records) != ESP_OK) {
+        count = 0;
+    }
+    
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_scanning = false;
+    
+    wifi_candidate_t best;
+    bool found = select_candidate(records, count, &best);
+    free(records);
+    
+    if (!s_active) {
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    
+    // Scan started by the link timer, a working link only moves for a clear gain
+    if (s_wifi_connected) {
+        if (found && should_roam(&best)) {
+            ESP_LOGI(TAG, "Roaming from %s (%d dBm) to %s (%d dBm)", s_profiles[s_link.profile].ssid,
+                     s_link.rssi, s_profiles[best.profile].ssid, best.rssi);
+            s_stats.roams++;
+            start_link_timing();
+            join(&best);
+            s_switching = true;
+            esp_wifi_disconnect();
+        }
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    
+    if (!found) {
+        // Nothing in range, try the remaining profiles by SSID in case they are hidden
+        best.profile = -1;
+        for (uint8_t i = 0; i < s_profile_count; i++) {
+            if (!(s_failed_mask & (1 << i))) {
+                best.profile = i;
+                best.rssi = 0;
+                best.bssid_set = false;
+                best.channel = 0;
+                break;
+            }
+        }
+        if (best.profile < 0) {
+            ESP_LOGW(TAG, "No WiFi profile reachable, scanning again in %d ms", WIFI_LINK_CHECK_INTERVAL_MS);
+            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+            s_failed_mask = 0;
+            s_idle = true;
+            xSemaphoreGive(s_lock);
+            return;
+        }
+    }
+    
+    ESP_LOGI(TAG, "Joining %s (profile %d, %d dBm)", s_profiles[best.profile].ssid, best.profile, best.rssi);
+    join(&best);
+    s_retry_num = 0;
+    esp_wifi_connect();
+    xSemaphoreGive(s_lock);
+}
+
+static void on_disconnected(uint8_t reason)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool was_connected = s_wifi_connected;
+    s_wifi_connected = false;
+    
+    if (!s_active) {
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    
+    if (s_switching) {
+        // Roaming, s_link already holds the new AP
+        s_switching = false;
+        esp_wifi_connect();
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    
+    if (was_connected) {
+        ESP_LOGW(TAG, "Link to %s lost, reason %d", s_link.profile >= 0 ? s_profiles[s_link.profile].ssid : "?",
+                 reason);
+        s_stats.link_losses++;
+        if (!s_rescan) {
+            start_link_timing();
+        }
+    }
+    
+    if (s_rescan) {
+        s_rescan = false;
+        start_scan();
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    
+    // A missing AP is not worth another attempt, the scan finds the next best one
+    bool ap_gone = reason == WIFI_REASON_BEACON_TIMEOUT || reason == WIFI_REASON_NO_AP_FOUND;
+    if (!ap_gone && s_retry_num < WIFI_DIRECT_RETRIES) {
+        s_retry_num++;
+        esp_wifi_connect();
+        ESP_LOGI(TAG, "Retry to connect to AP (%d/%d)", s_retry_num, WIFI_DIRECT_RETRIES);
+    } else {
+        if (!was_connected && s_link.profile >= 0) {
+            s_failed_mask |= 1 << s_link.profile;
+            ESP_LOGI(TAG, "Failed to connect to %s", s_profiles[s_link.profile].ssid);
+        }
+        s_retry_num = 0;
+        start_scan();
+    }
+    xSemaphoreGive(s_lock);
+}
+
+static void on_got_ip(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_link.profile < 0) {
+        // Joined with settings replaced meanwhile, pick again from the new profiles
+        s_rescan = true;
+        esp_wifi_disconnect();
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    
+    s_wifi_connected = true;
+    s_retry_num = 0;
+    s_failed_mask = 0;
+    s_idle = false;
+    s_weak_checks = 0;
+    s_roam_scan_tick = xTaskGetTickCount();
+    
+    // Joined by SSID alone, the AP actually used is only known now
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        memcpy(s_link.bssid, ap.bssid, sizeof(s_link.bssid));
+        s_link.rssi = ap.rssi;
+        s_link.channel = ap.primary;
+    }
+    
+    if (s_link_lost) {
+        uint32_t recovery_ms = (xTaskGetTickCount() - s_link_lost_tick) * portTICK_PERIOD_MS;
+        s_stats.last_recovery_ms = recovery_ms;
+        if (recovery_ms > s_stats.max_recovery_ms) {
+            s_stats.max_recovery_ms = recovery_ms;
+        }
+        if (s_link.profile != s_lost_link.profile || memcmp(s_link.bssid, s_lost_link.bssid, sizeof(s_link.bssid)) != 0) {
+            s_stats.failovers++;
+        }
+        s_link_lost = false;
+        ESP_LOGI(TAG, "Link up on %s after %u ms", s_profiles[s_link.profile].ssid, recovery_ms);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+static void link_timer_callback(TimerHandle_t xTimer)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!s_active || s_scanning || s_switching) {
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    
+    if (!s_wifi_connected) {
+        if (s_idle) {
+            start_scan();
+        }
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        s_link.rssi = ap.rssi;
+        s_weak_checks = ap.rssi < WIFI_MIN_RSSI ? s_weak_checks + 1 : 0;
+    }
+    
+    // Look around when the link keeps reading weak, or now and then while on a backup profile
+    bool weak = s_weak_checks >= WIFI_WEAK_CHECKS;
+    bool on_backup = s_link.profile > 0 &&
+                     (xTaskGetTickCount() - s_roam_scan_tick) >= pdMS_TO_TICKS(WIFI_PREFERRED_RESCAN_MS);
+    if (weak || on_backup) {
+        s_weak_checks = 0;
+        s_roam_scan_tick = xTaskGetTickCount();
+        start_scan();
+    }
+    xSemaphoreGive(s_lock);
+}
+
+// Caller holds s_lock
+static bool select_candidate(const wifi_ap_record_t* records, uint16_t count, wifi_candidate_t* best)
+{
+    best->profile = -1;
+    for (uint16_t i = 0; i < count; i++) {
+        for (uint8_t k = 0; k < s_profile_count; k++) {
+            if ((s_failed_mask & (1 << k)) || strcmp((const char*)records[i].ssid, s_profiles[k].ssid) != 0) {
+                continue;
+            }
+            if (better_candidate(k, records[i].rssi, best)) {
+                best->profile = k;
+                best->rssi = records[i].rssi;
+                best->bssid_set = true;
+                memcpy(best->bssid, records[i].bssid, sizeof(best->bssid));
+                best->channel = records[i].primary;
+            }
+            break;
+        }
+    }
+    return best->profile >= 0;
+}
+
+// Usable APs (at least WIFI_MIN_RSSI) first, then priority, then signal
+static bool better_candidate(int8_t profile, int8_t rssi, const wifi_candidate_t* best)
+{
+    if (best->profile < 0) {
+        return true;
+    }
+    bool usable = rssi >= WIFI_MIN_RSSI;
+    bool best_usable = best->rssi >= WIFI_MIN_RSSI;
+    if (usable != best_usable) {
+        return usable;
+    }
+    if (usable && profile != best->profile) {
+        return profile < best->profile;
+    }
+    return rssi > best->rssi;
+}
+
+// Caller holds s_lock
+static bool should_roam(const wifi_candidate_t* candidate)
+{
+    if (candidate->profile == s_link.profile &&
+        memcmp(candidate->bssid, s_link.bssid, sizeof(candidate->bssid)) == 0) {
+        return false;
+    }
+    if (candidate->profile < s_link.profile && candidate->rssi >= WIFI_MIN_RSSI) {
+        return true;
+    }
+    return candidate->rssi >= s_link.rssi + WIFI_ROAM_HYSTERESIS_DB;
+}
+
+// Points the station at the candidate, a known BSSID and channel skip the scan inside esp_wifi_connect.
+// Caller holds s_lock
+static void join(const wifi_candidate_t* candidate)
+{
+    const wifi_profile_t* profile = &s_profiles[candidate->profile];
+    wifi_config_t wifi_config = {0};
+    strncpy((char*)wifi_config.sta.ssid, profile->ssid, sizeof(wifi_config.sta.ssid));
+    strncpy((char*)wifi_config.sta.password, profile->password, sizeof(wifi_config.sta.password));
+    wifi_config.sta.threshold.authmode = strlen(profile->password) > 0 ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+    wifi_config.sta.bssid_set = candidate->bssid_set;
+    memcpy(wifi_config.sta.bssid, candidate->bssid, sizeof(wifi_config.sta.bssid));
+    wifi_config.sta.channel = candidate->channel;
+    
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    s_link = *candidate;
+}
+
+// Caller holds s_lock
+static void start_link_timing(void)
+{
+    if (!s_link_lost) {
+        s_link_lost = true;
+        s_link_lost_tick = xTaskGetTickCount();
+        s_lost_link = s_link;
+    }
+}
+
+static void get_ap_config(wifi_config_t *wifi_config)
+{
+    *wifi_config = (wifi_config_t) {
+        .ap = {
+            .ssid = CONFIG_AP_SSID,
+            .ssid_len = strlen(CONFIG_AP_SSID),
+            .channel = CONFIG_AP_CHANNEL,
+            .password = CONFIG_AP_PASSWORD,
+            .max_connection = CONFIG_AP_MAX_CONNECTIONS,
+            .authmode = WIFI_AUTH_WPA_WPA2_PSK
+        },
+    };
+    
+    if (strlen(CONFIG_AP_PASSWORD) == 0) {
+        wifi_config->ap.authmode = WIFI_AUTH_OPEN;
+    }
+}
@@ -2,12 +2,29 @@
 #define WIFI_MANAGER_H
 
 #include "esp_wifi.h"
+#include "config.h"
+
+typedef struct {
+    char ssid[MAX_WIFI_SSID_LENGTH];  // Current link, empty while disconnected
+    int8_t profile;                   // Priority of the current link, -1 while disconnected
+    int8_t rssi;                      // dBm
+    uint32_t link_losses;             // Established links that dropped
+    uint32_t roams;                   // Working links moved to a stronger or preferred AP
+    uint32_t failovers;               // Recoveries that ended on another AP or profile
+    uint32_t scans;
+    uint32_t last_recovery_ms;        // From link loss or roam start to a new IP
+    uint32_t max_recovery_ms;
+} wifi_manager_stats_t;
 
 // Function prototypes
 void wifi_manager_init(void);
 void wifi_manager_start_ap(void);
-void wifi_manager_connect_sta(const char* ssid, const char* password);
+void wifi_manager_start_apsta(void);  // Adds the configuration AP without dropping the station link
+void wifi_manager_stop_ap(void);
+void wifi_manager_connect_sta(const wifi_profile_t* profiles, uint8_t count);  // profiles[0] is preferred
+void wifi_manager_update_sta(const wifi_profile_t* profiles, uint8_t count);  // New profiles without restarting WiFi
 void wifi_manager_stop(void);
 bool wifi_manager_is_connected(void);
+void wifi_manager_get_stats(wifi_manager_stats_t* stats);
 
 #endif // WIFI_MANAGER_H
@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+"""Measures how well the device detects the outages played by fault_server.py.
+
+For each scenario the harness points the device at the local fault server,
+waits until the relay is on, plays the scenario while polling GET /status,
+and reports:
+
+- detection latency: outage start until the relay switched off
+- recovery latency: outage end until the relay switched back on
+- false trips: relay switched off outside an outage (plus a grace period)
+- relay toggles, and the probe outcomes the device recorded (GET /stats)
+
+Example:
+
+    python3 tools/detection_harness.py --device 192.168.1.50 --host-ip 192.168.1.10 \\
+        --token secret --interval 10 tools/scenarios/*.json
+"""
+
+import argparse
+import json
+import sys
+import time
+import urllib.error
+import urllib.request
+
+from fault_server import FaultServer, load_scenario
+
+
+class Device:
+    def __init__(self, address, token=None, timeout=3):
+        self.base = "http://%s" % address
+        self.token = token
+        self.timeout = timeout
+
+    def _request(self, path, body=None):
+        data = json.dumps(body).encode() if body is not None else None
+        request = urllib.request.Request(self.base + path, data=data)
+        if data is not None:
+            request.add_header("Content-Type", "application/json")
+            if self.token:
+                request.add_header("Authorization", "Bearer " + self.token)
+        with urllib.request.urlopen(request, timeout=self.timeout) as response:
+            return json.loads(response.read().decode())
+
+    def relay_on(self):
+        """True/False, or None when the device did not answer."""
+        try:
+            return self._request("/status").get("relay") == "on"
+        except (urllib.error.URLError, OSError, ValueError):
+            return None
+
+    def reasons(self):
+        try:
+            targets = self._request("/stats").get("targets", [])
+        except (urllib.error.URLError, OSError, ValueError):
+            return {}
+        return targets[0].get("reasons", {}) if targets else {}
+
+    def configure(self, settings):
+        return self._request("/config", settings)
+
+
+def target_url(scenario, args):
+    kind = scenario["target"]
+    if kind == "https":
+        return "https://%s:%d/health" % (args.host_ip, args.tls_port)
+    if kind == "dns":
+        return "http://%s:%d/health" % (args.dns_name, args.port)
+    return "http://%s:%d/health" % (args.host_ip, args.port)
+
+
+def wait_for_relay(device, on, limit):
+    deadline = time.monotonic() + limit
+    while time.monotonic() < deadline:
+        if device.relay_on() == on:
+            return True
+        time.sleep(0.5)
+    return False
+
+
+def record_relay(device, seconds, poll):
+    """List of (time, relay_on) for every change seen while polling."""
+    changes = []
+    last = device.relay_on()
+    end = time.monotonic() + seconds
+    while time.monotonic() < end:
+        time.sleep(poll)
+        state = device.relay_on()
+        if state is None or state == last:
+            continue
+        changes.append((time.monotonic(), state))
+        last = state
+    return changes
+
+
+def score(windows, changes, grace, total_s):
+    detections = []
+    recoveries = []
+    false_trips = 0
+    missed = 0
+
+    # A switch-off belongs to the outage it falls in, or just after it when the outage was shorter
+    # than the detection path; anything else is a false trip
+    for start, end in windows:
+        off = next((t for t, on in changes if not on and start <= t < end + grace), None)
+        if off is None:
+            missed += 1
+            continue
+        detections.append(off - start)
+        back = next((t for t, on in changes if on and t >= max(end, off)), None)
+        if back is not None:
+            recoveries.append(back - end)
+    for t, on in changes:
+        if not on and not any(start <= t < end + grace for start, end in windows):
+            false_trips += 1
+
+    outage_s = sum(end - start for start, end in windows)
+    healthy_h = max(total_s - outage_s, 0) / 3600.0
+    return {
+        "outages": len(windows),
+        "missed": missed,
+        "detect_s": mean(detections),
+        "detect_max_s": max(detections) if detections else None,
+        "recover_s": mean(recoveries),
+        "false_trips": false_trips,
+        "false_trips_per_h": false_trips / healthy_h if healthy_h > 0 else None,
+        "toggles": len(changes),
+    }
+
+
+def mean(values):
+    return sum(values) / len(values) if values else None
+
+
+def run_scenario(server, device, scenario, args):
+    url = target_url(scenario, args)
+    if args.token:
+        settings = {"health_check_url": url, "check_interval": args.interval * 1000}
+        if args.schedule:
+            settings["schedule"] = args.schedule
+        device.configure(settings)
+
+    # Start every scenario from a healthy, settled device
+    server.play({"phases": []})
+    if not wait_for_relay(device, True, args.warmup):
+        return {"error": "relay did not turn on within %d s" % args.warmup}
+
+    before = device.reasons()
+    server.play(scenario)
+    changes = record_relay(device, server.player.duration + args.settle, args.poll)
+    after = device.reasons()
+
+    result = score(server.player.outage_windows(), changes, args.interval * 2, server.player.duration)
+    result["probes"] = {k: after.get(k, 0) - before.get(k, 0) for k in after if after.get(k, 0) != before.get(k, 0)}
+    return result
+
+
+def fmt(value):
+    if value is None:
+        return "-"
+    return "%.1f" % value if isinstance(value, float) else str(value)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Detection quality of the health monitor under scripted faults")
+    parser.add_argument("scenarios", nargs="+")
+    parser.add_argument("--device", required=True, help="Device address in execution mode")
+    parser.add_argument("--host-ip", required=True, help="Address of this machine as seen by the device")
+    parser.add_argument("--token", help="api_token, lets the harness point the device at the fault server")
+    parser.add_argument("--interval", type=int, default=10, help="Check interval in s")
+    parser.add_argument("--schedule", choices=("spread", "fixed"))
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--tls-port", type=int, default=8443)
+    parser.add_argument("--cert")
+    parser.add_argument("--key")
+    parser.add_argument("--dns-port", type=int, help="Needs the device's DHCP DNS pointed at this machine")
+    parser.add_argument("--dns-name", default="fault.test")
+    parser.add_argument("--poll", type=float, default=0.5, help="Relay polling period in s")
+    parser.add_argument("--warmup", type=int, default=120)
+    parser.add_argument("--settle", type=int, default=60, help="Extra observation after the scenario in s")
+    parser.add_argument("--json", help="Also write the results here")
+    args = parser.parse_args()
+
+    server = FaultServer(port=args.port, tls_port=args.tls_port, cert=args.cert, key=args.key,
+                         dns_port=args.dns_port, dns_name=args.dns_name, answer_ip=args.host_ip)
+    server.start()
+    device = Device(args.device, args.token)
+
+    results = {}
+    try:
+        for path in args.scenarios:
+            scenario = load_scenario(path)
+            print("== %s (%d s)" % (scenario["name"], sum(p["duration"] for p in scenario["phases"])),
+                  file=sys.stderr)
+            results[scenario["name"]] = run_scenario(server, device, scenario, args)
+    finally:
+        server.stop()
+
+    columns = ("outages", "missed", "detect_s", "detect_max_s", "recover_s", "false_trips",
+               "false_trips_per_h", "toggles")
+    print("%-20s %s" % ("scenario", " ".join("%12s" % c for c in columns)))
+    for name, result in results.items():
+        if "error" in result:
+            print("%-20s %s" % (name, result["error"]))
+            continue
+        print("%-20s %s" % (name, " ".join("%12s" % fmt(result[c]) for c in columns)))
+        if result["probes"]:
+            print("%-20s probes: %s" % ("", ", ".join("%s=%d" % kv for kv in sorted(result["probes"].items()))))
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
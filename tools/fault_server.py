@@ -0,0 +1,309 @@
+#!/usr/bin/env python3
+"""Local stand-in for a monitored service that misbehaves on a script.
+
+Serves a health endpoint whose behaviour follows the phases of a scenario
+file (see tools/scenarios/). Besides plain HTTP it can listen on a TLS port
+and answer DNS queries, so handshake and name resolution failures can be
+played back too. Used by detection_harness.py, but can also run on its own:
+
+    python3 tools/fault_server.py tools/scenarios/latency_spike.json --port 8080
+"""
+
+import argparse
+import json
+import socket
+import socketserver
+import ssl
+import struct
+import threading
+import time
+
+# Modes that break a phase of the exchange, everything else answers normally
+HTTP_MODES = ("ok", "delay", "status", "reset", "stall", "slow_body")
+TLS_MODES = ("tls_error", "tls_stall")
+DNS_MODES = ("dns_fail", "dns_stall")
+MODES = HTTP_MODES + TLS_MODES + DNS_MODES
+
+# handshake_failure alert, what a server with no usable cipher sends
+TLS_ALERT = b"\x15\x03\x01\x00\x02\x02\x28"
+
+STALL_MAX_S = 60
+
+
+def load_scenario(path):
+    with open(path) as f:
+        scenario = json.load(f)
+    for phase in scenario["phases"]:
+        if phase.get("mode", "ok") not in MODES:
+            raise ValueError("%s: unknown mode %r" % (path, phase["mode"]))
+        phase.setdefault("mode", "ok")
+        # Ground truth for the harness, modes that only slow things down may override it
+        phase.setdefault("outage", phase["mode"] != "ok")
+    scenario.setdefault("name", path)
+    scenario.setdefault("target", "http")
+    return scenario
+
+
+class ScenarioPlayer:
+    """Maps wall-clock time to the scenario phase in effect."""
+
+    def __init__(self, scenario):
+        self.scenario = scenario
+        self.start = None
+
+    def begin(self):
+        self.start = time.monotonic()
+
+    @property
+    def duration(self):
+        return sum(p["duration"] for p in self.scenario["phases"])
+
+    def current(self):
+        if self.start is None:
+            return {"mode": "ok", "outage": False}
+        elapsed = time.monotonic() - self.start
+        for phase in self.scenario["phases"]:
+            if elapsed < phase["duration"]:
+                return phase
+            elapsed -= phase["duration"]
+        return {"mode": "ok", "outage": False}
+
+    def outage_windows(self):
+        """Absolute (start, end) of each run of outage phases."""
+        windows = []
+        t = self.start
+        for phase in self.scenario["phases"]:
+            end = t + phase["duration"]
+            if phase["outage"]:
+                if windows and windows[-1][1] == t:
+                    windows[-1] = (windows[-1][0], end)
+                else:
+                    windows.append((t, end))
+            t = end
+        return windows
+
+
+class FaultServer:
+    def __init__(self, bind="0.0.0.0", port=8080, tls_port=None, cert=None, key=None,
+                 dns_port=None, dns_name=None, answer_ip=None):
+        self.player = ScenarioPlayer({"phases": []})
+        self.requests = []  # (monotonic time, mode) of every probe that reached us
+        self.lock = threading.Lock()
+        self.dns_name = dns_name.lower().rstrip(".") if dns_name else None
+        self.answer_ip = answer_ip
+        self.servers = []
+
+        self._add_tcp(bind, port, self._handle_http)
+        if tls_port:
+            self.tls_context = None
+            if cert and key:
+                self.tls_context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+                self.tls_context.load_cert_chain(cert, key)
+            self._add_tcp(bind, tls_port, self._handle_tls)
+        if dns_port:
+            self._add_udp(bind, dns_port)
+
+    def play(self, scenario):
+        self.player = ScenarioPlayer(scenario)
+        self.player.begin()
+
+    def start(self):
+        for server in self.servers:
+            threading.Thread(target=server.serve_forever, daemon=True).start()
+
+    def stop(self):
+        for server in self.servers:
+            server.shutdown()
+            server.server_close()
+
+    def _add_tcp(self, bind, port, handler):
+        class Handler(socketserver.BaseRequestHandler):
+            def handle(self):
+                handler(self.request)
+
+        server = socketserver.ThreadingTCPServer((bind, port), Handler, bind_and_activate=False)
+        server.allow_reuse_address = True
+        server.daemon_threads = True
+        server.server_bind()
+        server.server_activate()
+        self.servers.append(server)
+
+    def _add_udp(self, bind, port):
+        owner = self
+
+        class Handler(socketserver.BaseRequestHandler):
+            def handle(self):
+                data, sock = self.request
+                reply = owner._dns_reply(data)
+                if reply is not None:
+                    sock.sendto(reply, self.client_address)
+
+        server = socketserver.ThreadingUDPServer((bind, port), Handler)
+        server.daemon_threads = True
+        self.servers.append(server)
+
+    def _record(self, mode):
+        with self.lock:
+            self.requests.append((time.monotonic(), mode))
+
+    def _handle_http(self, conn):
+        self._serve(conn, self.player.current())
+
+    def _handle_tls(self, conn):
+        phase = self.player.current()
+        mode = phase["mode"]
+        if mode == "tls_error":
+            self._record(mode)
+            conn.settimeout(5)
+            try:
+                conn.recv(1024)  # ClientHello
+                conn.sendall(TLS_ALERT)
+            except OSError:
+                pass
+            return
+        if mode == "tls_stall":
+            self._record(mode)
+            self._stall(conn)
+            return
+        if self.tls_context is None:
+            return  # No certificate, the TLS port can only misbehave
+        try:
+            conn = self.tls_context.wrap_socket(conn, server_side=True)
+        except (OSError, ssl.SSLError):
+            return
+        self._serve(conn, phase)
+
+    def _serve(self, conn, phase):
+        mode = phase["mode"]
+        conn.settimeout(10)
+        try:
+            request = b""
+            while b"\r\n\r\n" not in request and len(request) < 4096:
+                chunk = conn.recv(1024)
+                if not chunk:
+                    return
+                request += chunk
+        except OSError:
+            return
+        self._record(mode)
+
+        try:
+            if mode == "reset":
+                # Zero linger turns close() into a RST
+                conn.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+                conn.close()
+                return
+            if mode == "stall":
+                self._stall(conn)
+                return
+            if mode == "delay":
+                time.sleep(phase.get("delay_ms", 5000) / 1000.0)
+            if mode == "status":
+                headers = {}
+                if "retry_after" in phase:
+                    headers["Retry-After"] = str(phase["retry_after"])
+                self._respond(conn, phase.get("status", 503), b"fault\n", headers)
+                return
+            if mode == "slow_body":
+                self._drip(conn, phase)
+                return
+            self._respond(conn, 200, b"ok\n")
+        except OSError:
+            pass
+
+    def _respond(self, conn, status, body, headers=None):
+        lines = ["HTTP/1.1 %d %s" % (status, "OK" if status == 200 else "Fault"),
+                 "Content-Length: %d" % len(body),
+                 "Connection: close"]
+        for name, value in (headers or {}).items():
+            lines.append("%s: %s" % (name, value))
+        conn.sendall(("\r\n".join(lines) + "\r\n\r\n").encode() + body)
+
+    def _drip(self, conn, phase):
+        size = phase.get("body_bytes", 64)
+        interval = phase.get("byte_interval_ms", 1000) / 1000.0
+        conn.sendall(("HTTP/1.1 200 OK\r\nContent-Length: %d\r\nConnection: close\r\n\r\n" % size).encode())
+        for _ in range(size):
+            time.sleep(interval)
+            conn.sendall(b".")
+
+    def _stall(self, conn):
+        # Hold the connection open without a word until the client gives up
+        conn.settimeout(STALL_MAX_S)
+        try:
+            while conn.recv(1024):
+                pass
+        except OSError:
+            pass
+
+    def _dns_reply(self, query):
+        if len(query) < 12:
+            return None
+        mode = self.player.current()["mode"]
+        if mode == "dns_stall":
+            self._record(mode)
+            return None
+
+        # Question section: labels up to the root, then QTYPE and QCLASS
+        pos = 12
+        labels = []
+        while pos < len(query) and query[pos] != 0:
+            length = query[pos]
+            labels.append(query[pos + 1:pos + 1 + length].decode(errors="replace"))
+            pos += 1 + length
+        question_end = pos + 5
+        if question_end > len(query):
+            return None
+        name = ".".join(labels).lower()
+        qtype = struct.unpack("!H", query[pos + 1:pos + 3])[0]
+
+        txid = query[:2]
+        question = query[12:question_end]
+        known = self.dns_name is None or name == self.dns_name
+        if mode == "dns_fail" or not known:
+            self._record("dns_fail")
+            # Standard response, recursion available, NXDOMAIN
+            return txid + struct.pack("!HHHHH", 0x8183, 1, 0, 0, 0) + question
+        if qtype != 1 or self.answer_ip is None:
+            return txid + struct.pack("!HHHHH", 0x8180, 1, 0, 0, 0) + question
+        # TTL 0 so the device resolves again on every probe
+        answer = struct.pack("!HHHIH", 0xC00C, 1, 1, 0, 4) + socket.inet_aton(self.answer_ip)
+        return txid + struct.pack("!HHHHH", 0x8180, 1, 1, 0, 0) + question + answer
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Play a fault scenario on a local health endpoint")
+    parser.add_argument("scenario")
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--tls-port", type=int)
+    parser.add_argument("--cert")
+    parser.add_argument("--key")
+    parser.add_argument("--dns-port", type=int)
+    parser.add_argument("--dns-name", help="Only this name resolves, anything else is NXDOMAIN")
+    parser.add_argument("--answer-ip", help="Address returned for --dns-name")
+    args = parser.parse_args()
+
+    server = FaultServer(args.bind, args.port, args.tls_port, args.cert, args.key,
+                         args.dns_port, args.dns_name, args.answer_ip)
+    server.start()
+    scenario = load_scenario(args.scenario)
+    server.play(scenario)
+    print("Playing %s for %d s" % (scenario["name"], server.player.duration))
+
+    last = None
+    try:
+        while time.monotonic() - server.player.start < server.player.duration:
+            mode = server.player.current()["mode"]
+            if mode != last:
+                print("%7.1f s  %s" % (time.monotonic() - server.player.start, mode))
+                last = mode
+            time.sleep(0.2)
+    except KeyboardInterrupt:
+        pass
+    server.stop()
+    print("%d probes received" % len(server.requests))
+
+
+if __name__ == "__main__":
+    main()
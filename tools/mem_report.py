@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""DRAM, IRAM and flash usage per module, read from the linker map.
+
+Every input section in the map is assigned to a memory by its address, so
+the report does not depend on the SDK's output section names. Objects of
+the main component are listed one per source file, everything else per
+library. With --budget the script exits non-zero when a module or the
+total goes over its limit:
+
+    python3 tools/mem_report.py build/monitor-health-checker.map --budget tools/mem_budget.json
+
+Also available as `make mem-report`.
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+# ESP8266 address map
+REGIONS = (
+    ("dram", 0x3FFE8000, 0x40000000),
+    ("iram", 0x40100000, 0x40200000),
+    ("flash", 0x40200000, 0x40400000),
+)
+MEMORIES = tuple(name for name, _, _ in REGIONS)
+
+# " .text.name  0x40201234  0x34 path/libmain.a(probe.o)", the name may sit alone on the previous line
+SECTION_LINE = re.compile(r"^\s*(\.\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+NAME_ONLY = re.compile(r"^\s(\.\S+)\s*$")
+ARCHIVE_MEMBER = re.compile(r"(?:^|/)(lib[^/(]+)\.a\(([^)]+)\)$")
+
+
+def region_of(address):
+    for name, start, end in REGIONS:
+        if start <= address < end:
+            return name
+    return None
+
+
+def module_of(path, main_lib):
+    member = ARCHIVE_MEMBER.search(path)
+    if member:
+        library, obj = member.groups()
+        if library == main_lib:
+            return "main/" + os.path.splitext(obj)[0]
+        return library[3:]
+    return os.path.splitext(os.path.basename(path))[0]
+
+
+def parse_map(path, main_lib="libmain"):
+    usage = {}
+    pending = None
+    in_memory_map = False
+    with open(path, errors="replace") as f:
+        for line in f:
+            if not in_memory_map:
+                in_memory_map = line.startswith("Linker script and memory map")
+                continue
+            if line.startswith("OUTPUT(") or line.startswith("/DISCARD/"):
+                break
+            name_only = NAME_ONLY.match(line)
+            if name_only:
+                pending = name_only.group(1)
+                continue
+            match = SECTION_LINE.match(line)
+            section = pending
+            pending = None
+            if not match:
+                continue
+            section = match.group(1) or section
+            address, size, source = int(match.group(2), 16), int(match.group(3), 16), match.group(4).strip()
+            # Fill lines and symbol lines have no input file
+            if section is None or size == 0 or source.startswith("*") or "(" not in source and "/" not in source:
+                continue
+            region = region_of(address)
+            if region is None:
+                continue
+            counts = usage.setdefault(module_of(source, main_lib), dict.fromkeys(MEMORIES, 0))
+            counts[region] += size
+    return usage
+
+
+def check_budget(usage, budget):
+    """List of (what, memory, used, limit) for everything over its budget."""
+    over = []
+    totals = {m: sum(u[m] for u in usage.values()) for m in MEMORIES}
+    for memory, limit in budget.get("total", {}).items():
+        if totals[memory] > limit:
+            over.append(("total", memory, totals[memory], limit))
+    for module, limits in budget.get("modules", {}).items():
+        used = usage.get(module, dict.fromkeys(MEMORIES, 0))
+        for memory, limit in limits.items():
+            if used[memory] > limit:
+                over.append((module, memory, used[memory], limit))
+    return over
+
+
+def print_report(usage, limit):
+    rows = sorted(usage.items(), key=lambda kv: (kv[1]["dram"], kv[1]["iram"], kv[1]["flash"]), reverse=True)
+    print("%-28s %8s %8s %8s" % ("module", "dram", "iram", "flash"))
+    for module, counts in rows[:limit] if limit else rows:
+        print("%-28s %8d %8d %8d" % (module, counts["dram"], counts["iram"], counts["flash"]))
+    totals = [sum(u[m] for u in usage.values()) for m in MEMORIES]
+    print("%-28s %8d %8d %8d" % ("total", *totals))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Per-module memory usage from the linker map")
+    parser.add_argument("map")
+    parser.add_argument("--budget", help="JSON with total and per-module limits in bytes")
+    parser.add_argument("--main-lib", default="libmain", help="Library listed per source file")
+    parser.add_argument("--top", type=int, default=0, help="Only the N biggest modules, 0 lists all")
+    parser.add_argument("--json", help="Also write the usage here")
+    args = parser.parse_args()
+
+    usage = parse_map(args.map, args.main_lib)
+    if not usage:
+        sys.exit("%s: no sections found, is it a linker map?" % args.map)
+    print_report(usage, args.top)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(usage, f, indent=2, sort_keys=True)
+
+    if args.budget:
+        with open(args.budget) as f:
+            over = check_budget(usage, json.load(f))
+        for what, memory, used, limit in over:
+            print("OVER BUDGET: %s %s %d > %d bytes" % (what, memory, used, limit), file=sys.stderr)
+        if over:
+            sys.exit(1)
+        print("Within budget")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Local collector for the device's remote syslog stream.
+
+The device batches several RFC 5424 messages into one UDP datagram, one per
+line. This listener splits them, prints one line per message and keeps
+counts per severity, which is enough to check the stream without setting up
+rsyslog. Point the device at this machine with POST /config
+{"syslog_server": "<ip>:5514"} and run:
+
+    python3 tools/syslog_listener.py --port 5514
+"""
+
+import argparse
+import json
+import re
+import socket
+import sys
+import time
+
+SEVERITIES = ("emerg", "alert", "crit", "err", "warning", "notice", "info", "debug")
+
+# <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG
+RFC5424 = re.compile(r"^<(\d{1,3})>1 (\S+) (\S+) (\S+) (\S+) (\S+) (-|\[.*?\]) ?(.*)$")
+
+
+def parse(line):
+    match = RFC5424.match(line)
+    if not match:
+        return None
+    pri = int(match.group(1))
+    return {
+        "facility": pri // 8,
+        "severity": SEVERITIES[pri % 8],
+        "timestamp": match.group(2),
+        "hostname": match.group(3),
+        "app": match.group(4),
+        "msgid": match.group(6),
+        "msg": match.group(8),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Print the syslog stream of the health monitor")
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=5514)
+    parser.add_argument("--duration", type=float, help="Stop after this many s and print the counts")
+    parser.add_argument("--json", action="store_true", help="One JSON object per message")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    sock.settimeout(0.5)
+
+    counts = {"datagrams": 0, "messages": 0, "invalid": 0}
+    end = time.monotonic() + args.duration if args.duration else None
+    try:
+        while end is None or time.monotonic() < end:
+            try:
+                data, sender = sock.recvfrom(2048)
+            except socket.timeout:
+                continue
+            counts["datagrams"] += 1
+            for line in data.decode(errors="replace").split("\n"):
+                if not line:
+                    continue
+                message = parse(line)
+                if message is None:
+                    counts["invalid"] += 1
+                    print("?? %s" % line, file=sys.stderr)
+                    continue
+                counts["messages"] += 1
+                counts[message["severity"]] = counts.get(message["severity"], 0) + 1
+                if args.json:
+                    print(json.dumps(message))
+                else:
+                    print("%s %s %-7s %-16s %s" % (message["timestamp"], message["hostname"],
+                                                   message["severity"], message["msgid"], message["msg"]))
+                sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+
+    print(", ".join("%s=%d" % kv for kv in counts.items()), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()